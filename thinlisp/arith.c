@@ -0,0 +1,256 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "bistack.h"
+#include "cell.h"
+#include "value.h"
+#include "arith.h"
+
+
+VALUE arith_box(BISTACK *bs, int32_t n) {
+    if (value_fixnum_fits(n)) {
+        return value_fixnum(n);
+    }
+    CELLHEADER *cell = bistack_allocf(bs, sizeof(CELLHEADER) + sizeof(n));
+    *cell = (CELLHEADER){
+        .Extended={
+            .type=AST_NONE,
+            .kind=CELL_EXT_INT32,
+            .prefix=0,
+            .flags=0,
+        }
+    };
+    memcpy(&cell[1], &n, sizeof(n));
+    return value_of_cell(bs, cell);
+}
+
+
+VALUE arith_slow2(BISTACK *bs, char op, VALUE a, VALUE b) {
+    int64_t x = value_integer(bs, a);
+    int64_t y = value_integer(bs, b);
+    int64_t n;
+    switch (op) {
+    case ARITH_ADD:
+        n = x + y;
+        break;
+    case ARITH_SUBTRACT:
+        n = x - y;
+        break;
+    case ARITH_MULTIPLY:
+        n = x * y;
+        break;
+    case ARITH_DIVIDE:
+        lassert(y != 0, ARITH_DIVIDE_BY_ZERO);
+        n = x / y;
+        break;
+    default:
+        lerror(ARITH_ARITY_ERROR, PSTR("unknown operator %c"), op);
+    }
+    lassert(n >= INT32_MIN && n <= INT32_MAX, ARITH_OVERFLOW_ERROR);
+    return arith_box(bs, n);
+}
+
+
+char arith_less_slow2(BISTACK *bs, VALUE a, VALUE b) {
+    return value_integer(bs, a) < value_integer(bs, b);
+}
+
+
+static VALUE arith_op2(BISTACK *bs, char op, VALUE a, VALUE b) {
+    switch (op) {
+    case ARITH_ADD:
+        return arith_add2(bs, a, b);
+    case ARITH_SUBTRACT:
+        return arith_sub2(bs, a, b);
+    case ARITH_MULTIPLY:
+        return arith_mul2(bs, a, b);
+    default:
+        return arith_div2(bs, a, b);
+    }
+}
+
+
+VALUE arith_fold(BISTACK *bs, char op, VALUE *args, uint8_t nargs) {
+    if (nargs == 0) {
+        lassert(
+            op == ARITH_ADD || op == ARITH_MULTIPLY, ARITH_ARITY_ERROR);
+        return value_fixnum(op == ARITH_ADD ? 0 : 1);
+    } else if (nargs == 1) {
+        if (op == ARITH_SUBTRACT) {
+            return arith_sub2(bs, value_fixnum(0), args[0]);
+        } else if (op == ARITH_DIVIDE) {
+            return arith_div2(bs, value_fixnum(1), args[0]);
+        }
+        // checks the argument is a number
+        return arith_op2(
+            bs, op, args[0], value_fixnum(op == ARITH_ADD ? 0 : 1));
+    }
+
+    VALUE acc = args[0];
+    for (uint8_t i=1; i<nargs; i++) {
+        acc = arith_op2(bs, op, acc, args[i]);
+    }
+    return acc;
+}
+
+
+char arith_less(BISTACK *bs, VALUE *args, uint8_t nargs) {
+    for (uint8_t i=1; i<nargs; i++) {
+        if (!arith_less2(bs, args[i - 1], args[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+#ifdef ARITH_TEST
+#include <stdio.h>
+#include <setjmp.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static uint8_t heap[4096];
+
+static char * test_fixnums() {
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+    void *forwardptr = bs->forwardptr;
+
+    mu_assert("wrong sum",
+        arith_add2(bs, value_fixnum(-7), value_fixnum(12)) == value_fixnum(5));
+    mu_assert("wrong difference",
+        arith_sub2(bs, value_fixnum(-7), value_fixnum(12)) ==
+        value_fixnum(-19));
+    mu_assert("wrong product",
+        arith_mul2(bs, value_fixnum(-7), value_fixnum(12)) ==
+        value_fixnum(-84));
+    mu_assert("wrong quotient",
+        arith_div2(bs, value_fixnum(-7), value_fixnum(2)) ==
+        value_fixnum(-3));
+    mu_assert("wrong comparison",
+        arith_less2(bs, value_fixnum(-7), value_fixnum(2)) &&
+        !arith_less2(bs, value_fixnum(2), value_fixnum(2)));
+
+    // a counting loop runs in immediate values
+    VALUE total = value_fixnum(0);
+    for (VALUE i=value_fixnum(1); arith_less2(bs, i, value_fixnum(101));
+            i=arith_add2(bs, i, value_fixnum(1))) {
+        total = arith_add2(bs, total, i);
+    }
+    mu_assert("wrong loop total", total == value_fixnum(5050));
+    mu_assert("fixnums allocated", bs->forwardptr == forwardptr);
+    return 0;
+}
+
+
+static char * test_promotion() {
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+    void *forwardptr = bs->forwardptr;
+
+    // results beyond a fixnum are boxed, and unboxed again once they fit
+    VALUE big = arith_add2(
+        bs, value_fixnum(VALUE_FIXNUM_MAX), value_fixnum(1));
+    mu_assert("overflow not boxed", VALUE_IS_CELL(big));
+    mu_assert("wrong boxed sum",
+        value_integer(bs, big) == VALUE_FIXNUM_MAX + 1);
+    mu_assert("box not allocated", bs->forwardptr > forwardptr);
+    mu_assert("boxed result not unboxed",
+        arith_sub2(bs, big, value_fixnum(2)) ==
+        value_fixnum(VALUE_FIXNUM_MAX - 1));
+
+    VALUE product = arith_mul2(
+        bs, value_fixnum(10000), value_fixnum(-10000));
+    mu_assert("wrong boxed product",
+        value_integer(bs, product) == -100000000);
+    mu_assert("wrong boxed quotient",
+        arith_div2(bs, product, value_fixnum(-10000)) == value_fixnum(10000));
+    mu_assert("wrong boxed comparison",
+        arith_less2(bs, product, value_fixnum(0)) &&
+        !arith_less2(bs, big, value_fixnum(5)));
+    mu_assert("wrong negated minimum",
+        value_integer(bs, arith_div2(bs, value_fixnum(VALUE_FIXNUM_MIN),
+            value_fixnum(-1))) == -VALUE_FIXNUM_MIN);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        arith_mul2(bs, product, product);
+        mu_assert("32 bit overflow accepted", 0);
+    } else {
+        mu_assert("wrong overflow error", exctype == ARITH_OVERFLOW_ERROR);
+    }
+    exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        arith_div2(bs, value_fixnum(1), value_fixnum(0));
+        mu_assert("division by zero accepted", 0);
+    } else {
+        mu_assert("wrong division error", exctype == ARITH_DIVIDE_BY_ZERO);
+    }
+    exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        arith_add2(bs, value_symbol(3), value_fixnum(1));
+        mu_assert("symbol added", 0);
+    } else {
+        mu_assert("wrong type error", exctype == VALUE_TYPE_ERROR);
+    }
+    return 0;
+}
+
+
+static char * test_variadic() {
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+    VALUE args[] = { value_fixnum(100), value_fixnum(7), value_fixnum(3) };
+
+    mu_assert("wrong empty sum",
+        arith_fold(bs, ARITH_ADD, args, 0) == value_fixnum(0));
+    mu_assert("wrong empty product",
+        arith_fold(bs, ARITH_MULTIPLY, args, 0) == value_fixnum(1));
+    mu_assert("wrong negation",
+        arith_fold(bs, ARITH_SUBTRACT, args, 1) == value_fixnum(-100));
+    mu_assert("wrong reciprocal",
+        arith_fold(bs, ARITH_DIVIDE, args, 1) == value_fixnum(0));
+    mu_assert("wrong sum",
+        arith_fold(bs, ARITH_ADD, args, 3) == value_fixnum(110));
+    mu_assert("wrong difference",
+        arith_fold(bs, ARITH_SUBTRACT, args, 3) == value_fixnum(90));
+    mu_assert("wrong product",
+        arith_fold(bs, ARITH_MULTIPLY, args, 3) == value_fixnum(2100));
+    mu_assert("wrong quotient",
+        arith_fold(bs, ARITH_DIVIDE, args, 3) == value_fixnum(4));
+    mu_assert("decreasing args less", !arith_less(bs, args, 3));
+    VALUE increasing[] = {
+        value_fixnum(-1), value_fixnum(0), arith_box(bs, 1<<20) };
+    mu_assert("increasing args not less", arith_less(bs, increasing, 3));
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        arith_fold(bs, ARITH_SUBTRACT, args, 0);
+        mu_assert("empty difference accepted", 0);
+    } else {
+        mu_assert("wrong arity error", exctype == ARITH_ARITY_ERROR);
+    }
+    return 0;
+}
+
+
+static char *all_tests() {
+    mu_run_test(test_fixnums);
+    mu_run_test(test_promotion);
+    mu_run_test(test_variadic);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+#include "defines.h"
+#include "runtime.h"
+#include "bistack.h"
+#include "value.h"
+
+/*
+ * The arithmetic and comparison builtins.  The two argument forms are
+ * inline so compiled code can call them directly: when both arguments are
+ * fixnums, which one test of their combined tag bits shows, they compute in
+ * 16 or 32 bits and allocate nothing.  Only a result which does not fit a
+ * fixnum is boxed, as an int32 cell on the forward stack, and boxed
+ * arguments take the out of line path.  A result beyond 32 bits throws
+ * ARITH_OVERFLOW_ERROR.
+ */
+#define ARITH_ADD '+'
+#define ARITH_SUBTRACT '-'
+#define ARITH_MULTIPLY '*'
+#define ARITH_DIVIDE '/'
+
+/**
+ * The value of n, boxed in a new int32 cell only if it is not a fixnum.
+ */
+VALUE arith_box(BISTACK *bs, int32_t n);
+
+/**
+ * The out of line path of the two argument forms, for boxed arguments.
+ * @param[in] op One of ARITH_ADD, ARITH_SUBTRACT, ARITH_MULTIPLY and
+ *     ARITH_DIVIDE
+ */
+VALUE arith_slow2(BISTACK *bs, char op, VALUE a, VALUE b);
+
+/**
+ * The out of line path of arith_less2.
+ */
+char arith_less_slow2(BISTACK *bs, VALUE a, VALUE b);
+
+// TRUE if both a and b are fixnums
+#define ARITH_BOTH_FIXNUMS(A, B) VALUE_IS_FIXNUM((A) & (B))
+
+static inline VALUE arith_add2(BISTACK *bs, VALUE a, VALUE b) {
+  if (ARITH_BOTH_FIXNUMS(a, b)) {
+    // two fixnums add without overflowing 16 bits
+    int16_t n = value_fixnum_value(a) + value_fixnum_value(b);
+    return value_fixnum_fits(n) ? value_fixnum(n) : arith_box(bs, n);
+  }
+  return arith_slow2(bs, ARITH_ADD, a, b);
+}
+
+static inline VALUE arith_sub2(BISTACK *bs, VALUE a, VALUE b) {
+  if (ARITH_BOTH_FIXNUMS(a, b)) {
+    int16_t n = value_fixnum_value(a) - value_fixnum_value(b);
+    return value_fixnum_fits(n) ? value_fixnum(n) : arith_box(bs, n);
+  }
+  return arith_slow2(bs, ARITH_SUBTRACT, a, b);
+}
+
+static inline VALUE arith_mul2(BISTACK *bs, VALUE a, VALUE b) {
+  if (ARITH_BOTH_FIXNUMS(a, b)) {
+    int32_t n = (int32_t)value_fixnum_value(a) * value_fixnum_value(b);
+    return value_fixnum_fits(n) ? value_fixnum(n) : arith_box(bs, n);
+  }
+  return arith_slow2(bs, ARITH_MULTIPLY, a, b);
+}
+
+/**
+ * Divides, truncating towards zero.  Throws ARITH_DIVIDE_BY_ZERO.
+ */
+static inline VALUE arith_div2(BISTACK *bs, VALUE a, VALUE b) {
+  if (ARITH_BOTH_FIXNUMS(a, b) && b != value_fixnum(0)) {
+    int16_t n = value_fixnum_value(a) / value_fixnum_value(b);
+    return value_fixnum_fits(n) ? value_fixnum(n) : arith_box(bs, n);
+  }
+  return arith_slow2(bs, ARITH_DIVIDE, a, b);
+}
+
+static inline char arith_less2(BISTACK *bs, VALUE a, VALUE b) {
+  if (ARITH_BOTH_FIXNUMS(a, b)) {
+    return value_fixnum_value(a) < value_fixnum_value(b);
+  }
+  return arith_less_slow2(bs, a, b);
+}
+
+/**
+ * Folds op over args, for calls with any number of arguments: (+) is 0,
+ * (*) is 1, (- x) is -x and (/ x) is 1/x.  Throws ARITH_ARITY_ERROR when -
+ * or / have no arguments.
+ */
+VALUE arith_fold(BISTACK *bs, char op, VALUE *args, uint8_t nargs);
+
+/**
+ * @return TRUE if args are in strictly increasing order
+ */
+char arith_less(BISTACK *bs, VALUE *args, uint8_t nargs);
+
+#endif
@@ -0,0 +1,644 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "utils.h"
+#include "bistack.h"
+#include "cell.h"
+#include "nvmem.h"
+#include "astcodec.h"
+
+#define ASTCODEC_BUCKETS 256
+
+typedef struct astcodec_symbol {
+    // the next symbol in the same bucket, and in order of first use
+    struct astcodec_symbol *bucket_next;
+    struct astcodec_symbol *next;
+    CELLHEADER *symbol;
+    uint16_t index;
+} ASTCODEC_SYMBOL;
+
+typedef struct astcodec_encoder {
+    astcodec_write_t write;
+    void *streamobj;
+    size_t len;
+    ASTCODEC_SYMBOL **buckets;
+} ASTCODEC_ENCODER;
+
+
+static inline char astcodec_is_string(CELLHEADER *cell) {
+    return cell->Symbol.prefix == AST_DOUBLEQUOTE;
+}
+
+static ASTCODEC_SYMBOL *astcodec_find(
+        ASTCODEC_ENCODER *encoder, CELLHEADER *cell, uint8_t hash) {
+    ASTCODEC_SYMBOL *symbol = encoder->buckets[hash];
+    while (symbol && !(
+            symbol->symbol->Symbol.length == cell->Symbol.length &&
+            memcmp(&symbol->symbol[1], &cell[1], cell->Symbol.length) == 0)) {
+        symbol = symbol->bucket_next;
+    }
+    return symbol;
+}
+
+static void astcodec_emit(
+        ASTCODEC_ENCODER *encoder, const void *data, size_t len) {
+    if (encoder->write) {
+        encoder->write(encoder->streamobj, data, len);
+    }
+    encoder->len += len;
+}
+
+static void astcodec_emit_varint(
+        ASTCODEC_ENCODER *encoder, uint8_t tag, char has_tag, uint32_t value) {
+    /**
+     * Emits value as a varint, preceded by tag if has_tag.
+     */
+    uint8_t bytes[6];
+    uint8_t len = 0;
+    if (has_tag) {
+        bytes[len++] = tag;
+    }
+    while (value >= 0x80) {
+        bytes[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    bytes[len++] = value;
+    astcodec_emit(encoder, bytes, len);
+}
+
+static void astcodec_emit_cell(ASTCODEC_ENCODER *encoder, CELLHEADER *cell) {
+    if (cell_is_list(cell)) {
+        uint16_t length = cell_list_length(cell);
+        uint8_t prefix = cell_list_prefix(cell);
+        if (prefix == AST_NOPREFIX && length < 32) {
+            uint8_t tag = ASTCODEC_TAG_LIST_SHORT | length;
+            astcodec_emit(encoder, &tag, 1);
+        } else {
+            astcodec_emit_varint(
+                encoder, ASTCODEC_TAG_LIST | prefix, TRUE, length);
+        }
+
+    } else if (cell_is_integer(cell)) {
+        int32_t value = cell_integer_value(cell);
+        if (value >= 0 && value < 16) {
+            uint8_t tag = ASTCODEC_TAG_INTEGER_SHORT | value;
+            astcodec_emit(encoder, &tag, 1);
+        } else {
+            // zigzag, so small negative values stay short
+            uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+            astcodec_emit_varint(encoder, ASTCODEC_TAG_INTEGER, TRUE, zigzag);
+        }
+
+    } else if (astcodec_is_string(cell)) {
+        uint8_t bytes[2] = {
+            ASTCODEC_TAG_STRING | cell->Symbol.prefix, cell->Symbol.length };
+        astcodec_emit(encoder, bytes, 2);
+        astcodec_emit(encoder, &cell[1], cell->Symbol.length);
+
+    } else {
+        uint16_t index = astcodec_find(
+            encoder,
+            cell,
+            hashstr_8((char*)&cell[1], cell->Symbol.length))->index;
+        if (cell->Symbol.prefix == AST_NOPREFIX && index < 0x80) {
+            uint8_t tag = ASTCODEC_TAG_SYMBOL_SHORT | index;
+            astcodec_emit(encoder, &tag, 1);
+        } else {
+            astcodec_emit_varint(
+                encoder,
+                ASTCODEC_TAG_SYMBOL | cell->Symbol.prefix,
+                TRUE,
+                index);
+        }
+    }
+}
+
+size_t astcodec_encode(
+        BISTACK *bs,
+        CELLHEADER *forms,
+        uint16_t nforms,
+        astcodec_write_t write,
+        void *streamobj) {
+    void *start_mark = bistack_mark(bs);
+    ASTCODEC_ENCODER encoder = {
+        .write=write,
+        .streamobj=streamobj,
+        .len=0,
+        .buckets=bistack_alloc(bs, ASTCODEC_BUCKETS * sizeof(ASTCODEC_SYMBOL*)),
+    };
+    memset(encoder.buckets, 0, ASTCODEC_BUCKETS * sizeof(ASTCODEC_SYMBOL*));
+    ASTCODEC_SYMBOL *first = NULL;
+    ASTCODEC_SYMBOL *last = NULL;
+    uint16_t nsymbols = 0;
+
+    // number each distinct symbol name in order of first use
+    CELL_WALK walk;
+    CELLHEADER *cell;
+    cell_walk_init(&walk, forms, nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        if (cell->Symbol.type != AST_SYMBOL || astcodec_is_string(cell)) {
+            continue;
+        }
+        uint8_t hash = hashstr_8((char*)&cell[1], cell->Symbol.length);
+        if (astcodec_find(&encoder, cell, hash)) {
+            continue;
+        }
+
+        lassert(nsymbols < UINT16_MAX, CELL_OVERFLOW_ERROR);
+        ASTCODEC_SYMBOL *symbol = bistack_alloc(bs, sizeof(ASTCODEC_SYMBOL));
+        symbol->bucket_next = encoder.buckets[hash];
+        symbol->next = NULL;
+        symbol->symbol = cell;
+        symbol->index = nsymbols++;
+        encoder.buckets[hash] = symbol;
+        if (last) {
+            last->next = symbol;
+        } else {
+            first = symbol;
+        }
+        last = symbol;
+    }
+
+    astcodec_emit_varint(&encoder, 0, FALSE, nsymbols);
+    astcodec_emit_varint(&encoder, 0, FALSE, nforms);
+    for (ASTCODEC_SYMBOL *symbol=first; symbol; symbol=symbol->next) {
+        uint8_t length = symbol->symbol->Symbol.length;
+        astcodec_emit(&encoder, &length, 1);
+        astcodec_emit(&encoder, &symbol->symbol[1], length);
+    }
+
+    cell_walk_init(&walk, forms, nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        astcodec_emit_cell(&encoder, cell);
+    }
+
+    lassert(start_mark == bistack_rewind(bs), READER_STATE_ERROR);
+    return encoder.len;
+}
+
+
+static void astcodec_blockwrite(void *writer, const void *data, size_t len) {
+    nvmem_blockwriter_write((NVMEM_BLOCKWRITER*)writer, data, len);
+}
+
+code_addr_t astcodec_save(BISTACK *bs, CELLHEADER *forms, uint16_t nforms) {
+    // the block's length is needed up front, so measure before writing
+    NVMEM_BLOCKWRITER writer;
+    nvmem_blockwriter_begin(
+        &writer, astcodec_encode(bs, forms, nforms, NULL, NULL));
+    astcodec_encode(bs, forms, nforms, astcodec_blockwrite, &writer);
+    return nvmem_blockwriter_end(&writer);
+}
+
+
+static uint8_t astcodec_byte(ASTCODEC_DECODER *decoder) {
+    int16_t byte = decoder->getb(decoder->streamobj);
+    lassert(byte >= 0, ASTCODEC_FORMAT_ERROR);
+    return byte;
+}
+
+static uint32_t astcodec_varint(ASTCODEC_DECODER *decoder) {
+    uint32_t value = 0;
+    for (uint8_t shift=0; ; shift+=7) {
+        lassert(shift < 32, ASTCODEC_FORMAT_ERROR);
+        uint8_t byte = astcodec_byte(decoder);
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+static void astcodec_chars(ASTCODEC_DECODER *decoder, char *dest, uint8_t len) {
+    for (uint8_t i=0; i<len; i++) {
+        dest[i] = astcodec_byte(decoder);
+    }
+}
+
+uint16_t astcodec_decoder_init(
+        ASTCODEC_DECODER *decoder,
+        BISTACK *bs,
+        astcodec_getb_t getb,
+        void *streamobj) {
+    decoder->bs = bs;
+    decoder->getb = getb;
+    decoder->streamobj = streamobj;
+
+    uint32_t nsymbols = astcodec_varint(decoder);
+    uint32_t nforms = astcodec_varint(decoder);
+    // the index must fit a single bistack allocation
+    lassert(
+        nsymbols <= UINT16_MAX / sizeof(uint8_t*) && nforms <= UINT16_MAX,
+        ASTCODEC_FORMAT_ERROR);
+    decoder->nsymbols = nsymbols;
+    decoder->nforms = nforms;
+
+    bistack_markb(bs);
+    decoder->symbols = bistack_allocb(bs, nsymbols * sizeof(uint8_t*));
+    for (uint16_t i=0; i<nsymbols; i++) {
+        uint8_t length = astcodec_byte(decoder);
+        lassert(length < (1 << CELL_SYMBOL_LENGTH_BITS), ASTCODEC_FORMAT_ERROR);
+        uint8_t *entry = bistack_allocb(bs, 2 + length);
+        entry[0] = length;
+        astcodec_chars(decoder, (char*)&entry[2], length);
+        // hashed once here rather than at every use of the symbol
+        entry[1] = hashstr_8((char*)&entry[2], length);
+        decoder->symbols[i] = entry;
+    }
+    return decoder->nforms;
+}
+
+static void astcodec_symbol(
+        ASTCODEC_DECODER *decoder, CELLHEADER *cell, uint8_t prefix,
+        const uint8_t *entry, uint8_t length) {
+    /**
+     * Fills in a symbol header whose characters follow it, copying them and
+     * their hash from a dictionary entry, or reading them from the stream if
+     * entry is NULL.
+     */
+    char *chars = bistack_allocf(decoder->bs, length);
+    if (entry) {
+        memcpy(chars, &entry[2], length);
+        cell->Symbol.hash = entry[1];
+    } else {
+        astcodec_chars(decoder, chars, length);
+        cell->Symbol.hash = hashstr_8(chars, length);
+    }
+    cell->Symbol.type = AST_SYMBOL;
+    cell->Symbol.length = length;
+    cell->Symbol.prefix = prefix;
+}
+
+typedef struct astcodec_open {
+    // a list still being decoded, and the children it is still owed
+    CELLHEADER *list;
+    uint16_t remaining;
+} ASTCODEC_OPEN;
+
+CELLHEADER *astcodec_decode(ASTCODEC_DECODER *decoder) {
+    /**
+     * Builds the form the way the reader does: each finished child is
+     * counted into the innermost open list, which finishes once it holds the
+     * number of children the encoding gave it.
+     */
+    if (decoder->nforms == 0) {
+        return NULL;
+    }
+    decoder->nforms--;
+
+    BISTACK *bs = decoder->bs;
+    CELLHEADER *form = bs->forwardptr;
+
+    // the open lists are kept below the dictionary, aligned, one frame per
+    // level the form reaches, the outermost highest
+    void *backwardptr = bs->backwardptr;
+    uint8_t misalign = (uintptr_t)backwardptr % sizeof(void*);
+    if (misalign) {
+        bistack_allocb(bs, misalign);
+    }
+    ASTCODEC_OPEN *open = (ASTCODEC_OPEN*)bs->backwardptr - 1;
+    int32_t depth = -1;
+    int32_t frames = 0;
+
+    do {
+        uint8_t tag = astcodec_byte(decoder);
+        CELLHEADER *cell = bistack_allocf(bs, sizeof(CELLHEADER));
+
+        if (tag < ASTCODEC_TAG_LIST_SHORT ||
+                (tag & 0xf8) == ASTCODEC_TAG_SYMBOL) {
+            uint32_t index = (
+                tag < ASTCODEC_TAG_LIST_SHORT ? tag : astcodec_varint(decoder));
+            lassert(index < decoder->nsymbols, ASTCODEC_FORMAT_ERROR);
+            uint8_t *entry = decoder->symbols[index];
+            astcodec_symbol(
+                decoder, cell, tag < ASTCODEC_TAG_LIST_SHORT ? 0 : tag & 0x7,
+                entry, entry[0]);
+
+        } else if ((tag & 0xf8) == ASTCODEC_TAG_STRING) {
+            uint8_t length = astcodec_byte(decoder);
+            lassert(
+                length < (1 << CELL_SYMBOL_LENGTH_BITS), ASTCODEC_FORMAT_ERROR);
+            astcodec_symbol(decoder, cell, tag & 0x7, NULL, length);
+
+        } else if ((tag & 0xf0) == ASTCODEC_TAG_INTEGER_SHORT) {
+            cell->Integer.type = AST_INTEGER;
+            cell->Integer.sign = 1;
+            cell->Integer.value = tag & 0xf;
+
+        } else if (tag == ASTCODEC_TAG_INTEGER) {
+            uint32_t zigzag = astcodec_varint(decoder);
+            cell->Integer.type = AST_INTEGER;
+            cell->Integer.sign = 1;
+            cell->Integer.value = 0;
+            cell_set_integer(
+                bs, cell, (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1));
+
+        } else if ((tag & 0xe0) == ASTCODEC_TAG_LIST_SHORT ||
+                (tag & 0xf0) == ASTCODEC_TAG_LIST) {
+            char is_short = (tag & 0xe0) == ASTCODEC_TAG_LIST_SHORT;
+            uint32_t length = is_short ? tag & 0x1f : astcodec_varint(decoder);
+            lassert(length <= UINT16_MAX, ASTCODEC_FORMAT_ERROR);
+            cell->List.type = AST_LIST;
+            cell->List.prefix = is_short ? 0 : tag & 0xf;
+            cell->List.length = 0;
+            if (length) {
+                if (++depth == frames) {
+                    // nothing else allocates backward while decoding, so
+                    // each frame lands directly below the one before
+                    lassert(
+                        bistack_allocb(bs, sizeof(ASTCODEC_OPEN)) ==
+                        (void*)(open - depth),
+                        READER_STATE_ERROR);
+                    frames++;
+                }
+                open[-depth].list = cell;
+                open[-depth].remaining = length;
+                continue;
+            }
+
+        } else {
+            lerror(ASTCODEC_FORMAT_ERROR, PSTR("astcodec_decode"));
+        }
+
+        // the cell is finished, as are the lists it was the last child of
+        while (depth >= 0) {
+            cell_list_add(bs, open[-depth].list, 1);
+            if (--open[-depth].remaining) {
+                break;
+            }
+            depth--;
+        }
+    } while (depth >= 0);
+
+    // frames left by a damaged form are released by astcodec_decoder_end
+    bs->backwardptr = backwardptr;
+    return form;
+}
+
+void astcodec_decoder_end(ASTCODEC_DECODER *decoder) {
+    bistack_rewindb(decoder->bs);
+}
+
+
+#ifdef ASTCODEC_TEST
+#include <stdio.h>
+#include "reader.h"
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+typedef struct membuf {
+    uint8_t data[1<<15];
+    size_t len;
+    size_t pos;
+} MEMBUF;
+
+static void memwrite(void *streamobj, const void *data, size_t len) {
+    MEMBUF *buf = (MEMBUF*)streamobj;
+    memcpy(&buf->data[buf->len], data, len);
+    buf->len += len;
+}
+
+static int16_t memgetb(void *streamobj) {
+    MEMBUF *buf = (MEMBUF*)streamobj;
+    return buf->pos < buf->len ? buf->data[buf->pos++] : -1;
+}
+
+static char filegetc(void *file) {
+    int c = fgetc((FILE*)file);
+    return c == EOF ? -1 : c;
+}
+
+static READER *read_stream(FILE *file, char is_sized) {
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    reader_set_getc(reader, filegetc, file);
+    reader_set_sized_lists(reader, is_sized);
+    while (!feof(file)) {
+        reader_read(reader);
+    }
+    fclose(file);
+    return reader;
+}
+
+static READER *read_file(char *filename, char is_sized) {
+    return read_stream(fopen(filename, "rb"), is_sized);
+}
+
+static READER *read_string(char *source) {
+    return read_stream(fmemopen(source, strlen(source), "rb"), FALSE);
+}
+
+static char *check_round_trip(
+        READER *reader, astcodec_getb_t getb, void *streamobj) {
+    /**
+     * Decodes every form, which must match the ones reader read.
+     */
+    BISTACK *bs = bistack_new(1<<18);
+    void *backwardptr = bs->backwardptr;
+    CELLHEADER *root = reader->reader_context->cellheader;
+    CELLHEADER *expected = cell_list_first(root);
+    size_t len = (char*)reader->environment->bs->forwardptr - (char*)expected;
+
+    ASTCODEC_DECODER decoder;
+    uint16_t nforms = astcodec_decoder_init(&decoder, bs, getb, streamobj);
+    mu_assert("wrong form count", nforms == cell_list_length(root));
+    CELLHEADER *first = bs->forwardptr;
+    CELLHEADER *form;
+    uint16_t count = 0;
+    while ((form = astcodec_decode(&decoder))) {
+        count++;
+    }
+    mu_assert("forms not all decoded", count == nforms);
+    mu_assert("decoded length differs",
+        (char*)bs->forwardptr - (char*)first == len);
+    mu_assert("decoded forms differ", memcmp(first, expected, len) == 0);
+
+    astcodec_decoder_end(&decoder);
+    mu_assert("dictionary not released", bs->backwardptr == backwardptr);
+    bistack_destroy(bs);
+    return 0;
+}
+
+static char *test_samples() {
+    char *samples[] = {
+        "tests/samples/sample1.lisp", "tests/samples/sample2.lisp" };
+    nvmem_initmem();
+    nvmem_init();
+    for (int i=0; i<sizeof(samples)/sizeof(samples[0]); i++) {
+        READER *reader = read_file(samples[i], FALSE);
+        READER *sized = read_file(samples[i], TRUE);
+        BISTACK *bs = reader->environment->bs;
+        CELLHEADER *root = reader->reader_context->cellheader;
+        CELLHEADER *sized_root = sized->reader_context->cellheader;
+        void *backwardptr = bs->backwardptr;
+
+        size_t len = astcodec_encode(
+            bs, cell_list_first(root), cell_list_length(root), NULL, NULL);
+        mu_assert("encode left allocations", bs->backwardptr == backwardptr);
+        mu_assert("sized lists encode differently",
+            len == astcodec_encode(
+                sized->environment->bs,
+                cell_list_first(sized_root), cell_list_length(sized_root),
+                NULL, NULL));
+        size_t cells_len = (char*)bs->forwardptr - (char*)cell_list_first(root);
+        mu_assert("encoding not denser than cells", len * 4 < cells_len * 3);
+
+        // through nvmem, with a staging buffer far smaller than the block
+        code_addr_t addr = astcodec_save(
+            bs, cell_list_first(root), cell_list_length(root));
+        uint8_t buffer[8];
+        NVMEM_BLOCKREADER blockreader;
+        nvmem_blockreader_init(&blockreader, addr, buffer, sizeof(buffer));
+        char *result = check_round_trip(
+            reader, nvmem_blockreader_getb, &blockreader);
+        if (result) {
+            return result;
+        }
+        nvmem_freeblock(addr);
+
+        bistack_destroy(sized->environment->bs);
+        bistack_destroy(bs);
+    }
+    return 0;
+}
+
+static char *test_values() {
+    static MEMBUF buf;
+    char source[] = (
+        "0 15 16 -1 -16 8191 8192 -8192 2147483647 -2147483648 "
+        "'(a b) `(c ,d ,@e) #'f \"a string\" 'g "
+        "(((((((((((((((((((((((((((((((h)))))))))))))))))))))))))))))))");
+    READER *reader = read_string(source);
+    CELLHEADER *root = reader->reader_context->cellheader;
+
+    // a list longer than plain headers hold, and more symbols than short tags
+    BISTACK *bs = reader->environment->bs;
+    CELLHEADER *list = bistack_allocf(bs, sizeof(CELLHEADER));
+    list->List.type = AST_LIST;
+    list->List.prefix = AST_NOPREFIX;
+    list->List.length = 0;
+    for (int i=0; i<1500; i++) {
+        char name[8];
+        uint8_t length = sprintf(name, "s%d", i % 300);
+        CELLHEADER *symbol = bistack_allocf(bs, sizeof(CELLHEADER) + length);
+        memcpy(&symbol[1], name, length);
+        symbol->Symbol.type = AST_SYMBOL;
+        symbol->Symbol.length = length;
+        symbol->Symbol.prefix = AST_NOPREFIX;
+        symbol->Symbol.hash = hashstr_8(name, length);
+        cell_list_add(bs, list, 1);
+    }
+    cell_list_add(bs, root, 1);
+
+    buf.len = 0;
+    buf.pos = 0;
+    astcodec_encode(
+        bs, cell_list_first(root), cell_list_length(root), memwrite, &buf);
+    return check_round_trip(reader, memgetb, &buf);
+}
+
+static char *test_deep() {
+    /**
+     * Forms nested deeper than any fixed limit load as they were saved.
+     */
+    static char source[256];
+    char *pos = source;
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, "(a ");
+    }
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, ")");
+    }
+    sprintf(pos, " (b)");
+    nvmem_initmem();
+    nvmem_init();
+    READER *reader = read_string(source);
+    CELLHEADER *root = reader->reader_context->cellheader;
+    BISTACK *bs = reader->environment->bs;
+
+    code_addr_t addr = astcodec_save(
+        bs, cell_list_first(root), cell_list_length(root));
+    uint8_t buffer[8];
+    NVMEM_BLOCKREADER blockreader;
+    nvmem_blockreader_init(&blockreader, addr, buffer, sizeof(buffer));
+    char *result = check_round_trip(
+        reader, nvmem_blockreader_getb, &blockreader);
+    nvmem_freeblock(addr);
+    bistack_destroy(bs);
+    return result;
+}
+
+static char *test_damage() {
+    static MEMBUF buf;
+    READER *reader = read_file("tests/samples/sample1.lisp", FALSE);
+    CELLHEADER *root = reader->reader_context->cellheader;
+    buf.len = 0;
+    astcodec_encode(
+        reader->environment->bs,
+        cell_list_first(root), cell_list_length(root), memwrite, &buf);
+    size_t len = buf.len;
+
+    struct {
+        size_t len;
+        size_t offset;
+        uint8_t value;
+    } damage[] = {
+        // truncated
+        { len - 1, 0, buf.data[0] },
+        // a symbol index past the dictionary
+        { len, 0, 0 },
+        // an unused tag
+        { len, len - 1, 0xff },
+    };
+
+    BISTACK *bs = bistack_new(1<<18);
+    for (int i=0; i<sizeof(damage)/sizeof(damage[0]); i++) {
+        uint8_t original = buf.data[damage[i].offset];
+        buf.data[damage[i].offset] = damage[i].value;
+        buf.len = damage[i].len;
+        buf.pos = 0;
+
+        void *forwardptr = bs->forwardptr;
+        ASTCODEC_DECODER decoder;
+        int exctype = setjmp(__jmpbuff);
+        if (exctype == 0) {
+            astcodec_decoder_init(&decoder, bs, memgetb, &buf);
+            while (astcodec_decode(&decoder)) {
+            }
+            mu_assert("damage not detected", 0);
+        }
+        mu_assert("wrong error", exctype == ASTCODEC_FORMAT_ERROR);
+        astcodec_decoder_end(&decoder);
+        bistack_releasef(bs, forwardptr);
+
+        buf.data[damage[i].offset] = original;
+    }
+    bistack_destroy(bs);
+    bistack_destroy(reader->environment->bs);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_samples);
+    mu_run_test(test_values);
+    mu_run_test(test_deep);
+    mu_run_test(test_damage);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef ASTCODEC_H
+#define ASTCODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "defines.h"
+#include "bistack.h"
+#include "nvmem.h"
+
+/*
+ * A denser encoding of forms for the code store.  Cells repeat each symbol's
+ * name wherever it is used; encoded forms name each distinct symbol once in
+ * a dictionary and refer to it by index:
+ *
+ *   varint nsymbols | varint nforms
+ *     | nsymbols * (uint8 length | name) | cells of each form
+ *
+ * Each cell starts with a tag byte:
+ *
+ *   0iiiiiii  unprefixed symbol, dictionary index i
+ *   100lllll  unprefixed list of l children
+ *   1010vvvv  integer v
+ *   10110ppp  symbol with prefix p | varint index
+ *   10111ppp  string with prefix p | uint8 length | characters
+ *   1100pppp  list with prefix p | varint length
+ *   11010000  integer | zigzag varint
+ *
+ * Varints hold 7 bits per byte, low bits first, and set the top bit of every
+ * byte but the last.  A list's children follow it.  Strings are not shared,
+ * as with the .tlc symbol table.
+ */
+#define ASTCODEC_TAG_SYMBOL_SHORT 0x00
+#define ASTCODEC_TAG_LIST_SHORT 0x80
+#define ASTCODEC_TAG_INTEGER_SHORT 0xa0
+#define ASTCODEC_TAG_SYMBOL 0xb0
+#define ASTCODEC_TAG_STRING 0xb8
+#define ASTCODEC_TAG_LIST 0xc0
+#define ASTCODEC_TAG_INTEGER 0xd0
+
+/**
+ * Receives encoded bytes, see astcodec_encode.
+ */
+typedef void (*astcodec_write_t)(void *streamobj, const void *data, size_t len);
+
+/**
+ * Supplies encoded bytes to a decoder.
+ * @return The next byte, or -1 if there are none
+ */
+typedef int16_t (*astcodec_getb_t)(void *streamobj);
+
+typedef struct astcodec_decoder {
+    BISTACK *bs;
+    astcodec_getb_t getb;
+    void *streamobj;
+
+    // the dictionary, each entry a length, the name's hashstr_8, the name
+    uint8_t **symbols;
+    uint16_t nsymbols;
+
+    // forms not yet decoded
+    uint16_t nforms;
+} ASTCODEC_DECODER;
+
+/**
+ * Encodes forms, passing the encoding to write in pieces.
+ * @param[in] bs Temporary space for building the dictionary
+ * @param[in] forms The first form, followed by the others
+ * @param[in] nforms The number of forms
+ * @param[in] write Receives the encoding, or NULL to only measure it
+ * @param[in] streamobj Passed to write
+ * @return The length of the encoding
+ */
+size_t astcodec_encode(
+    BISTACK *bs,
+    CELLHEADER *forms,
+    uint16_t nforms,
+    astcodec_write_t write,
+    void *streamobj);
+
+/**
+ * Encodes forms into a new nvmem block, streamed through an
+ * NVMEM_BLOCKWRITER so the encoding is never held in RAM.
+ * @return The address of the block
+ */
+code_addr_t astcodec_save(BISTACK *bs, CELLHEADER *forms, uint16_t nforms);
+
+/**
+ * Starts decoding, reading the dictionary onto the backward stack of bs
+ * where it stays until astcodec_decoder_end.
+ * @param[out] decoder The decoder to start
+ * @param[in] bs The bistack receiving the dictionary and the forms
+ * @param[in] getb Supplies the encoding, e.g. nvmem_blockreader_getb
+ * @param[in] streamobj Passed to getb
+ * @return The number of forms to decode
+ */
+uint16_t astcodec_decoder_init(
+    ASTCODEC_DECODER *decoder,
+    BISTACK *bs,
+    astcodec_getb_t getb,
+    void *streamobj);
+
+/**
+ * Decodes the next form onto the forward stack, laid out as the reader
+ * would have read it.  Bytes are pulled from getb only as they are needed.
+ * Lists may nest to any depth, the open ones are kept on the backward stack
+ * until the form is finished.
+ * A damaged or truncated encoding throws ASTCODEC_FORMAT_ERROR, leaving the
+ * partial form for the caller to release.
+ * @return The form, or NULL once all forms were decoded
+ */
+CELLHEADER *astcodec_decode(ASTCODEC_DECODER *decoder);
+
+/**
+ * Releases the dictionary.  Nothing may have been allocated on the backward
+ * stack since astcodec_decoder_init.
+ */
+void astcodec_decoder_end(ASTCODEC_DECODER *decoder);
+
+#endif
@@ -127,6 +127,15 @@ void *bistack_rewindb(BISTACK *bs) {
   return bs->backwardptr;
 }
 
+void bistack_releasef(BISTACK *bs, void *ptr) {
+  /* Releases every forward allocation made at or after ptr */
+  lassert(
+    ptr >= (void*)bs->forwardmark + sizeof(void*) && ptr <= bs->forwardptr,
+    BISTACK_REWIND_TOO_FAR);
+  bs->forwardptr = ptr;
+  BS_DEBUG("bistack_releasef @ forwardptr: 0x%08x\n", (int)bs->forwardptr);
+}
+
 void *bistack_dropmark(BISTACK *bs) {
   if ((bs->direction_stack & 1) == BS_FORWARD) {
     return bistack_dropmarkf(bs);
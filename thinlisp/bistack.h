@@ -47,6 +47,8 @@ void *bistack_rewindb(BISTACK *bs);
 
 void bistack_zero(BISTACK *bs);
 
+void bistack_releasef(BISTACK *bs, void *ptr);
+
 void *bistack_dropmark(BISTACK *bs);
 void *bistack_dropmarkf(BISTACK *bs);
 void *bistack_dropmarkb(BISTACK *bs);
@@ -0,0 +1,30 @@
+#ifndef BUILTIN_NAMES_H
+#define BUILTIN_NAMES_H
+
+/*
+ * The builtins in order, as X(ID, NAME), so the ROM generator on the host
+ * and the firmware agree on the index of each.
+ */
+#define BUILTIN_NAMES(X) \
+  X(QUOTE, "quote") X(COND, "cond") X(IF, "if") X(AND, "and") X(OR, "or") \
+  X(WHILE, "while") X(LAMBDA, "lambda") X(MACRO, "macro") X(LABEL, "label") \
+  X(PROGN, "progn") \
+  X(EQ, "eq") X(ATOM, "atom") X(CONS, "cons") X(CAR, "car") X(CDR, "cdr") \
+  X(READ, "read") X(EVAL, "eval") X(PRINT, "print") \
+  X(SET, "set") X(NOT, "not") X(LOAD, "load") X(SYMBOLP, "symbolp") \
+  X(NUMBERP, "numberp") X(ADD, "+") X(SUBTRACT, "-") X(MULTIPLY, "*") \
+  X(DIVIDE, "/") X(LESS, "<") \
+  X(PROG1, "prog1") X(APPLY, "apply") X(RPLACA, "rplaca") \
+  X(RPLACD, "rplacd") X(BOUNDP, "boundp") X(ERROR, "error") X(EXIT, "exit") \
+  X(PRINC, "princ") \
+  X(CONSP, "consp") X(ASSOC, "assoc")
+
+#define BUILTIN_ENUM(ID, NAME) BUILTIN_##ID,
+#define BUILTIN_NAME_STRING(ID, NAME) NAME,
+
+enum {
+  BUILTIN_NAMES(BUILTIN_ENUM)
+  BUILTIN_COUNT
+};
+
+#endif
@@ -4,14 +4,9 @@
 #include <stdlib.h>
 
 #include "main.h"
+#include "builtin_names.h"
 
-static char *builtin_names[] =
-    { "quote", "cond", "if", "and", "or", "while", "lambda", "macro", "label",
-      "progn",
-      "eq", "atom", "cons", "car", "cdr", "read", "eval", "print",
-      "set", "not", "load", "symbolp", "numberp", "+", "-", "*", "/", "<",
-      "prog1", "apply", "rplaca", "rplacd", "boundp", "error", "exit", "princ",
-      "consp", "assoc" };
+static char *builtin_names[] = { BUILTIN_NAMES(BUILTIN_NAME_STRING) };
 
 typedef struct {
   char *symbol;
@@ -0,0 +1,558 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "bistack.h"
+#include "cell.h"
+
+static inline CELLHEADER *cell_sized_list_end(CELLHEADER *list) {
+    char *span = (char*)&list[1] + sizeof(uint16_t);
+    return (CELLHEADER*)(span + sizeof(uint16_t) + cell_get16(span));
+}
+
+CELLHEADER *cell_next(CELLHEADER *cell) {
+    // cells left to skip, a plain list adds its children
+    uint16_t remaining = 1;
+    while (remaining) {
+        if (cell->List.type == AST_LIST) {
+            remaining += cell->List.length;
+            cell = &cell[1];
+        } else if (cell_is_sized_list(cell)) {
+            cell = cell_sized_list_end(cell);
+        } else if (cell_is_int32(cell)) {
+            cell = (CELLHEADER*)((char*)&cell[1] + sizeof(int32_t));
+        } else if (cell->Integer.type == AST_INTEGER) {
+            cell = &cell[1];
+        } else {
+            cell = (CELLHEADER*)((char*)&cell[1] + cell->Symbol.length);
+        }
+        remaining--;
+    }
+    return cell;
+}
+
+CELLHEADER *cell_nth(CELLHEADER *list, uint16_t n) {
+    uint16_t length = cell_list_length(list);
+    lassert(n < length, CELL_INDEX_ERROR);
+
+    CELLHEADER *child = cell_list_first(list);
+    if (cell_is_sized_list(list) &&
+            (list->Extended.flags & CELL_LIST_INDEXED) &&
+            n >= CELL_LIST_INDEX_STRIDE) {
+        uint16_t entries = (length - 1) / CELL_LIST_INDEX_STRIDE;
+        char *table = (
+            (char*)cell_sized_list_end(list) - entries * sizeof(uint16_t));
+        uint16_t offset = cell_get16(
+            table + (n / CELL_LIST_INDEX_STRIDE - 1) * sizeof(uint16_t));
+        child = (CELLHEADER*)((char*)child + offset);
+        n %= CELL_LIST_INDEX_STRIDE;
+    }
+    while (n--) {
+        child = cell_next(child);
+    }
+    return child;
+}
+
+void cell_walk_init(CELL_WALK *walk, CELLHEADER *first, uint16_t count) {
+    walk->depth = 0;
+    walk->remaining = count;
+    walk->end = NULL;
+    walk->next = first;
+}
+
+static inline char cell_is_indexed(CELLHEADER *cell) {
+    return (
+        cell_is_sized_list(cell) && (cell->Extended.flags & CELL_LIST_INDEXED));
+}
+
+static CELLHEADER *cell_list_table(CELLHEADER *list) {
+    // the offset table of an indexed list, which follows its last child
+    uint16_t entries = (cell_list_length(list) - 1) / CELL_LIST_INDEX_STRIDE;
+    return (CELLHEADER*)(
+        (char*)cell_sized_list_end(list) - entries * sizeof(uint16_t));
+}
+
+static char cell_fits(CELLHEADER *cell, char *end) {
+    /**
+     * Checks the fields of cell lie before end, each before it is read.
+     */
+    char *fields = (char*)&cell[1];
+    if (fields > end) {
+        return FALSE;
+    } else if (cell_is_sized_list(cell)) {
+        return (
+            fields + CELL_SIZED_LIST_HEADER <= end &&
+            (char*)cell_sized_list_end(cell) <= end &&
+            (!cell_is_indexed(cell) ||
+                (cell_list_length(cell) > 0 &&
+                (char*)cell_list_table(cell) >= fields)));
+    } else if (cell_is_int32(cell)) {
+        return fields + sizeof(int32_t) <= end;
+    } else if (cell->List.type == AST_LIST ||
+            cell->Integer.type == AST_INTEGER) {
+        return TRUE;
+    }
+    return fields + cell->Symbol.length <= end;
+}
+
+CELLHEADER *cell_walk_next(CELL_WALK *walk) {
+    // the last child of an indexed list is done once the walk reaches its
+    // offset table
+    while (walk->depth > 0 &&
+            walk->next == cell_list_table(walk->lists[walk->depth - 1])) {
+        walk->next = cell_sized_list_end(walk->lists[--walk->depth]);
+    }
+    if (walk->remaining == 0 ||
+            (walk->end && !cell_fits(walk->next, walk->end))) {
+        return NULL;
+    }
+
+    CELLHEADER *cell = walk->next;
+    if (cell_is_indexed(cell) && walk->depth == CELL_WALK_DEPTH) {
+        // a bounded walk ends early instead, as for any cell it cannot take
+        lassert(walk->end != NULL, CELL_OVERFLOW_ERROR);
+        return NULL;
+    }
+    walk->remaining--;
+    if (cell_is_list(cell)) {
+        if (cell_is_indexed(cell)) {
+            walk->lists[walk->depth++] = cell;
+        }
+        walk->remaining += cell_list_length(cell);
+        walk->next = cell_list_first(cell);
+    } else {
+        walk->next = cell_next(cell);
+    }
+    return cell;
+}
+
+static char cell_extend_list(BISTACK *bs, CELLHEADER *list) {
+    /**
+     * Moves the children of a plain list to make room for the sized header.
+     * @return FALSE if the children are too large to be spanned
+     */
+    uint8_t prefix = list->List.prefix;
+    uint16_t length = list->List.length;
+    size_t children = (char*)bs->forwardptr - (char*)&list[1];
+    if (children > UINT16_MAX) {
+        return FALSE;
+    }
+
+    bistack_allocf(bs, CELL_SIZED_LIST_HEADER);
+    memmove((char*)&list[1] + CELL_SIZED_LIST_HEADER, &list[1], children);
+    *list = (CELLHEADER){
+        .Extended={
+            .type=AST_NONE,
+            .kind=CELL_EXT_LIST,
+            .prefix=prefix,
+            .flags=0,
+        }
+    };
+    cell_put16(&list[1], length);
+    cell_put16((char*)&list[1] + sizeof(uint16_t), children);
+    return TRUE;
+}
+
+CELLHEADER *cell_size_list(BISTACK *bs, CELLHEADER *list) {
+    if (list->List.type == AST_LIST &&
+            (list->List.length == 0 || !cell_extend_list(bs, list))) {
+        return list;
+    }
+    lassert(cell_is_sized_list(list), READER_STATE_ERROR);
+
+    uint16_t length = cell_get16(&list[1]);
+    char *span = (char*)&list[1] + sizeof(uint16_t);
+    uint16_t children = cell_get16(span);
+    uint16_t entries = (length - 1) / CELL_LIST_INDEX_STRIDE;
+    if ((list->Extended.flags & CELL_LIST_INDEXED) ||
+            length < CELL_LIST_INDEX_MIN ||
+            children + entries * sizeof(uint16_t) > UINT16_MAX) {
+        return list;
+    }
+
+    // children are sized as they close, so this walk is linear
+    char *first = (char*)cell_list_first(list);
+    char *table = bistack_allocf(bs, entries * sizeof(uint16_t));
+    CELLHEADER *child = (CELLHEADER*)first;
+    for (uint16_t i=1; i<length; i++) {
+        child = cell_next(child);
+        if (i % CELL_LIST_INDEX_STRIDE == 0) {
+            cell_put16(
+                table + (i / CELL_LIST_INDEX_STRIDE - 1) * sizeof(uint16_t),
+                (char*)child - first);
+        }
+    }
+    cell_put16(span, children + entries * sizeof(uint16_t));
+    list->Extended.flags |= CELL_LIST_INDEXED;
+    return list;
+}
+
+void cell_list_add(BISTACK *bs, CELLHEADER *list, uint16_t count) {
+    if (list->List.type == AST_LIST) {
+        if (list->List.length + count <= CELL_LIST_PLAIN_MAX) {
+            list->List.length += count;
+            return;
+        }
+        lassert(cell_extend_list(bs, list), CELL_OVERFLOW_ERROR);
+    }
+    lassert(
+        cell_is_sized_list(list) &&
+        !(list->Extended.flags & CELL_LIST_INDEXED),
+        READER_STATE_ERROR);
+
+    uint32_t length = (uint32_t)cell_get16(&list[1]) + count;
+    size_t children = (char*)bs->forwardptr - (char*)cell_list_first(list);
+    lassert(
+        length <= UINT16_MAX && children <= UINT16_MAX, CELL_OVERFLOW_ERROR);
+    cell_put16(&list[1], length);
+    cell_put16((char*)&list[1] + sizeof(uint16_t), children);
+}
+
+void cell_set_integer(BISTACK *bs, CELLHEADER *integer, int32_t value) {
+    if (integer->Integer.type == AST_INTEGER) {
+        if (value >= -CELL_INTEGER_PLAIN_MAX &&
+                value <= CELL_INTEGER_PLAIN_MAX) {
+            // zero keeps its sign so a "-0" prefix survives until a digit
+            if (value != 0) {
+                integer->Integer.sign = value > 0;
+            }
+            integer->Integer.value = value < 0 ? -value : value;
+            return;
+        }
+        lassert((void*)&integer[1] == bs->forwardptr, READER_STATE_ERROR);
+        bistack_allocf(bs, sizeof(int32_t));
+        *integer = (CELLHEADER){
+            .Extended={
+                .type=AST_NONE,
+                .kind=CELL_EXT_INT32,
+                .prefix=0,
+                .flags=0,
+            }
+        };
+    }
+    lassert(cell_is_int32(integer), READER_STATE_ERROR);
+    memcpy(&integer[1], &value, sizeof(value));
+}
+
+
+#ifdef CELL_TEST
+#include <stdio.h>
+#include "reader.h"
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static char filegetc(void *file) {
+    int c = fgetc((FILE*)file);
+    return c == EOF ? -1 : c;
+}
+
+static CELLHEADER *read_file(char *filename, char is_sized) {
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    FILE *file = fopen(filename, "rb");
+    reader_set_getc(reader, filegetc, file);
+    reader_set_sized_lists(reader, is_sized);
+    while (!feof(file)) {
+        reader_read(reader);
+    }
+    fclose(file);
+    return reader->reader_context->cellheader;
+}
+
+static char *check_same(CELLHEADER *plain, CELLHEADER *sized) {
+    /**
+     * Compares the trees by walking them with cell_nth and cell_next.
+     */
+    if (!cell_is_list(plain)) {
+        uint16_t size = cell_size(plain);
+        mu_assert("atom differs",
+            size == cell_size(sized) && memcmp(plain, sized, size) == 0);
+        return 0;
+    }
+    uint16_t length = cell_list_length(plain);
+    mu_assert("length differs", length == cell_list_length(sized));
+    mu_assert("prefix differs",
+        cell_list_prefix(plain) == cell_list_prefix(sized));
+
+    CELLHEADER *plain_child = cell_list_first(plain);
+    CELLHEADER *sized_child = cell_list_first(sized);
+    for (uint16_t i=0; i<length; i++) {
+        mu_assert("nth differs from next", cell_nth(plain, i) == plain_child);
+        mu_assert("sized nth differs from next",
+            cell_nth(sized, i) == sized_child);
+        char *message = check_same(plain_child, sized_child);
+        if (message) {
+            return message;
+        }
+        plain_child = cell_next(plain_child);
+        sized_child = cell_next(sized_child);
+    }
+    return 0;
+}
+
+static char *test_sized_matches_plain() {
+    char *files[] = {
+        "tests/samples/sample1.lisp", "tests/samples/sample2.lisp"};
+    for (int i=0; i<2; i++) {
+        CELLHEADER *plain = read_file(files[i], FALSE);
+        CELLHEADER *sized = read_file(files[i], TRUE);
+        mu_assert("sample has no forms", plain->List.length > 0);
+        mu_assert("root should stay plain", sized->List.type == AST_LIST);
+        char *message = check_same(plain, sized);
+        if (message) {
+            return message;
+        }
+    }
+    return 0;
+}
+
+static char stringgetc(void *streamobj) {
+    char **str = (char**)streamobj;
+    return **str ? *(*str)++ : -1;
+}
+
+static char *test_offset_table() {
+    static char source[256];
+    char *pos = source;
+    pos += sprintf(pos, "(");
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, i % 3 ? "%d " : "(s%d x) ", i);
+    }
+    sprintf(pos, ")\n");
+
+    BISTACK *bs = bistack_new(1<<12);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    pos = source;
+    reader_set_getc(reader, stringgetc, &pos);
+    reader_set_sized_lists(reader, TRUE);
+    mu_assert("read incomplete", reader_read(reader));
+
+    CELLHEADER *list = &reader->reader_context->cellheader[1];
+    mu_assert("list not sized", cell_is_sized_list(list));
+    mu_assert("wrong length", cell_list_length(list) == 40);
+    mu_assert("next not past table",
+        (void*)cell_next(list) == bs->forwardptr);
+    for (int i=0; i<40; i++) {
+        CELLHEADER *child = cell_nth(list, i);
+        if (i % 3) {
+            mu_assert("wrong integer",
+                child->Integer.type == AST_INTEGER &&
+                child->Integer.value == i);
+        } else {
+            mu_assert("wrong sublist",
+                cell_is_sized_list(child) && cell_list_length(child) == 2);
+        }
+    }
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        cell_nth(list, 40);
+        mu_assert("nth past end not reported", 0);
+    } else {
+        mu_assert("wrong error", exctype == CELL_INDEX_ERROR);
+    }
+    bistack_destroy(bs);
+    return 0;
+}
+
+static char *test_character_count() {
+    // an indexed list followed by more cells, whose table is not counted
+    static char source[256];
+    char *pos = source;
+    pos += sprintf(pos, "((");
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, "%d ", i);
+    }
+    sprintf(pos, ") tail)\n");
+
+    uint16_t counts[2];
+    for (char is_sized=FALSE; is_sized<=TRUE; is_sized++) {
+        BISTACK *bs = bistack_new(1<<12);
+        bistack_pushdir(bs, BS_BACKWARD);
+        READER *reader = reader_new(environment_new(bs));
+        pos = source;
+        reader_set_getc(reader, stringgetc, &pos);
+        reader_set_sized_lists(reader, is_sized);
+        mu_assert("read incomplete", reader_read(reader));
+        CELLHEADER *form = cell_list_first(reader->reader_context->cellheader);
+        mu_assert("inner list not indexed", !is_sized || (
+            cell_list_first(form)->Extended.flags & CELL_LIST_INDEXED));
+        counts[is_sized] = cellheader_character_count(form);
+        bistack_destroy(bs);
+    }
+    mu_assert("offset table counted", counts[TRUE] == counts[FALSE]);
+    mu_assert("estimate too small", counts[FALSE] >= strlen(source) - 1);
+    return 0;
+}
+
+static int32_t long_list_value(int i) {
+    return i % 5 == 0 ? -i : i % 7 == 0 ? 100003 * i : i;
+}
+
+static READER *read_string(char *source, char is_sized) {
+    static char *pos;
+    BISTACK *bs = bistack_new(1<<16);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    pos = source;
+    reader_set_getc(reader, stringgetc, &pos);
+    reader_set_sized_lists(reader, is_sized);
+    reader_read(reader);
+    return reader;
+}
+
+static char memputc(void *streamobj, char c) {
+    char **pos = (char**)streamobj;
+    *(*pos)++ = c;
+    return TRUE;
+}
+
+static char *test_long_list() {
+    static char source[16384];
+    static char printed[16384];
+    char *pos = source;
+    pos += sprintf(pos, "(");
+    for (int i=0; i<1500; i++) {
+        pos += sprintf(pos, "%d ", long_list_value(i));
+    }
+    sprintf(pos, ")\n");
+
+    for (char is_sized=FALSE; is_sized<=TRUE; is_sized++) {
+        READER *reader = read_string(source, is_sized);
+        CELLHEADER *list = cell_list_first(reader->reader_context->cellheader);
+        mu_assert("long list not extended", cell_is_sized_list(list));
+        mu_assert("wrong offset table",
+            !(list->Extended.flags & CELL_LIST_INDEXED) == !is_sized);
+        mu_assert("wrong length", cell_list_length(list) == 1500);
+        mu_assert("next not at end",
+            (void*)cell_next(list) == reader->environment->bs->forwardptr);
+        for (int i=0; i<1500; i++) {
+            CELLHEADER *child = cell_nth(list, i);
+            mu_assert("wrong value",
+                cell_integer_value(child) == long_list_value(i));
+            mu_assert("small integer extended",
+                cell_is_int32(child) == (i % 7 == 0 && i % 5 && i));
+        }
+
+        // printing reads back to the same cells
+        pos = printed;
+        reader_set_putc(reader, memputc, &pos);
+        mu_assert("pprint incomplete", reader_pprint(reader));
+        *pos = '\0';
+        READER *reread = read_string(printed, is_sized);
+        CELLHEADER *reread_list = cell_list_first(
+            reread->reader_context->cellheader);
+        mu_assert("pprint output differs",
+            cell_size(list) == cell_size(reread_list) &&
+            memcmp(list, reread_list, cell_size(list)) == 0);
+        bistack_destroy(reread->environment->bs);
+        bistack_destroy(reader->environment->bs);
+    }
+    return 0;
+}
+
+static char *test_deep_walk() {
+    // nesting far past CELL_WALK_DEPTH, with an indexed list midway whose
+    // table follows its nested child
+    static char source[2048];
+    char *pos = source;
+    for (int i=0; i<100; i++) {
+        pos += sprintf(pos, "(a ");
+    }
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, "%d ", i);
+    }
+    for (int i=99; i>=0; i--) {
+        for (int j=0; i == 50 && j<20; j++) {
+            pos += sprintf(pos, " %d", j);
+        }
+        pos += sprintf(pos, ")");
+    }
+    sprintf(pos, "\n");
+
+    for (char is_sized=FALSE; is_sized<=TRUE; is_sized++) {
+        READER *reader = read_string(source, is_sized);
+        void *end = reader->environment->bs->forwardptr;
+        CELLHEADER *form = cell_list_first(reader->reader_context->cellheader);
+        CELLHEADER *middle = form;
+        for (int i=0; i<50; i++) {
+            middle = cell_nth(middle, 1);
+        }
+        mu_assert("middle list not indexed", !is_sized || (
+            middle->Extended.flags & CELL_LIST_INDEXED));
+
+        CELL_WALK walk;
+        uint16_t count = 0;
+        cell_walk_init(&walk, form, 1);
+        while (cell_walk_next(&walk)) {
+            count++;
+        }
+        mu_assert("wrong cell count", count == 100 + 100 + 40 + 20);
+        mu_assert("walk not at end", (void*)walk.next == end);
+
+        // a bound short of the last cell ends the walk before it
+        count = 0;
+        cell_walk_init(&walk, form, 1);
+        cell_walk_bound(&walk, (char*)end - 1);
+        while (cell_walk_next(&walk)) {
+            count++;
+        }
+        mu_assert("bounded walk not stopped",
+            walk.remaining > 0 && count < 100 + 100 + 40 + 20);
+        bistack_destroy(reader->environment->bs);
+    }
+    return 0;
+}
+
+static char *test_integer_limits() {
+    READER *reader = read_string(
+        "(2147483647 -2147483648 8191 -8191 8192 -0)\n", FALSE);
+    CELLHEADER *list = cell_list_first(reader->reader_context->cellheader);
+    mu_assert("int32 max", cell_integer_value(cell_nth(list, 0)) == INT32_MAX);
+    mu_assert("int32 min", cell_integer_value(cell_nth(list, 1)) == INT32_MIN);
+    mu_assert("plain max",
+        cell_nth(list, 2)->Integer.type == AST_INTEGER &&
+        cell_integer_value(cell_nth(list, 2)) == 8191);
+    mu_assert("plain min", cell_integer_value(cell_nth(list, 3)) == -8191);
+    mu_assert("extended 8192",
+        cell_is_int32(cell_nth(list, 4)) &&
+        cell_integer_value(cell_nth(list, 4)) == 8192);
+    mu_assert("negative zero", cell_integer_value(cell_nth(list, 5)) == 0);
+    bistack_destroy(reader->environment->bs);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        read_string("(2147483648)\n", FALSE);
+        mu_assert("overflow not reported", 0);
+    } else {
+        mu_assert("wrong error", exctype == READER_SYNTAX_ERROR);
+    }
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_sized_matches_plain);
+    mu_run_test(test_offset_table);
+    mu_run_test(test_character_count);
+    mu_run_test(test_long_list);
+    mu_run_test(test_deep_walk);
+    mu_run_test(test_integer_limits);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
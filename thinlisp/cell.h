@@ -0,0 +1,201 @@
+#ifndef CELL_H
+#define CELL_H
+
+#include <stdint.h>
+#include <string.h>
+#include "defines.h"
+#include "bistack.h"
+
+/*
+ * Cells are normally a 2 byte CELLHEADER, followed by a symbol's characters
+ * or a list's children.  An AST_NONE header is an extended header whose kind
+ * says what follows it.
+ *
+ * Skipping a plain list means walking all of its descendants, and its length
+ * is limited to 10 bits, so a list may instead be stored sized:
+ *
+ *   Extended{kind=CELL_EXT_LIST} | uint16 length | uint16 span | children
+ *     [| uint16 offsets[(length - 1) / CELL_LIST_INDEX_STRIDE]]
+ *
+ * span is the number of bytes following it, children and offsets included.
+ * Lists of CELL_LIST_INDEX_MIN or more children may end with an offset table
+ * locating every CELL_LIST_INDEX_STRIDE'th child relative to the first, which
+ * is flagged by CELL_LIST_INDEXED.
+ *
+ * Integers which do not fit the 13 bits of a plain header are stored as
+ *
+ *   Extended{kind=CELL_EXT_INT32} | int32 value
+ *
+ * The fields following an extended header are unaligned and are accessed
+ * with memcpy.
+ */
+#define CELL_EXT_LIST 1
+#define CELL_EXT_INT32 2
+
+// Extended.flags of a sized list ending with an offset table
+#define CELL_LIST_INDEXED 1
+
+#define CELL_LIST_INDEX_STRIDE 8
+#define CELL_LIST_INDEX_MIN 16
+
+// largest length and magnitude held by plain headers
+#define CELL_LIST_PLAIN_MAX ((1 << 10) - 1)
+#define CELL_INTEGER_PLAIN_MAX ((1 << 13) - 1)
+
+// bytes between a sized list's header and its first child
+#define CELL_SIZED_LIST_HEADER (2 * sizeof(uint16_t))
+
+static inline uint16_t cell_get16(const void *ptr) {
+    uint16_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline void cell_put16(void *ptr, uint16_t value) {
+    memcpy(ptr, &value, sizeof(value));
+}
+
+static inline char cell_is_sized_list(CELLHEADER *cell) {
+    return (
+        cell->Common.type == AST_NONE && cell->Extended.kind == CELL_EXT_LIST);
+}
+
+static inline char cell_is_list(CELLHEADER *cell) {
+    return cell->List.type == AST_LIST || cell_is_sized_list(cell);
+}
+
+static inline char cell_is_int32(CELLHEADER *cell) {
+    return (
+        cell->Common.type == AST_NONE && cell->Extended.kind == CELL_EXT_INT32);
+}
+
+static inline char cell_is_integer(CELLHEADER *cell) {
+    return cell->Integer.type == AST_INTEGER || cell_is_int32(cell);
+}
+
+static inline int32_t cell_integer_value(CELLHEADER *integer) {
+    if (cell_is_int32(integer)) {
+        int32_t value;
+        memcpy(&value, &integer[1], sizeof(value));
+        return value;
+    }
+    return (
+        integer->Integer.sign ?
+        integer->Integer.value : -(int32_t)integer->Integer.value);
+}
+
+static inline uint16_t cell_list_length(CELLHEADER *list) {
+    return (
+        cell_is_sized_list(list) ? cell_get16(&list[1]) : list->List.length);
+}
+
+static inline uint8_t cell_list_prefix(CELLHEADER *list) {
+    return (
+        cell_is_sized_list(list) ? list->Extended.prefix : list->List.prefix);
+}
+
+static inline CELLHEADER *cell_list_first(CELLHEADER *list) {
+    if (cell_is_sized_list(list)) {
+        return (CELLHEADER*)((char*)&list[1] + CELL_SIZED_LIST_HEADER);
+    }
+    return &list[1];
+}
+
+/**
+ * Finds the cell following cell.  Atoms and sized lists are skipped in
+ * constant time, plain lists by walking their descendants.
+ * @param[in] cell Any cell
+ * @return The address just past cell
+ */
+CELLHEADER *cell_next(CELLHEADER *cell);
+
+/**
+ * @return The number of bytes cell occupies
+ */
+static inline uint16_t cell_size(CELLHEADER *cell) {
+    return (char*)cell_next(cell) - (char*)cell;
+}
+
+/**
+ * Finds the n'th child of list.  A sized list with an offset table reaches
+ * it in at most CELL_LIST_INDEX_STRIDE - 1 steps.
+ * @param[in] list A plain or sized list
+ * @param[in] n The index of the child, less than the list's length
+ * @return The child
+ */
+CELLHEADER *cell_nth(CELLHEADER *list, uint16_t n);
+
+/**
+ * Visits cells in order, each list before its children, for walks which
+ * need every cell of a tree without recursing.  Lists may nest to any depth:
+ * only the count of cells left is kept, and a place for each open list with
+ * an offset table, to step over the table after its last child.  Up to
+ * CELL_WALK_DEPTH of those may be open at once.
+ */
+#define CELL_WALK_DEPTH 32
+
+typedef struct cell_walk {
+    // the open lists with offset tables, innermost last
+    CELLHEADER *lists[CELL_WALK_DEPTH];
+    uint8_t depth;
+    // the cells left to visit, at any depth
+    uint32_t remaining;
+    // where a bounded walk must end, or NULL
+    char *end;
+    // the cell visited next, or just past the last cell once done
+    CELLHEADER *next;
+} CELL_WALK;
+
+/**
+ * @param[out] walk The walk to start
+ * @param[in] first The first cell to visit
+ * @param[in] count The number of consecutive cells to visit from first
+ */
+void cell_walk_init(CELL_WALK *walk, CELLHEADER *first, uint16_t count);
+
+/**
+ * Bounds a walk of cells which are not trusted, such as those of a file: a
+ * cell which would not lie wholly before end, or an indexed list nested past
+ * CELL_WALK_DEPTH, ends the walk early with remaining left above 0 instead
+ * of raising an error.
+ */
+static inline void cell_walk_bound(CELL_WALK *walk, void *end) {
+    walk->end = end;
+}
+
+/**
+ * @return The next cell of the walk, or NULL when all cells were visited
+ */
+CELLHEADER *cell_walk_next(CELL_WALK *walk);
+
+/**
+ * Converts a list into a sized list with an offset table, in place.  The list
+ * must be the last thing allocated on the forward stack of bs, which grows
+ * by the sized header and offset table.  Empty lists and lists whose span
+ * would not fit in 16 bits are left as they are.
+ * @param[in] bs The bistack holding the list
+ * @param[in] list The list
+ * @return list
+ */
+CELLHEADER *cell_size_list(BISTACK *bs, CELLHEADER *list);
+
+/**
+ * Counts children just allocated at the end of list, which must be the last
+ * thing on the forward stack of bs.  A plain list outgrowing its 10 bit
+ * length is converted to a sized list in place, moving its children.
+ * @param[in] bs The bistack holding the list
+ * @param[in] list A list without an offset table
+ * @param[in] count The number of children added
+ */
+void cell_list_add(BISTACK *bs, CELLHEADER *list, uint16_t count);
+
+/**
+ * Stores value in an integer, converting a plain integer which is the last
+ * thing on the forward stack of bs to CELL_EXT_INT32 if it does not fit.
+ * @param[in] bs The bistack holding the integer
+ * @param[in] integer The integer
+ * @param[in] value The value to store
+ */
+void cell_set_integer(BISTACK *bs, CELLHEADER *integer, int32_t value);
+
+#endif
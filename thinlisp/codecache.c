@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "nvmem.h"
+#include "codecache.h"
+
+CODECACHE *codecache_init(CODECACHE *cache, uint8_t *arena, uint16_t size) {
+    cache->arena = arena;
+    cache->arena_size = size;
+    cache->used = 0;
+    cache->clock = 0;
+    cache->faults = 0;
+    memset(cache->entries, 0, sizeof(cache->entries));
+    return cache;
+}
+
+
+static void codecache_evict(CODECACHE *cache, CODECACHE_ENTRY *victim) {
+    /**
+     * Removes victim and slides the bodies after it down over its space.
+     */
+    uint16_t end = victim->offset + victim->size;
+    memmove(
+        &cache->arena[victim->offset], &cache->arena[end], cache->used - end);
+    for (uint8_t i=0; i<CODECACHE_SLOTS; i++) {
+        CODECACHE_ENTRY *entry = &cache->entries[i];
+        if (entry->addr && entry->offset > victim->offset) {
+            entry->offset -= victim->size;
+        }
+    }
+    cache->used -= victim->size;
+    victim->addr = 0;
+}
+
+
+static CODECACHE_ENTRY *codecache_least_recent(CODECACHE *cache) {
+    // ages are differences from the clock, so wrapping does not matter
+    CODECACHE_ENTRY *oldest = NULL;
+    for (uint8_t i=0; i<CODECACHE_SLOTS; i++) {
+        CODECACHE_ENTRY *entry = &cache->entries[i];
+        if (entry->addr == 0) {
+            continue;
+        }
+        if (oldest == NULL || (uint16_t)(cache->clock - entry->last_used) >
+                (uint16_t)(cache->clock - oldest->last_used)) {
+            oldest = entry;
+        }
+    }
+    return oldest;
+}
+
+
+static CODECACHE_ENTRY *codecache_fault(CODECACHE *cache, code_addr_t addr) {
+    // checked at the store's width, before it narrows to an entry's size
+    code_addr_t size = nvmem_blocksize(addr) - NVMEM_BLOCK_HEADER;
+    lassert(size <= cache->arena_size, CODECACHE_SIZE_ERROR);
+
+    CODECACHE_ENTRY *entry = NULL;
+    for (uint8_t i=0; i<CODECACHE_SLOTS && !entry; i++) {
+        if (cache->entries[i].addr == 0) {
+            entry = &cache->entries[i];
+        }
+    }
+    while (!entry || cache->arena_size - cache->used < size) {
+        CODECACHE_ENTRY *victim = codecache_least_recent(cache);
+        codecache_evict(cache, victim);
+        if (!entry) {
+            entry = victim;
+        }
+    }
+
+    entry->addr = addr;
+    entry->offset = cache->used;
+    entry->size = size;
+    nvmem_loadblock(&cache->arena[entry->offset], addr);
+    cache->used += size;
+    cache->faults++;
+    return entry;
+}
+
+
+uint8_t *codecache_body(CODECACHE *cache, LAZY_FUNCTION *fn, uint16_t *size) {
+    CODECACHE_ENTRY *entry = &cache->entries[fn->slot];
+    if (entry->addr != fn->addr) {
+        entry = NULL;
+        for (uint8_t i=0; i<CODECACHE_SLOTS && !entry; i++) {
+            if (cache->entries[i].addr == fn->addr) {
+                entry = &cache->entries[i];
+            }
+        }
+        if (!entry) {
+            entry = codecache_fault(cache, fn->addr);
+        }
+        fn->slot = entry - cache->entries;
+    }
+
+    entry->last_used = ++cache->clock;
+    if (size) {
+        *size = entry->size;
+    }
+    return &cache->arena[entry->offset];
+}
+
+
+void codecache_invalidate(CODECACHE *cache, code_addr_t addr) {
+    for (uint8_t i=0; i<CODECACHE_SLOTS; i++) {
+        if (cache->entries[i].addr == addr) {
+            codecache_evict(cache, &cache->entries[i]);
+        }
+    }
+}
+
+
+#ifdef CODECACHE_TEST
+#include <stdio.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static code_addr_t save_body(uint8_t fill, uint16_t size) {
+    uint8_t body[256];
+    memset(body, fill, size);
+    return nvmem_saveblock(body, size);
+}
+
+static char *check_body(CODECACHE *cache, LAZY_FUNCTION *fn, uint8_t fill) {
+    uint16_t size;
+    uint8_t *body = codecache_body(cache, fn, &size);
+    mu_assert("body too small", size >= 60);
+    for (uint16_t i=0; i<60; i++) {
+        mu_assert("wrong body", body[i] == fill);
+    }
+    return 0;
+}
+
+static char *test_lru() {
+    nvmem_initmem();
+    nvmem_init();
+    LAZY_FUNCTION fns[6];
+    for (uint8_t i=0; i<6; i++) {
+        lazy_function_bind(&fns[i], save_body('a' + i, 60));
+    }
+
+    // room for three bodies
+    static uint8_t arena[200];
+    CODECACHE cache;
+    codecache_init(&cache, arena, sizeof(arena));
+    char *message;
+
+    for (int round=0; round<3; round++) {
+        for (uint8_t i=0; i<3; i++) {
+            if ((message = check_body(&cache, &fns[i], 'a' + i))) {
+                return message;
+            }
+        }
+    }
+    mu_assert("bodies reloaded while cached", cache.faults == 3);
+
+    // 0 was used least recently and is evicted, 1 and 2 survive
+    if ((message = check_body(&cache, &fns[3], 'd'))) {
+        return message;
+    }
+    mu_assert("no fault for new body", cache.faults == 4);
+    if ((message = check_body(&cache, &fns[1], 'b'))) {
+        return message;
+    }
+    if ((message = check_body(&cache, &fns[2], 'c'))) {
+        return message;
+    }
+    mu_assert("recent body evicted", cache.faults == 4);
+    if ((message = check_body(&cache, &fns[0], 'a'))) {
+        return message;
+    }
+    mu_assert("evicted body not reloaded", cache.faults == 5);
+
+    // bodies moved by compaction are still found intact
+    for (uint8_t i=0; i<6; i++) {
+        if ((message = check_body(&cache, &fns[i], 'a' + i))) {
+            return message;
+        }
+    }
+
+    codecache_invalidate(&cache, fns[5].addr);
+    uint16_t faults = cache.faults;
+    if ((message = check_body(&cache, &fns[5], 'f'))) {
+        return message;
+    }
+    mu_assert("invalidated body not reloaded", cache.faults == faults + 1);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        LAZY_FUNCTION big;
+        lazy_function_bind(&big, save_body('z', 250));
+        codecache_body(&cache, &big, NULL);
+        mu_assert("oversized body accepted", 0);
+    } else {
+        mu_assert("wrong error", exctype == CODECACHE_SIZE_ERROR);
+    }
+    return 0;
+}
+
+#if NVMEM_ADDRESS_BITS > 16
+static char *test_wide_block() {
+    /**
+     * A body of 64 KB or more is too large for any arena, rather than the
+     * size of its low 16 bits.
+     */
+    nvmem_initmem();
+    nvmem_init();
+    static uint8_t body[(1L << 16) + 60];
+    memset(body, 'w', sizeof(body));
+    LAZY_FUNCTION fn;
+    lazy_function_bind(&fn, nvmem_saveblock(body, sizeof(body)));
+
+    static uint8_t arena[200];
+    CODECACHE cache;
+    codecache_init(&cache, arena, sizeof(arena));
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        codecache_body(&cache, &fn, NULL);
+        mu_assert("64 KB body accepted", 0);
+    }
+    mu_assert("wrong error", exctype == CODECACHE_SIZE_ERROR);
+    mu_assert("arena used", cache.used == 0 && cache.faults == 0);
+    return 0;
+}
+#endif
+
+static char *all_tests() {
+    mu_run_test(test_lru);
+#if NVMEM_ADDRESS_BITS > 16
+    mu_run_test(test_wide_block);
+#endif
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
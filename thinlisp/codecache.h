@@ -0,0 +1,74 @@
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <stdint.h>
+#include "defines.h"
+#include "nvmem.h"
+
+/*
+ * A bounded RAM cache of function bodies stored in nvmem.  A function bound
+ * to an nvmem address is faulted in on its first call; when the arena is
+ * full the least recently used bodies are evicted and the others compacted
+ * to the start of the arena.  Bodies therefore move, and a body is only
+ * valid until the next codecache_body call.
+ */
+#define CODECACHE_SLOTS 8
+
+typedef struct codecache_entry {
+    // the nvmem block of the body, or 0 for an unused entry
+    code_addr_t addr;
+    uint16_t offset;
+    uint16_t size;
+    // the cache's clock when the body was last used
+    uint16_t last_used;
+} CODECACHE_ENTRY;
+
+typedef struct codecache {
+    uint8_t *arena;
+    uint16_t arena_size;
+    // bytes of the arena in use, bodies are packed from its start
+    uint16_t used;
+    uint16_t clock;
+    // bodies loaded from nvmem, for tuning the arena size
+    uint16_t faults;
+    CODECACHE_ENTRY entries[CODECACHE_SLOTS];
+} CODECACHE;
+
+/**
+ * A global function binding whose body lives in nvmem.
+ */
+typedef struct lazy_function {
+    code_addr_t addr;
+    // the entry which last held the body, checked before searching
+    uint8_t slot;
+} LAZY_FUNCTION;
+
+/**
+ * Initializes a cache over arena.
+ * @param[out] cache The cache to initialize
+ * @param[in] arena Storage for bodies
+ * @param[in] size The size of arena
+ * @return cache
+ */
+CODECACHE *codecache_init(CODECACHE *cache, uint8_t *arena, uint16_t size);
+
+/**
+ * Finds the body of fn, loading it from nvmem if it is not cached.
+ * @param[in] cache The cache
+ * @param[in,out] fn The function, whose slot hint is updated
+ * @param[out] size Receives the size of the body, may be NULL
+ * @return The body, valid until the next call
+ */
+uint8_t *codecache_body(CODECACHE *cache, LAZY_FUNCTION *fn, uint16_t *size);
+
+/**
+ * Drops a cached body, for when the block at addr is rewritten or freed.
+ */
+void codecache_invalidate(CODECACHE *cache, code_addr_t addr);
+
+static inline void lazy_function_bind(LAZY_FUNCTION *fn, code_addr_t addr) {
+    fn->addr = addr;
+    fn->slot = 0;
+}
+
+#endif
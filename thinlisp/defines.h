@@ -22,6 +22,12 @@
 #define strncpy_P strncpy
 #endif
 
+// constant tables stay in program memory on the AVR, see rom.h
+#ifndef PROGMEM
+#define PROGMEM
+#define memcpy_P memcpy
+#endif
+
 
 typedef char bool;
 
@@ -85,6 +91,8 @@ typedef struct ast_type {
       uint8_t type : 2;
       uint8_t prefix : 4;
       uint8_t terminator : 1;
+      // named so that initializers zero it and .bitfield compares are stable
+      uint8_t reserved : 1;
      };
      uint8_t bitfield;
   };
@@ -116,6 +124,14 @@ typedef union {
     uint16_t length : 10;
   } List;
 
+  /* Extended type, an AST_NONE header whose kind is one of CELL_EXT_* */
+  struct {
+    uint16_t type : 2;
+    uint16_t kind : 4;
+    uint16_t prefix : 4;
+    uint16_t flags : 6;
+  } Extended;
+
   struct {
     uint16_t type : 2;
     uint16_t rest : 14;
@@ -15,6 +15,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include "nvdevice.h"
 
 #define MAX_SYMBOL_CHARS 32
 
@@ -45,52 +48,29 @@ typedef struct symbol {
 } symbol;
 
 
+#ifdef ARDUINO
 size_t eeprom_get_size() {
     return 1024;
 }
 
+#else
+// eeprom.bin unless a simulated device is set in its place.  A new file is
+// zeroed, as eeprom_alloc expects of space never written.
+NVDEVICE eeprom_file_device = NVDEVICE_FILE("eeprom.bin", 1024, 0);
+NVDEVICE *eeprom_device = &eeprom_file_device;
 
-#ifdef ARDUINO
 
-#else
-int eeprom_open() {
-    int fd = open("eeprom.bin", O_RDWR);
-    if (fd == -1) {
-        if (errno == ENOENT) {
-            // eeprom file does not exist, create and write freeblock to init
-            char *nullchar = { '\0' };
-            fd = eeprom_open(O_CREAT | O_WRONLY);
-            for (int i=0; i<eeprom_get_size(); i++) {
-                write(fd, nullchar, 1);
-            }
-            close(fd);
-            return eeprom_open();
-        } else {
-            perror("unable to open eeprom.bin");
-            exit(-1);
-        }
-    } else {
-        return fd;
-    }
+size_t eeprom_get_size() {
+    return eeprom_device->size;
 }
 
 
 void eeprom_read(size_t addr, void *buff, size_t n) {
-    int fd = eeprom_open();
-    if ((lseek(fd, addr, SEEK_SET) != addr) || read(fd, buff, n) < n) {
-        perror("unable to seek or read in eeprom");
-        exit(-1);
-    }
-    close(fd);
+    eeprom_device->read(eeprom_device, addr, buff, n);
 }
 
 void eeprom_write(size_t addr, void *buff, size_t n) {
-    int fd = eeprom_open();
-    if ((lseek(fd, addr, SEEK_SET) != addr) || write(fd, buff, n) < n) {
-        perror("unable to write in eeprom");
-        exit(-1);
-    }
-    close(fd);
+    eeprom_device->write(eeprom_device, addr, buff, n);
 }
 
 void eeprom_free(size_t addr) {
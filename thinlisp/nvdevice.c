@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "nvdevice.h"
+
+#define NVDEVICE_COPY_SIZE 64
+
+
+static inline void nvdevice_check(NVDEVICE *device, size_t addr, size_t len) {
+    lassert(addr <= device->size && len <= device->size - addr,
+        NVMEM_ADDRESS_ERROR);
+}
+
+
+static void nvdevice_ram_read(
+        NVDEVICE *device, size_t addr, void *dest, size_t len) {
+    nvdevice_check(device, addr, len);
+    memcpy(dest, device->mem + addr, len);
+}
+
+static void nvdevice_ram_write(
+        NVDEVICE *device, size_t addr, const void *src, size_t len) {
+    nvdevice_check(device, addr, len);
+    memcpy(device->mem + addr, src, len);
+}
+
+static void nvdevice_ram_erase(NVDEVICE *device, size_t addr, size_t len) {
+    nvdevice_check(device, addr, len);
+    memset(device->mem + addr, 0xff, len);
+}
+
+NVDEVICE *nvdevice_ram(NVDEVICE *device, uint8_t *mem, size_t size) {
+    device->read = nvdevice_ram_read;
+    device->write = nvdevice_ram_write;
+    device->erase = nvdevice_ram_erase;
+    device->size = size;
+    device->mem = mem;
+    return device;
+}
+
+
+static FILE *nvdevice_file_open(NVDEVICE *device, size_t addr, size_t len) {
+    /**
+     * Opens the device's file positioned at addr, creating it if missing.
+     */
+    nvdevice_check(device, addr, len);
+    FILE *file = fopen(device->file.filename, "rb+");
+    if (file == NULL) {
+        file = fopen(device->file.filename, "wb+");
+        lassert(file != NULL, NVMEM_WRITE_ERROR);
+        for (size_t i=0; i<device->size; i++) {
+            fputc(device->file.blank, file);
+        }
+    }
+    lassert(fseek(file, addr, SEEK_SET) != -1, NVMEM_READ_ERROR);
+    return file;
+}
+
+void nvdevice_file_read(NVDEVICE *device, size_t addr, void *dest, size_t len) {
+    FILE *file = nvdevice_file_open(device, addr, len);
+    size_t count = fread(dest, 1, len, file);
+    fclose(file);
+    lassert(count == len, NVMEM_READ_ERROR);
+}
+
+void nvdevice_file_write(
+        NVDEVICE *device, size_t addr, const void *src, size_t len) {
+    FILE *file = nvdevice_file_open(device, addr, len);
+    size_t count = fwrite(src, 1, len, file);
+    fclose(file);
+    lassert(count == len, NVMEM_WRITE_ERROR);
+}
+
+void nvdevice_file_erase(NVDEVICE *device, size_t addr, size_t len) {
+    uint8_t erased[NVDEVICE_COPY_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    FILE *file = nvdevice_file_open(device, addr, len);
+    size_t count = 0;
+    for (size_t pos=0; pos<len; pos+=sizeof(erased)) {
+        size_t piece = len - pos < sizeof(erased) ? len - pos : sizeof(erased);
+        count += fwrite(erased, 1, piece, file);
+    }
+    fclose(file);
+    lassert(count == len, NVMEM_WRITE_ERROR);
+}
+
+NVDEVICE *nvdevice_file(
+        NVDEVICE *device, const char *filename, size_t size, uint8_t blank) {
+    *device = (NVDEVICE)NVDEVICE_FILE(filename, size, blank);
+    return device;
+}
+
+
+static void nvdevice_sim_read(
+        NVDEVICE *device, size_t addr, void *dest, size_t len) {
+    device->sim.backing->read(device->sim.backing, addr, dest, len);
+    device->sim.stats.bytes_read += len;
+    device->sim.stats.time_ns += (uint64_t)len * device->sim.model->read_ns;
+}
+
+static void nvdevice_sim_wear(NVDEVICE *device, size_t page) {
+    if (device->sim.wear) {
+        device->sim.wear[page]++;
+    }
+}
+
+static char nvdevice_sim_sets_bits(
+        NVDEVICE *device, size_t addr, const uint8_t *src, size_t len) {
+    /**
+     * Whether writing src would set a bit which is clear.
+     */
+    uint8_t old[NVDEVICE_COPY_SIZE];
+    for (size_t pos=0; pos<len; pos+=sizeof(old)) {
+        size_t piece = len - pos < sizeof(old) ? len - pos : sizeof(old);
+        device->sim.backing->read(device->sim.backing, addr + pos, old, piece);
+        for (size_t i=0; i<piece; i++) {
+            if ((old[i] & src[pos + i]) != src[pos + i]) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static void nvdevice_sim_write(
+        NVDEVICE *device, size_t addr, const void *src, size_t len) {
+    const NVDEVICE_MODEL *model = device->sim.model;
+    const uint8_t *pos = (const uint8_t*)src;
+    size_t end = addr + len;
+    nvdevice_check(device, addr, len);
+
+    // account page by page, the backing device holds the result
+    for (size_t start=addr; start<end; ) {
+        size_t page = start / model->page_size;
+        size_t piece = (page + 1) * model->page_size - start;
+        piece = piece < end - start ? piece : end - start;
+
+        if (!model->is_flash) {
+            device->sim.stats.time_ns += (uint64_t)piece * model->write_ns;
+            nvdevice_sim_wear(device, page);
+        } else if (nvdevice_sim_sets_bits(device, start, pos, piece)) {
+            device->sim.stats.erases++;
+            device->sim.stats.time_ns += (
+                model->erase_ns + (uint64_t)model->page_size * model->write_ns);
+            nvdevice_sim_wear(device, page);
+        } else {
+            device->sim.stats.time_ns += (uint64_t)piece * model->write_ns;
+        }
+        pos += piece;
+        start += piece;
+    }
+
+    device->sim.backing->write(device->sim.backing, addr, src, len);
+    device->sim.stats.bytes_written += len;
+}
+
+static void nvdevice_sim_erase(NVDEVICE *device, size_t addr, size_t len) {
+    const NVDEVICE_MODEL *model = device->sim.model;
+    nvdevice_check(device, addr, len);
+    lassert(
+        !model->is_flash ||
+        (addr % model->page_size == 0 && len % model->page_size == 0),
+        NVMEM_ADDRESS_ERROR);
+
+    if (len) {
+        size_t last = (addr + len - 1) / model->page_size;
+        for (size_t page=addr / model->page_size; page<=last; page++) {
+            device->sim.stats.erases++;
+            device->sim.stats.time_ns += model->erase_ns;
+            nvdevice_sim_wear(device, page);
+        }
+    }
+    device->sim.backing->erase(device->sim.backing, addr, len);
+}
+
+NVDEVICE *nvdevice_sim(
+        NVDEVICE *device,
+        NVDEVICE *backing,
+        const NVDEVICE_MODEL *model,
+        uint16_t *wear) {
+    device->read = nvdevice_sim_read;
+    device->write = nvdevice_sim_write;
+    device->erase = nvdevice_sim_erase;
+    device->size = backing->size;
+    device->sim.backing = backing;
+    device->sim.model = model;
+    memset(&device->sim.stats, 0, sizeof(device->sim.stats));
+    device->sim.wear = wear;
+    if (wear) {
+        memset(wear, 0, sizeof(uint16_t) * (
+            (device->size + model->page_size - 1) / model->page_size));
+    }
+    return device;
+}
+
+uint16_t nvdevice_max_wear(NVDEVICE *device) {
+    uint16_t most = 0;
+    size_t npages = (
+        (device->size + device->sim.model->page_size - 1) /
+        device->sim.model->page_size);
+    for (size_t page=0; device->sim.wear && page<npages; page++) {
+        most = device->sim.wear[page] > most ? device->sim.wear[page] : most;
+    }
+    return most;
+}
+
+
+#ifdef NVDEVICE_TEST
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+#define TEST_SIZE 2048
+
+static char *test_ram_and_file() {
+    static uint8_t mem[TEST_SIZE];
+    NVDEVICE devices[2];
+    remove("nvdevice.bin");
+    nvdevice_ram(&devices[0], mem, sizeof(mem));
+    nvdevice_file(&devices[1], "nvdevice.bin", TEST_SIZE, 0);
+
+    for (int i=0; i<2; i++) {
+        NVDEVICE *device = &devices[i];
+        uint8_t data[300];
+        uint8_t got[300];
+        for (int j=0; j<sizeof(data); j++) {
+            data[j] = j * 13;
+        }
+        device->write(device, 1000, data, sizeof(data));
+        device->read(device, 1000, got, sizeof(got));
+        mu_assert("data differs", memcmp(data, got, sizeof(data)) == 0);
+
+        device->erase(device, 1100, 50);
+        device->read(device, 1000, got, sizeof(got));
+        mu_assert("erase missed", got[100] == 0xff && got[149] == 0xff);
+        mu_assert("erase overran",
+            got[99] == data[99] && got[150] == data[150]);
+
+        int exctype = setjmp(__jmpbuff);
+        if (exctype == 0) {
+            device->read(device, TEST_SIZE - 10, got, 11);
+            mu_assert("read past end", 0);
+        } else {
+            mu_assert("wrong error", exctype == NVMEM_ADDRESS_ERROR);
+        }
+    }
+
+    // a new file is blank
+    uint8_t c;
+    devices[1].read(&devices[1], 0, &c, 1);
+    mu_assert("new file not blank", c == 0);
+    remove("nvdevice.bin");
+    return 0;
+}
+
+static char *test_flash_model() {
+    static uint8_t mem[TEST_SIZE];
+    static const NVDEVICE_MODEL model = NVDEVICE_FLASH_MODEL;
+    uint16_t wear[TEST_SIZE / 256];
+    NVDEVICE ram;
+    NVDEVICE flash;
+    nvdevice_sim(&flash, nvdevice_ram(&ram, mem, sizeof(mem)), &model, wear);
+    flash.erase(&flash, 0, TEST_SIZE);
+    mu_assert("erases not counted", flash.sim.stats.erases == TEST_SIZE / 256);
+
+    // programming erased bytes, then clearing more bits, needs no erase
+    uint8_t data[4] = { 0xf0, 0x0f, 0xff, 0x00 };
+    flash.write(&flash, 10, data, sizeof(data));
+    data[0] = 0x30;
+    flash.write(&flash, 10, data, sizeof(data));
+    mu_assert("programming erased",
+        flash.sim.stats.erases == TEST_SIZE / 256 && wear[0] == 1);
+
+    // setting a bit erases the page, and each page a write touches
+    memset(data, 0xff, sizeof(data));
+    flash.write(&flash, 8, data, sizeof(data));
+    mu_assert("page not erased",
+        flash.sim.stats.erases == TEST_SIZE / 256 + 1 && wear[0] == 2);
+    memset(data, 0, sizeof(data));
+    flash.write(&flash, 254, data, sizeof(data));
+    memset(data, 0xff, sizeof(data));
+    flash.write(&flash, 254, data, sizeof(data));
+    mu_assert("pages not erased", wear[0] == 3 && wear[1] == 2);
+    mu_assert("wrong max wear", nvdevice_max_wear(&flash) == 3);
+
+    uint64_t time_ns = (
+        TEST_SIZE / 256 * model.erase_ns +
+        3 * sizeof(data) * model.write_ns +
+        3 * (model.erase_ns + 256 * model.write_ns));
+    mu_assert("wrong modelled time", flash.sim.stats.time_ns == time_ns);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        flash.erase(&flash, 10, 256);
+        mu_assert("partial page erased", 0);
+    } else {
+        mu_assert("wrong error", exctype == NVMEM_ADDRESS_ERROR);
+    }
+    return 0;
+}
+
+static char *test_eeprom_model() {
+    static uint8_t mem[TEST_SIZE];
+    static const NVDEVICE_MODEL model = NVDEVICE_EEPROM_MODEL;
+    uint16_t wear[TEST_SIZE / 4];
+    NVDEVICE ram;
+    NVDEVICE eeprom;
+    nvdevice_sim(&eeprom, nvdevice_ram(&ram, mem, sizeof(mem)), &model, wear);
+
+    uint8_t data[6] = { 1, 2, 3, 4, 5, 6 };
+    eeprom.write(&eeprom, 2, data, sizeof(data));
+    eeprom.read(&eeprom, 0, data, sizeof(data));
+    mu_assert("eeprom write erased", eeprom.sim.stats.erases == 0);
+    mu_assert("pages not worn", wear[0] == 1 && wear[1] == 1 && wear[2] == 0);
+    mu_assert("wrong modelled time",
+        eeprom.sim.stats.time_ns == 6 * model.write_ns + 6 * model.read_ns);
+    mu_assert("wrong byte counts",
+        eeprom.sim.stats.bytes_written == 6 &&
+        eeprom.sim.stats.bytes_read == 6);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_ram_and_file);
+    mu_run_test(test_flash_model);
+    mu_run_test(test_eeprom_model);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
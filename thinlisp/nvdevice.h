@@ -0,0 +1,123 @@
+#ifndef NVDEVICE_H
+#define NVDEVICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "defines.h"
+
+/*
+ * The storage under nvmem and the EEPROM, behind read, write and erase
+ * functions so the store can be RAM, a file on the host, or a simulated
+ * device which models what the accesses would cost on real hardware.
+ *
+ * A simulated device passes accesses on to a backing device, adding up the
+ * modelled time of each and the wear of each page.  Flash programming only
+ * clears bits, so a flash write which sets any bit costs an erase of its
+ * page, and rewriting the rest of it.  EEPROM erases each byte as it is
+ * written, so every write wears its page.
+ */
+typedef struct nvdevice_model {
+  // modelled nanoseconds per byte read and written, and per page erased
+  uint32_t read_ns;
+  uint32_t write_ns;
+  uint32_t erase_ns;
+  uint16_t page_size;
+  char is_flash;
+} NVDEVICE_MODEL;
+
+// an ATmega328's EEPROM, 3.3ms to erase and write a byte
+#define NVDEVICE_EEPROM_MODEL { \
+  .read_ns=250, .write_ns=3300000, .erase_ns=1800000, \
+  .page_size=4, .is_flash=FALSE }
+
+// NOR flash with 256 byte pages
+#define NVDEVICE_FLASH_MODEL { \
+  .read_ns=50, .write_ns=8000, .erase_ns=4000000, \
+  .page_size=256, .is_flash=TRUE }
+
+typedef struct nvdevice_stats {
+  uint32_t bytes_read;
+  uint32_t bytes_written;
+  uint32_t erases;
+  uint64_t time_ns;
+} NVDEVICE_STATS;
+
+typedef struct nvdevice {
+  void (*read)(struct nvdevice *device, size_t addr, void *dest, size_t len);
+  void (*write)(
+      struct nvdevice *device, size_t addr, const void *src, size_t len);
+  // sets len bytes from addr to 0xff, whole pages on flash
+  void (*erase)(struct nvdevice *device, size_t addr, size_t len);
+  size_t size;
+
+  union {
+    uint8_t *mem;
+    struct {
+      const char *filename;
+      // the value of each byte of a file created by the device
+      uint8_t blank;
+    } file;
+    struct {
+      struct nvdevice *backing;
+      const NVDEVICE_MODEL *model;
+      NVDEVICE_STATS stats;
+      // erases or writes of each page, or NULL
+      uint16_t *wear;
+    } sim;
+  };
+} NVDEVICE;
+
+void nvdevice_file_read(NVDEVICE *device, size_t addr, void *dest, size_t len);
+void nvdevice_file_write(
+    NVDEVICE *device, size_t addr, const void *src, size_t len);
+void nvdevice_file_erase(NVDEVICE *device, size_t addr, size_t len);
+
+/**
+ * Initializes a file device statically.  The file is created when first
+ * accessed.
+ */
+#define NVDEVICE_FILE(FILENAME, SIZE, BLANK) { \
+  .read=nvdevice_file_read, .write=nvdevice_file_write, \
+  .erase=nvdevice_file_erase, .size=(SIZE), \
+  .file={ .filename=(FILENAME), .blank=(BLANK) } }
+
+/**
+ * A device held in RAM.
+ * @param[out] device The device to initialize
+ * @param[in] mem The device's contents
+ * @param[in] size The size of mem
+ * @return device
+ */
+NVDEVICE *nvdevice_ram(NVDEVICE *device, uint8_t *mem, size_t size);
+
+/**
+ * A device held in a file on the host.
+ * @param[out] device The device to initialize
+ * @param[in] filename The file, created filled with blank if missing
+ * @param[in] size The size of the device
+ * @param[in] blank The value of each byte of a new file
+ * @return device
+ */
+NVDEVICE *nvdevice_file(
+    NVDEVICE *device, const char *filename, size_t size, uint8_t blank);
+
+/**
+ * A simulated device, modelling the cost of accesses to backing.
+ * @param[out] device The device to initialize, with zeroed stats
+ * @param[in] backing The device holding the contents
+ * @param[in] model The costs and page size to model
+ * @param[out] wear Room for a count per page, or NULL
+ * @return device
+ */
+NVDEVICE *nvdevice_sim(
+    NVDEVICE *device,
+    NVDEVICE *backing,
+    const NVDEVICE_MODEL *model,
+    uint16_t *wear);
+
+/**
+ * @return The most any page of a simulated device was worn
+ */
+uint16_t nvdevice_max_wear(NVDEVICE *device);
+
+#endif
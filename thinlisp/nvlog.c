@@ -0,0 +1,527 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "nvmem.h"
+#include "nvlog.h"
+
+#define NVLOG_COPY_SIZE 32
+
+
+static inline code_addr_t nvlog_segment_addr(uint8_t segment) {
+    return NVLOG_START_ADDRESS + (code_addr_t)segment * NVLOG_SEGMENT_SIZE;
+}
+
+static inline uint8_t nvlog_segment_of(code_addr_t addr) {
+    return (addr - NVLOG_START_ADDRESS) / NVLOG_SEGMENT_SIZE;
+}
+
+static void nvlog_free(NVLOG *log, uint8_t segment) {
+    /**
+     * Formats an erased segment as free.
+     */
+    NVLOG_SEGMENT_HEADER header = {
+        .sequence=NVLOG_FREE_SEQUENCE,
+        .erases=log->erases[segment],
+        .reserved=0xffff,
+    };
+    nvmem_set(nvlog_segment_addr(segment), &header, sizeof(header));
+    log->dead[segment] = 0;
+    log->free_segments |= (uint32_t)1 << segment;
+    log->nfree++;
+}
+
+static void nvlog_erase(NVLOG *log, uint8_t segment) {
+    nvmem_erase(nvlog_segment_addr(segment), NVLOG_SEGMENT_SIZE);
+    log->erases[segment]++;
+    nvlog_free(log, segment);
+}
+
+static void nvlog_open(NVLOG *log) {
+    /**
+     * Makes the least worn free segment the head.
+     */
+    int16_t best = -1;
+    for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+        if ((log->free_segments & ((uint32_t)1 << segment)) &&
+                (best < 0 || log->erases[segment] < log->erases[best])) {
+            best = segment;
+        }
+    }
+    lassert(best >= 0, NVMEM_OUT_OF_MEMORY);
+
+    // only the sequence is programmed, the rest of the header stays as is
+    uint32_t sequence = ++log->sequence;
+    nvmem_set(nvlog_segment_addr(best), &sequence, sizeof(sequence));
+    log->free_segments &= ~((uint32_t)1 << best);
+    log->nfree--;
+    log->head = best;
+    log->head_pos = sizeof(NVLOG_SEGMENT_HEADER);
+}
+
+static void nvlog_supersede(NVLOG *log, uint16_t id, code_addr_t addr) {
+    /**
+     * Makes the record at addr the latest of id, and the one before it dead.
+     */
+    code_addr_t old = log->index[id];
+    if (old) {
+        NVLOG_RECORD record;
+        nvmem_fetch(&record, old, sizeof(record));
+        log->dead[nvlog_segment_of(old)] += sizeof(record) + record.len;
+    }
+    log->index[id] = addr;
+}
+
+static code_addr_t nvlog_append(NVLOG *log, uint16_t id, uint16_t len) {
+    /**
+     * Appends a record header for len bytes of data, opening a new head if
+     * the current one is full.  The commit field is left erased until
+     * nvlog_commit.
+     * @return The code address of the record's data
+     */
+    if (log->head_pos + sizeof(NVLOG_RECORD) + len > NVLOG_SEGMENT_SIZE) {
+        nvlog_open(log);
+    }
+    code_addr_t addr = nvlog_segment_addr(log->head) + log->head_pos;
+    NVLOG_RECORD record = { .id=id, .len=len };
+    nvmem_set(addr, &record, offsetof(NVLOG_RECORD, commit));
+    log->head_pos += sizeof(record) + len;
+    nvlog_supersede(log, id, addr);
+    return addr + sizeof(record);
+}
+
+static void nvlog_commit(code_addr_t data) {
+    /**
+     * Marks the record whose data is at data as written in full.
+     */
+    uint16_t commit = NVLOG_COMMITTED;
+    nvmem_set(
+        data - sizeof(NVLOG_RECORD) + offsetof(NVLOG_RECORD, commit),
+        &commit, sizeof(commit));
+}
+
+static char nvlog_is_end(NVLOG_RECORD *record) {
+    /**
+     * @return TRUE if record is still erased, and so ends its segment
+     */
+    return (
+        record->id == NVLOG_END_ID && record->len == 0xffff &&
+        record->commit == 0xffff);
+}
+
+static void nvlog_reserve(NVLOG *log, uint16_t len) {
+    /**
+     * Cleans until a record of len bytes fits the head, or opening a new
+     * head leaves NVLOG_RESERVE free segments.
+     */
+    for (uint8_t tries=0;
+            log->head_pos + sizeof(NVLOG_RECORD) + len > NVLOG_SEGMENT_SIZE &&
+            log->nfree <= NVLOG_RESERVE;
+            tries++) {
+        lassert(
+            tries < NVLOG_SEGMENTS && nvlog_clean(log, 1), NVMEM_OUT_OF_MEMORY);
+    }
+}
+
+static void nvlog_replay(NVLOG *log, uint8_t segment) {
+    code_addr_t addr = nvlog_segment_addr(segment);
+    uint16_t pos = sizeof(NVLOG_SEGMENT_HEADER);
+    while (pos + sizeof(NVLOG_RECORD) <= NVLOG_SEGMENT_SIZE) {
+        NVLOG_RECORD record;
+        nvmem_fetch(&record, addr + pos, sizeof(record));
+        if (nvlog_is_end(&record)) {
+            break;
+        } else if (record.commit != NVLOG_COMMITTED) {
+            // a write cut short, the rest of the segment is not appended to
+            log->dead[segment] += NVLOG_SEGMENT_SIZE - pos;
+            pos = NVLOG_SEGMENT_SIZE;
+            break;
+        }
+        lassert(
+            record.id < NVLOG_MAX_IDS &&
+            pos + sizeof(record) + record.len <= NVLOG_SEGMENT_SIZE,
+            NVMEM_READ_ERROR);
+        nvlog_supersede(log, record.id, addr + pos);
+        pos += sizeof(record) + record.len;
+    }
+    log->head = segment;
+    log->head_pos = pos;
+}
+
+void nvlog_mount(NVLOG *log) {
+    memset(log, 0, sizeof(NVLOG));
+    uint32_t sequences[NVLOG_SEGMENTS];
+
+    for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+        NVLOG_SEGMENT_HEADER header;
+        nvmem_fetch(&header, nvlog_segment_addr(segment), sizeof(header));
+        if (header.erases == 0xffff) {
+            // never formatted, so still as erased as it came
+            log->erases[segment] = 0;
+            nvlog_free(log, segment);
+        } else {
+            log->erases[segment] = header.erases;
+            if (header.sequence == NVLOG_FREE_SEQUENCE) {
+                log->free_segments |= (uint32_t)1 << segment;
+                log->nfree++;
+            }
+        }
+        sequences[segment] = header.sequence;
+    }
+
+    // replay oldest first, leaving the newest segment as the head
+    char has_head = FALSE;
+    while (TRUE) {
+        int16_t next = -1;
+        for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+            if (sequences[segment] != NVLOG_FREE_SEQUENCE &&
+                    (!has_head || sequences[segment] > log->sequence) &&
+                    (next < 0 || sequences[segment] < sequences[next])) {
+                next = segment;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        nvlog_replay(log, next);
+        log->sequence = sequences[next];
+        has_head = TRUE;
+    }
+
+    if (!has_head) {
+        nvlog_open(log);
+    }
+}
+
+void nvlog_write(NVLOG *log, uint16_t id, const void *data, uint16_t len) {
+    lassert(
+        id < NVLOG_MAX_IDS && len > 0 && len <= NVLOG_MAX_LEN,
+        NVMEM_WRITE_ERROR);
+    nvlog_reserve(log, len);
+    code_addr_t addr = nvlog_append(log, id, len);
+    nvmem_set(addr, (void*)data, len);
+    nvlog_commit(addr);
+}
+
+void nvlog_delete(NVLOG *log, uint16_t id) {
+    lassert(id < NVLOG_MAX_IDS, NVMEM_WRITE_ERROR);
+    code_addr_t addr;
+    if (nvlog_find(log, id, &addr)) {
+        nvlog_reserve(log, 0);
+        nvlog_commit(nvlog_append(log, id, 0));
+    }
+}
+
+uint16_t nvlog_find(NVLOG *log, uint16_t id, code_addr_t *addr) {
+    lassert(id < NVLOG_MAX_IDS, NVMEM_ADDRESS_ERROR);
+    if (log->index[id] == 0) {
+        return 0;
+    }
+    NVLOG_RECORD record;
+    nvmem_fetch(&record, log->index[id], sizeof(record));
+    *addr = log->index[id] + sizeof(record);
+    return record.len;
+}
+
+char nvlog_clean(NVLOG *log, uint16_t min_dead) {
+    /**
+     * Picks the victim with the most dead bytes, the least worn on a tie,
+     * copies the records the index still points at to the head, then erases
+     * it.  Deletions are copied too, in case an older segment still holds a
+     * version of their id.
+     */
+    int16_t victim = -1;
+    for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+        if (segment == log->head ||
+                (log->free_segments & ((uint32_t)1 << segment))) {
+            continue;
+        }
+        if (victim < 0 ||
+                log->dead[segment] > log->dead[victim] ||
+                (log->dead[segment] == log->dead[victim] &&
+                 log->erases[segment] < log->erases[victim])) {
+            victim = segment;
+        }
+    }
+    if (victim < 0 || log->dead[victim] < min_dead ||
+            log->dead[victim] == 0) {
+        return FALSE;
+    }
+
+    code_addr_t addr = nvlog_segment_addr(victim);
+    uint16_t pos = sizeof(NVLOG_SEGMENT_HEADER);
+    while (pos + sizeof(NVLOG_RECORD) <= NVLOG_SEGMENT_SIZE) {
+        NVLOG_RECORD record;
+        nvmem_fetch(&record, addr + pos, sizeof(record));
+        if (nvlog_is_end(&record) || record.commit != NVLOG_COMMITTED) {
+            break;
+        }
+        code_addr_t src = addr + pos + sizeof(record);
+        pos += sizeof(record) + record.len;
+        if (log->index[record.id] != src - sizeof(record)) {
+            continue;
+        }
+
+        code_addr_t dest = nvlog_append(log, record.id, record.len);
+        uint8_t buffer[NVLOG_COPY_SIZE];
+        for (uint16_t i=0; i<record.len; i+=sizeof(buffer)) {
+            uint16_t piece = (
+                record.len - i < sizeof(buffer) ?
+                record.len - i : sizeof(buffer));
+            nvmem_fetch(buffer, src + i, piece);
+            nvmem_set(dest + i, buffer, piece);
+        }
+        nvlog_commit(dest);
+    }
+
+    nvlog_erase(log, victim);
+    return TRUE;
+}
+
+
+#ifdef NVLOG_TEST
+#include <stdio.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+#define TEST_IDS 8
+#define TEST_LEN 120
+#define TEST_ROUNDS 300
+
+static void test_data(uint8_t *data, uint16_t id, uint16_t round) {
+    for (uint16_t i=0; i<TEST_LEN; i++) {
+        data[i] = id * 31 + round * 7 + i;
+    }
+}
+
+static char *check_contents(NVLOG *log, uint16_t rounds) {
+    /**
+     * Every id holds the data of the last round it was written in.
+     */
+    uint8_t expected[TEST_LEN];
+    uint8_t got[TEST_LEN];
+    for (uint16_t id=0; id<TEST_IDS; id++) {
+        code_addr_t addr;
+        test_data(expected, id, rounds - 1);
+        mu_assert("wrong length", nvlog_find(log, id, &addr) == TEST_LEN);
+        nvmem_fetch(got, addr, TEST_LEN);
+        mu_assert("wrong data", memcmp(got, expected, TEST_LEN) == 0);
+    }
+    return 0;
+}
+
+static char *test_write_find_delete() {
+    nvmem_initmem();
+    NVLOG log;
+    nvlog_mount(&log);
+    mu_assert("fresh log not empty", log.nfree == NVLOG_SEGMENTS - 1);
+
+    uint8_t data[TEST_LEN];
+    for (uint16_t round=0; round<3; round++) {
+        for (uint16_t id=0; id<TEST_IDS; id++) {
+            test_data(data, id, round);
+            nvlog_write(&log, id, data, TEST_LEN);
+        }
+    }
+    char *result = check_contents(&log, 3);
+    if (result) {
+        return result;
+    }
+    nvlog_delete(&log, 3);
+    code_addr_t addr;
+    mu_assert("deleted block found", nvlog_find(&log, 3, &addr) == 0);
+    mu_assert("never written block found", nvlog_find(&log, 40, &addr) == 0);
+
+    // the index and dead counts are rebuilt from the store
+    NVLOG remounted;
+    nvlog_mount(&remounted);
+    mu_assert("index differs after mount",
+        memcmp(remounted.index, log.index, sizeof(log.index)) == 0);
+    mu_assert("dead counts differ after mount",
+        memcmp(remounted.dead, log.dead, sizeof(log.dead)) == 0);
+    mu_assert("head differs after mount",
+        remounted.head == log.head && remounted.head_pos == log.head_pos);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        nvlog_write(&log, NVLOG_MAX_IDS, data, 1);
+        mu_assert("bad id accepted", 0);
+    } else {
+        mu_assert("wrong error", exctype == NVMEM_WRITE_ERROR);
+    }
+    return 0;
+}
+
+static char *test_cleaning() {
+    nvmem_initmem();
+    NVLOG log;
+    nvlog_mount(&log);
+    uint8_t data[TEST_LEN];
+    for (uint16_t round=0; round<TEST_ROUNDS; round++) {
+        for (uint16_t id=0; id<TEST_IDS; id++) {
+            test_data(data, id, round);
+            nvlog_write(&log, id, data, TEST_LEN);
+        }
+        char *result = check_contents(&log, round + 1);
+        if (result) {
+            return result;
+        }
+    }
+
+    NVLOG remounted;
+    nvlog_mount(&remounted);
+    char *result = check_contents(&remounted, TEST_ROUNDS);
+    if (result) {
+        return result;
+    }
+
+    // erases are spread over the segments
+    uint16_t least = UINT16_MAX;
+    uint16_t most = 0;
+    for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+        least = log.erases[segment] < least ? log.erases[segment] : least;
+        most = log.erases[segment] > most ? log.erases[segment] : most;
+    }
+    mu_assert("segments cleaned", most > 1);
+    mu_assert("wear not levelled", most - least <= 2);
+
+    // idle cleaning only takes segments worth it
+    while (nvlog_clean(&log, NVLOG_SEGMENT_SIZE / 2)) {
+    }
+    mu_assert("idle cleaning lost data",
+        check_contents(&log, TEST_ROUNDS) == 0);
+    return 0;
+}
+
+static char *test_torn_write() {
+    /**
+     * A write cut short, in its header or its data, leaves the version
+     * before it, and later writes go to another segment.
+     */
+    nvmem_initmem();
+    NVLOG log;
+    nvlog_mount(&log);
+    uint8_t data[TEST_LEN];
+    for (uint16_t id=0; id<TEST_IDS; id++) {
+        test_data(data, id, 0);
+        nvlog_write(&log, id, data, TEST_LEN);
+    }
+
+    for (char in_header=FALSE; in_header<=TRUE; in_header++) {
+        if (in_header) {
+            uint16_t id = 2;
+            nvmem_set(
+                nvlog_segment_addr(log.head) + log.head_pos, &id, sizeof(id));
+        } else {
+            test_data(data, 2, 1);
+            nvmem_set(nvlog_append(&log, 2, TEST_LEN), data, TEST_LEN / 2);
+        }
+        uint8_t head = log.head;
+
+        nvlog_mount(&log);
+        char *result = check_contents(&log, 1);
+        if (result) {
+            return result;
+        }
+        mu_assert("torn segment still appended to",
+            log.head == head && log.head_pos == NVLOG_SEGMENT_SIZE);
+
+        test_data(data, 2, 0);
+        nvlog_write(&log, 2, data, TEST_LEN);
+        mu_assert("write after tear in torn segment", log.head != head);
+        NVLOG remounted;
+        nvlog_mount(&remounted);
+        mu_assert("index differs after tear",
+            memcmp(remounted.index, log.index, sizeof(log.index)) == 0);
+    }
+
+    // the cleaner reclaims torn segments without reading past the tear
+    while (nvlog_clean(&log, 1)) {
+    }
+    mu_assert("torn segment not reclaimed", log.nfree == NVLOG_SEGMENTS - 1);
+    return check_contents(&log, 1);
+}
+
+static char *test_wear() {
+    /**
+     * The same updates cost far fewer page erases, and far less time, on a
+     * simulated flash when appended to the log than when rewritten in place
+     * by the block allocator.
+     */
+    static uint8_t mem[NVMEM_END_ADDRESS];
+    static const NVDEVICE_MODEL model = NVDEVICE_FLASH_MODEL;
+    NVDEVICE ram;
+    NVDEVICE flash;
+    NVDEVICE_STATS in_place;
+    nvdevice_sim(&flash, nvdevice_ram(&ram, mem, sizeof(mem)), &model, NULL);
+    NVDEVICE *previous = nvmem_use_device(&flash);
+    uint8_t data[TEST_LEN];
+    code_addr_t addrs[TEST_IDS] = {0};
+
+    memset(mem, 0xff, sizeof(mem));
+    nvmem_init();
+    for (uint16_t round=0; round<TEST_ROUNDS; round++) {
+        for (uint16_t id=0; id<TEST_IDS; id++) {
+            test_data(data, id, round);
+            if (addrs[id]) {
+                nvmem_freeblock(addrs[id]);
+            }
+            addrs[id] = nvmem_saveblock(data, TEST_LEN);
+        }
+    }
+    in_place = flash.sim.stats;
+
+    memset(mem, 0xff, sizeof(mem));
+    nvdevice_sim(&flash, &ram, &model, NULL);
+    NVLOG log;
+    nvlog_mount(&log);
+    for (uint16_t round=0; round<TEST_ROUNDS; round++) {
+        for (uint16_t id=0; id<TEST_IDS; id++) {
+            test_data(data, id, round);
+            nvlog_write(&log, id, data, TEST_LEN);
+        }
+    }
+    nvmem_use_device(previous);
+
+    uint32_t erases = 0;
+    for (uint8_t segment=0; segment<NVLOG_SEGMENTS; segment++) {
+        erases += log.erases[segment];
+    }
+    printf("page erases: in place %u, log %u\n",
+        in_place.erases, flash.sim.stats.erases);
+    printf("modelled ms: in place %u, log %u\n",
+        (uint32_t)(in_place.time_ns / 1000000),
+        (uint32_t)(flash.sim.stats.time_ns / 1000000));
+    mu_assert("log erased pages besides whole segments",
+        flash.sim.stats.erases ==
+        erases * (NVLOG_SEGMENT_SIZE / model.page_size));
+    mu_assert("log not gentler on flash",
+        flash.sim.stats.erases * 4 < in_place.erases);
+    mu_assert("log not faster on flash",
+        flash.sim.stats.time_ns * 2 < in_place.time_ns);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_write_find_delete);
+    mu_run_test(test_cleaning);
+    mu_run_test(test_torn_write);
+    mu_run_test(test_wear);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
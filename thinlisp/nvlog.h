@@ -0,0 +1,116 @@
+#ifndef NVLOG_H
+#define NVLOG_H
+
+#include <stdint.h>
+#include "defines.h"
+#include "nvmem.h"
+
+/*
+ * A log-structured store for flash, as an alternative to the block
+ * allocator, which rewrites headers in place.  Writing never changes a
+ * programmed byte: each version of a block is appended to the head segment,
+ * and a RAM index maps block ids to their latest record.  Superseded records
+ * are dead, and the cleaner reclaims a segment by copying its live records
+ * to the head and erasing it.
+ *
+ * The log owns the store from NVLOG_START_ADDRESS and divides it into
+ * segments, each a multiple of NVMEM_PAGE_SIZE:
+ *
+ *   NVLOG_SEGMENT_HEADER | records | erased bytes
+ *
+ * A record is an NVLOG_RECORD followed by len bytes of data; a record still
+ * erased ends the records.  A record with len 0 deletes its id.  Segments are
+ * replayed in order of sequence, so the last record of an id wins.
+ *
+ * The commit field of a record is programmed last, once its data is written,
+ * so a write cut short by a reset is found on replay and ignored.  Nothing
+ * more is appended to its segment, which the cleaner reclaims.
+ */
+#define NVLOG_SEGMENT_SIZE 1024
+#define NVLOG_START_ADDRESS \
+  ((NVMEM_FIRST_BLOCK_ADDRESS + NVLOG_SEGMENT_SIZE - 1) & \
+    ~(NVLOG_SEGMENT_SIZE - 1))
+// at most 32, the width of the free segment mask
+#define NVLOG_SEGMENTS \
+  ((NVMEM_END_ADDRESS - NVLOG_START_ADDRESS) / NVLOG_SEGMENT_SIZE > 32 ? 32 : \
+    (NVMEM_END_ADDRESS - NVLOG_START_ADDRESS) / NVLOG_SEGMENT_SIZE)
+#define NVLOG_MAX_IDS 64
+// free segments kept back so the cleaner always has somewhere to copy to
+#define NVLOG_RESERVE 1
+
+// the sequence of a segment which is erased and not yet a head
+#define NVLOG_FREE_SEQUENCE 0xffffffff
+#define NVLOG_END_ID 0xffff
+
+typedef struct {
+  uint32_t sequence;
+  // 0xffff until the segment is first formatted
+  uint16_t erases;
+  uint16_t reserved;
+} NVLOG_SEGMENT_HEADER;
+
+// the commit field of a record whose data was written in full
+#define NVLOG_COMMITTED 0xa55a
+
+typedef struct {
+  uint16_t id;
+  uint16_t len;
+  uint16_t commit;
+} NVLOG_RECORD;
+
+#define NVLOG_MAX_LEN \
+  (NVLOG_SEGMENT_SIZE - sizeof(NVLOG_SEGMENT_HEADER) - sizeof(NVLOG_RECORD))
+
+typedef struct {
+  // the address of each id's latest record, or 0
+  code_addr_t index[NVLOG_MAX_IDS];
+  // bytes of each segment held by superseded records
+  uint16_t dead[NVLOG_SEGMENTS];
+  uint16_t erases[NVLOG_SEGMENTS];
+  uint32_t free_segments;
+  uint8_t nfree;
+
+  // the segment appended to, and the offset of its next record
+  uint8_t head;
+  uint16_t head_pos;
+  uint32_t sequence;
+} NVLOG;
+
+/**
+ * Rebuilds the index by replaying every segment, formatting segments which
+ * were never used.
+ * @param[out] log The log to mount
+ */
+void nvlog_mount(NVLOG *log);
+
+/**
+ * Appends a new version of block id, cleaning first if the log is short of
+ * free segments.
+ * @param[in] log The log
+ * @param[in] id The block id, less than NVLOG_MAX_IDS
+ * @param[in] data The block's data
+ * @param[in] len The length of data, from 1 to NVLOG_MAX_LEN
+ */
+void nvlog_write(NVLOG *log, uint16_t id, const void *data, uint16_t len);
+
+/**
+ * Appends a record deleting block id.
+ */
+void nvlog_delete(NVLOG *log, uint16_t id);
+
+/**
+ * Locates the latest version of block id, to be read with nvmem_fetch.
+ * @param[out] addr Receives the code address of the block's data
+ * @return The block's length, or 0 if it does not exist
+ */
+uint16_t nvlog_find(NVLOG *log, uint16_t id, code_addr_t *addr);
+
+/**
+ * Cleans the segment with the most dead bytes, if it has at least min_dead.
+ * Writes clean when they must; calling this while idle with a larger
+ * min_dead keeps that work off the write path.
+ * @return TRUE if a segment was reclaimed
+ */
+char nvlog_clean(NVLOG *log, uint16_t min_dead);
+
+#endif
@@ -5,61 +5,116 @@
 
 #include "nvmem.h"
 #include "runtime.h"
+#include "utils.h"
+
+
+// bumped by every write, so prefetch windows notice stale contents
+uint16_t nvmem_generation = 0;
+// no block below this address is free
+static code_addr_t nvmem_free_hint = NVMEM_FIRST_BLOCK_ADDRESS;
+
+
+#ifdef POSIX
+// code.mem, as erased as a fresh flash or EEPROM
+static NVDEVICE nvmem_file_device = NVDEVICE_FILE(
+    "code.mem", NVMEM_END_ADDRESS, 0xff);
+NVDEVICE *nvmem_device = &nvmem_file_device;
+
+
+NVDEVICE *nvmem_use_device(NVDEVICE *device) {
+    NVDEVICE *previous = nvmem_device;
+    lassert(device->size >= NVMEM_END_ADDRESS, NVMEM_ADDRESS_ERROR);
+    nvmem_device = device;
+    nvmem_generation++;
+    nvmem_free_hint = NVMEM_FIRST_BLOCK_ADDRESS;
+    return previous;
+}
+#endif
 
 
 void nvmem_initmem() {
 #ifdef POSIX
-  FILE *memfd = fopen("code.mem", "wb");
-  for (int i=0; i<NVMEM_END_ADDRESS; i++) {
-    fwrite("\0", 1, 1, memfd);
-  }
-  fclose(memfd);
+  nvmem_device->erase(nvmem_device, 0, NVMEM_END_ADDRESS);
 #endif
 }
 
 
 void nvmem_fetch(void *dest, code_addr_t src, const size_t len) {
-#ifdef POSIX
-    lassert(src >= NVMEM_START_ADDRESS, NVMEM_ADDRESS_ERROR);
-    FILE *memfd = fopen("code.mem", "rb");
-    assert_seek(memfd, src);
-    assert_read(memfd, dest, len);
-    fclose(memfd);
-
-#elif ARDUINO
-    while (len--) {
-        (*(uint8_t*)dest)++ = pgm_read_byte(addr++);
+#ifdef ARDUINO
+    // program memory is read a byte at a time through the LPM instruction
+    uint8_t *pos = (uint8_t*)dest;
+    for (size_t i=0; i<len; i++) {
+        *pos++ = pgm_read_byte(src + i);
     }
 
+#elif defined(POSIX)
+    lassert(src >= NVMEM_START_ADDRESS, NVMEM_ADDRESS_ERROR);
+    nvmem_device->read(nvmem_device, src, dest, len);
+
 #endif
 }
 
 
 void nvmem_set(code_addr_t dest, void *src, const size_t len) {
+    nvmem_generation++;
 #ifdef POSIX
     lassert(dest >= NVMEM_START_ADDRESS, NVMEM_WRITE_ERROR);
-    FILE *memfd = fopen("code.mem", "rb+");
-    assert_seek(memfd, dest);
-    assert_write(memfd, src, len);
-    fclose(memfd);
+    nvmem_device->write(nvmem_device, dest, src, len);
+#endif
+}
+
+
+void nvmem_erase(code_addr_t dest, const size_t len) {
+    lassert(
+        dest % NVMEM_PAGE_SIZE == 0 && len % NVMEM_PAGE_SIZE == 0,
+        NVMEM_ADDRESS_ERROR);
+    nvmem_generation++;
+#ifdef POSIX
+    lassert(dest >= NVMEM_START_ADDRESS, NVMEM_WRITE_ERROR);
+    nvmem_device->erase(nvmem_device, dest, len);
+#endif
+}
+
+
+void nvmem_window_fill(NVMEM_WINDOW *window, code_addr_t addr) {
+#ifndef ARDUINO
+    lassert(addr < NVMEM_END_ADDRESS, NVMEM_ADDRESS_ERROR);
+    window->start = addr;
+    window->len = (
+        NVMEM_END_ADDRESS - addr < NVMEM_WINDOW_SIZE ?
+        NVMEM_END_ADDRESS - addr : NVMEM_WINDOW_SIZE);
+    window->generation = nvmem_generation;
+    nvmem_fetch(window->buffer, addr, window->len);
 #endif
 }
 
 
 void nvmem_commitblock(code_addr_t addr, NVMEM_BLOCK *block) {
-    //  printf("saving block:@%04x next:@%04x size:%04d\n",
-    //	 addr, block->nextblock_addr, block->size);
-    nvmem_set(addr, block, sizeof(NVMEM_BLOCK));
+    uint8_t header[NVMEM_BLOCK_HEADER];
+    code_addr_t value = (
+        block->size | (code_addr_t)block->free << (NVMEM_ADDRESS_BITS - 1));
+    for (uint8_t i=0; i<NVMEM_BLOCK_HEADER; i++) {
+        header[i] = value >> (i * 8);
+    }
+    nvmem_set(addr, header, sizeof(header));
 }
 
 
 void nvmem_refreshblock(NVMEM_BLOCK *block, code_addr_t addr) {
-    nvmem_fetch(block, addr, sizeof(NVMEM_BLOCK));
+    uint8_t header[NVMEM_BLOCK_HEADER];
+    code_addr_t value = 0;
+    nvmem_fetch(header, addr, sizeof(header));
+    for (uint8_t i=0; i<NVMEM_BLOCK_HEADER; i++) {
+        value |= (code_addr_t)header[i] << (i * 8);
+    }
+    block->free = value >> (NVMEM_ADDRESS_BITS - 1);
+    block->size = value;
 }
 
 
 void nvmem_init() {
   char magicbuff[sizeof(MAGIC_WORD)];
+  nvmem_free_hint = NVMEM_FIRST_BLOCK_ADDRESS;
   nvmem_fetch(magicbuff, NVMEM_START_ADDRESS, sizeof(magicbuff));
 
   if (strncmp_P(magicbuff, MAGIC_WORD, sizeof(magicbuff)) != 0) {
@@ -67,52 +122,95 @@ void nvmem_init() {
     strncpy_P(magicbuff, MAGIC_WORD, sizeof(magicbuff));
     nvmem_set(NVMEM_START_ADDRESS, magicbuff, sizeof(magicbuff));
 
+    // an empty module directory and shared block index
+    code_addr_t buckets[NVMEM_MODULE_BUCKETS] = {0};
+    nvmem_set(NVMEM_DIRECTORY_ADDRESS, buckets, sizeof(buckets));
+    code_addr_t shared[NVMEM_SHARED_BUCKETS] = {0};
+    nvmem_set(NVMEM_SHARED_ADDRESS, shared, sizeof(shared));
+
     NVMEM_BLOCK freeblock = {
         .free=1,
-        .size=NVMEM_END_ADDRESS - sizeof(NVMEM_BLOCK) - NVMEM_START_ADDRESS
+        .size=NVMEM_END_ADDRESS - NVMEM_FIRST_BLOCK_ADDRESS
     };
-    nvmem_commitblock(NVMEM_START_ADDRESS + sizeof(MAGIC_WORD), &freeblock);
+    nvmem_commitblock(NVMEM_FIRST_BLOCK_ADDRESS, &freeblock);
   }
 }
 
 
-code_addr_t nvmem_saveblock(void *data, const size_t len) {
-    code_addr_t best_addr;
-    code_addr_t best_size;
-    code_addr_t cur_addr;
-    NVMEM_BLOCK block;
-
+static size_t nvmem_allocsize(size_t len) {
     // NOTE: block length includes block header and normalize supplied len
-    size_t alloc_size = len + ((1<<BLOCK_ALIGNMENT) - 1) + sizeof(NVMEM_BLOCK);
-    alloc_size = alloc_size & ~((1<<BLOCK_ALIGNMENT) - 1);
+    size_t alloc_size = len + ((1<<BLOCK_ALIGNMENT) - 1) + NVMEM_BLOCK_HEADER;
+    return alloc_size & ~((1<<BLOCK_ALIGNMENT) - 1);
+}
+
 
-    cur_addr = NVMEM_START_ADDRESS + sizeof(MAGIC_WORD);
-    best_addr = 0;
-    best_size = (1<<sizeof(size_t))-1;
+static code_addr_t nvmem_findfree(size_t alloc_size, code_addr_t *best_size) {
+    /**
+     * Finds the smallest free block of at least alloc_size.  The scan starts
+     * at the free hint, stops early at an exact fit, and moves the hint up to
+     * the first free block it passes.
+     */
+    code_addr_t best_addr = 0;
+    code_addr_t first_free = 0;
+    code_addr_t cur_addr = nvmem_free_hint;
+    NVMEM_BLOCK block;
+    *best_size = NVMEM_END_ADDRESS;
 
     while (cur_addr < NVMEM_END_ADDRESS) {
         nvmem_refreshblock(&block, cur_addr);
-        if (block.free && block.size >= alloc_size && best_size > block.size) {
-            best_addr = cur_addr;
-            best_size = block.size;
+        lassert(block.size >= NVMEM_BLOCK_HEADER, NVMEM_READ_ERROR);
+        if (block.free) {
+            first_free = first_free ? first_free : cur_addr;
+            if (block.size >= alloc_size && *best_size > block.size) {
+                best_addr = cur_addr;
+                *best_size = block.size;
+                if (block.size == alloc_size) {
+                    break;
+                }
+            }
         }
         cur_addr += block.size;
     }
 
+    nvmem_free_hint = first_free ? first_free : NVMEM_END_ADDRESS;
     lassert(best_addr != 0, NVMEM_OUT_OF_MEMORY);
+    return best_addr;
+}
+
+
+static void nvmem_zeropad(code_addr_t addr, size_t len, size_t alloc_size) {
+    /**
+     * Zeroes a block from the end of its data up to alloc_size, so readers
+     * of text blocks find its end.
+     */
+    char zeros[1<<BLOCK_ALIGNMENT] = {0};
+    code_addr_t pos = addr + NVMEM_BLOCK_HEADER + len;
+    while (pos < addr + alloc_size) {
+        size_t n = addr + alloc_size - pos;
+        n = n < sizeof(zeros) ? n : sizeof(zeros);
+        nvmem_set(pos, zeros, n);
+        pos += n;
+    }
+}
 
-    // write the requested data before any FS changes occur just incase process
-    //  is interrupted during the most time consuming phase
-    nvmem_set(best_addr + sizeof(NVMEM_BLOCK), data, len);
+
+static void nvmem_claimblock(
+        code_addr_t best_addr, code_addr_t best_size, size_t alloc_size) {
+    /**
+     * Marks the free block at best_addr used, splitting off what is left
+     * after alloc_size when that is large enough to be a block.
+     */
+    NVMEM_BLOCK block;
+    code_addr_t cur_addr;
 
     if (best_size - alloc_size > NVMEM_SPLIT_BLOCK_THRESHOLD) {
         // split block, write used block
-        block.size = len;
+        block.size = alloc_size;
         block.free = 0;
         nvmem_commitblock(best_addr, &block);
 
         // compute next block's address
-        cur_addr = best_addr + len;
+        cur_addr = best_addr + alloc_size;
 
         // load next block and see if we can join next 2 blocks together
         if (best_addr + best_size < NVMEM_END_ADDRESS) {
@@ -127,15 +225,111 @@ code_addr_t nvmem_saveblock(void *data, const size_t len) {
             nvmem_commitblock(cur_addr, &block);
         }
     } else {
+        // the unsplit remainder still holds what the block held before
+        nvmem_zeropad(best_addr, alloc_size - NVMEM_BLOCK_HEADER, best_size);
         block.free = 0;
         block.size = best_size;
         nvmem_commitblock(best_addr, &block);
     }
+}
+
+
+code_addr_t nvmem_saveblock(void *data, const size_t len) {
+    code_addr_t best_size;
+    size_t alloc_size = nvmem_allocsize(len);
+    code_addr_t best_addr = nvmem_findfree(alloc_size, &best_size);
 
+    // write the requested data before any FS changes occur just incase process
+    //  is interrupted during the most time consuming phase
+    nvmem_set(best_addr + NVMEM_BLOCK_HEADER, data, len);
+    nvmem_zeropad(best_addr, len, alloc_size);
+
+    nvmem_claimblock(best_addr, best_size, alloc_size);
     return best_addr;
 }
 
 
+void nvmem_blockwriter_begin(NVMEM_BLOCKWRITER *writer, size_t len) {
+    writer->addr = nvmem_findfree(nvmem_allocsize(len), &writer->free_size);
+    writer->len = len;
+    writer->pos = 0;
+}
+
+
+void nvmem_blockwriter_write(
+        NVMEM_BLOCKWRITER *writer, const void *data, size_t len) {
+    lassert(writer->pos + len <= writer->len, NVMEM_WRITE_ERROR);
+    nvmem_set(
+        writer->addr + NVMEM_BLOCK_HEADER + writer->pos, (void*)data, len);
+    writer->pos += len;
+}
+
+
+code_addr_t nvmem_blockwriter_end(NVMEM_BLOCKWRITER *writer) {
+    // as in nvmem_saveblock, the block is only claimed once its data is in
+    lassert(writer->pos == writer->len, NVMEM_WRITE_ERROR);
+    size_t alloc_size = nvmem_allocsize(writer->len);
+    nvmem_zeropad(writer->addr, writer->len, alloc_size);
+    nvmem_claimblock(writer->addr, writer->free_size, alloc_size);
+    return writer->addr;
+}
+
+
+void nvmem_blockreader_init(
+        NVMEM_BLOCKREADER *reader,
+        code_addr_t addr,
+        uint8_t *buffer,
+        uint8_t size) {
+    reader->pos = addr + NVMEM_BLOCK_HEADER;
+    reader->end = addr + nvmem_blocksize(addr);
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->len = 0;
+    reader->i = 0;
+}
+
+
+uint8_t nvmem_blockreader_next(NVMEM_BLOCKREADER *reader, uint8_t **chunk) {
+    uint8_t len = (
+        reader->end - reader->pos < reader->size ?
+        reader->end - reader->pos : reader->size);
+    if (len) {
+        nvmem_fetch(reader->buffer, reader->pos, len);
+        reader->pos += len;
+    }
+    reader->len = len;
+    reader->i = len;
+    *chunk = reader->buffer;
+    return len;
+}
+
+
+int16_t nvmem_blockreader_getb(void *streamobj) {
+    NVMEM_BLOCKREADER *reader = (NVMEM_BLOCKREADER*)streamobj;
+    if (reader->i == reader->len) {
+        uint8_t *chunk;
+        if (nvmem_blockreader_next(reader, &chunk) == 0) {
+            return -1;
+        }
+        reader->i = 0;
+    }
+    return reader->buffer[reader->i++];
+}
+
+
+char nvmem_blockreader_getc(void *streamobj) {
+    NVMEM_BLOCKREADER *reader = (NVMEM_BLOCKREADER*)streamobj;
+    int16_t c = nvmem_blockreader_getb(reader);
+    if (c == 0) {
+        // the zeroed padding which ends a text block
+        reader->pos = reader->end;
+        reader->i = reader->len;
+        return -1;
+    }
+    return c;
+}
+
+
 void nvmem_freeblock(code_addr_t addr) {
     NVMEM_BLOCK tofree;
 
@@ -143,10 +337,13 @@ void nvmem_freeblock(code_addr_t addr) {
     nvmem_refreshblock(&tofree, addr);
     tofree.free = 1;
     nvmem_commitblock(addr, &tofree);
+    if (addr < nvmem_free_hint) {
+        nvmem_free_hint = addr;
+    }
 }
 
 
-size_t nvmem_blocksize(code_addr_t addr) {
+code_addr_t nvmem_blocksize(code_addr_t addr) {
     NVMEM_BLOCK block;
     nvmem_refreshblock(&block, addr);
     return block.size;
@@ -154,12 +351,15 @@ size_t nvmem_blocksize(code_addr_t addr) {
 
 
 void nvmem_loadblock(void *dest, code_addr_t addr) {
-    nvmem_fetch(dest, addr + sizeof(NVMEM_BLOCK), nvmem_blocksize(addr));
+    nvmem_fetch(
+        dest,
+        addr + NVMEM_BLOCK_HEADER,
+        nvmem_blocksize(addr) - NVMEM_BLOCK_HEADER);
 }
 
 
 char nvmem_newitr(code_addr_t *addr, NVMEM_BLOCK *block) {
-    *addr = NVMEM_START_ADDRESS + sizeof(MAGIC_WORD);
+    *addr = NVMEM_FIRST_BLOCK_ADDRESS;
     nvmem_refreshblock(block, *addr);
     return 1;
 }
@@ -176,6 +376,362 @@ char nvmem_itrnext(code_addr_t *addr, NVMEM_BLOCK *block) {
 }
 
 
+static uint32_t nvmem_hashbytes(
+        uint32_t hash, code_addr_t *zeros, const uint8_t *data, size_t len) {
+    /**
+     * Folds data into an fnv_32_buf hash, holding back each run of zeros
+     * until a later byte shows it is not trailing.  A block then hashes the
+     * same whatever zeroed padding or remainder follows its data.
+     * @param[in,out] zeros The zeros held back so far
+     */
+    uint8_t zero = 0;
+    for (size_t i=0; i<len; i++) {
+        if (data[i] == 0) {
+            (*zeros)++;
+            continue;
+        }
+        for (; *zeros; (*zeros)--) {
+            hash = fnv_32_buf(&zero, 1, hash);
+        }
+        hash = fnv_32_buf((void*)&data[i], 1, hash);
+    }
+    return hash;
+}
+
+
+static uint32_t nvmem_datahash(void *data, size_t len) {
+    code_addr_t zeros = 0;
+    return nvmem_hashbytes(FNV1_32_INIT, &zeros, data, len);
+}
+
+
+static uint32_t nvmem_blockhash(code_addr_t addr) {
+    uint8_t buffer[16];
+    uint8_t *chunk;
+    uint8_t len;
+    code_addr_t zeros = 0;
+    uint32_t hash = FNV1_32_INIT;
+    NVMEM_BLOCKREADER reader;
+    nvmem_blockreader_init(&reader, addr, buffer, sizeof(buffer));
+    while ((len = nvmem_blockreader_next(&reader, &chunk))) {
+        hash = nvmem_hashbytes(hash, &zeros, chunk, len);
+    }
+    return hash;
+}
+
+
+static char nvmem_block_holds(code_addr_t addr, void *data, size_t len) {
+    /**
+     * Compares the start of the block at addr with data, a few bytes at a
+     * time.  The block may be larger than len needs, when it was reused
+     * without being split.
+     * @return TRUE if the block's first len bytes are data
+     */
+    uint8_t buffer[16];
+    code_addr_t src = addr + NVMEM_BLOCK_HEADER;
+    for (size_t i=0; i<len; i+=sizeof(buffer)) {
+        uint8_t n = len - i < sizeof(buffer) ? len - i : sizeof(buffer);
+        nvmem_fetch(buffer, src + i, n);
+        if (memcmp(buffer, (uint8_t*)data + i, n) != 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+static inline code_addr_t nvmem_shared_bucket(uint32_t hash) {
+    return (
+        NVMEM_SHARED_ADDRESS +
+        (hash % NVMEM_SHARED_BUCKETS) * sizeof(code_addr_t));
+}
+
+
+static inline void nvmem_fetchentry(
+        NVMEM_SHAREDENTRY *entry, code_addr_t entry_addr) {
+    nvmem_fetch(entry, entry_addr + NVMEM_BLOCK_HEADER, sizeof(*entry));
+}
+
+
+static inline void nvmem_setrefs(code_addr_t entry_addr, uint16_t refs) {
+    nvmem_set(
+        entry_addr + NVMEM_BLOCK_HEADER + offsetof(NVMEM_SHAREDENTRY, refs),
+        &refs,
+        sizeof(refs));
+}
+
+
+static code_addr_t nvmem_findentry(
+        uint32_t hash,
+        code_addr_t addr,
+        NVMEM_SHAREDENTRY *entry,
+        code_addr_t *prev) {
+    /**
+     * Walks hash's bucket for the entry of the shared block at addr.
+     * @param[out] prev Receives the entry before it in the chain, or 0
+     * @return The entry's block address, or 0 if addr is not shared
+     */
+    code_addr_t entry_addr;
+    *prev = 0;
+    nvmem_fetch(&entry_addr, nvmem_shared_bucket(hash), sizeof(entry_addr));
+    while (entry_addr) {
+        nvmem_fetchentry(entry, entry_addr);
+        if (entry->addr == addr) {
+            return entry_addr;
+        }
+        *prev = entry_addr;
+        entry_addr = entry->next;
+    }
+    return 0;
+}
+
+
+code_addr_t nvmem_saveshared(void *data, size_t len) {
+    uint32_t hash = nvmem_datahash(data, len);
+    code_addr_t bucket_addr = nvmem_shared_bucket(hash);
+    NVMEM_SHAREDENTRY entry;
+    code_addr_t entry_addr;
+    nvmem_fetch(&entry_addr, bucket_addr, sizeof(entry_addr));
+    while (entry_addr) {
+        nvmem_fetchentry(&entry, entry_addr);
+        // a saturated count leaves later saves to store a fresh copy
+        if (entry.hash == hash && entry.len == len &&
+                entry.refs != UINT16_MAX &&
+                nvmem_block_holds(entry.addr, data, len)) {
+            nvmem_setrefs(entry_addr, entry.refs + 1);
+            return entry.addr;
+        }
+        entry_addr = entry.next;
+    }
+
+    entry.hash = hash;
+    entry.addr = nvmem_saveblock(data, len);
+    entry.len = len;
+    nvmem_fetch(&entry.next, bucket_addr, sizeof(entry.next));
+    entry.refs = 1;
+    entry_addr = nvmem_saveblock(&entry, sizeof(entry));
+    nvmem_set(bucket_addr, &entry_addr, sizeof(entry_addr));
+    return entry.addr;
+}
+
+
+void nvmem_releaseblock(code_addr_t addr) {
+    NVMEM_SHAREDENTRY entry;
+    code_addr_t prev;
+    uint32_t hash = nvmem_blockhash(addr);
+    code_addr_t entry_addr = nvmem_findentry(hash, addr, &entry, &prev);
+    if (entry_addr) {
+        if (entry.refs > 1) {
+            nvmem_setrefs(entry_addr, entry.refs - 1);
+            return;
+        }
+        if (prev) {
+            nvmem_set(
+                prev + NVMEM_BLOCK_HEADER + offsetof(NVMEM_SHAREDENTRY, next),
+                &entry.next,
+                sizeof(entry.next));
+        } else {
+            nvmem_set(
+                nvmem_shared_bucket(hash), &entry.next, sizeof(entry.next));
+        }
+        nvmem_freeblock(entry_addr);
+    }
+    nvmem_freeblock(addr);
+}
+
+
+uint16_t nvmem_blockrefs(code_addr_t addr) {
+    NVMEM_SHAREDENTRY entry;
+    code_addr_t prev;
+    if (nvmem_findentry(nvmem_blockhash(addr), addr, &entry, &prev)) {
+        return entry.refs;
+    }
+    return 1;
+}
+
+
+static code_addr_t nvmem_bucket_address(const char *name, uint8_t namelen) {
+    return (
+        NVMEM_DIRECTORY_ADDRESS +
+        (hashstr_8((char*)name, namelen) % NVMEM_MODULE_BUCKETS) *
+        sizeof(code_addr_t));
+}
+
+
+static char nvmem_module_named(
+        code_addr_t addr,
+        NVMEM_MODULEBLOCK *module,
+        const char *name,
+        uint8_t namelen) {
+    /**
+     * Loads the fixed fields of the module block at addr and compares its
+     * name, a few characters at a time so no name sized buffer is needed.
+     * @return TRUE if the module is called name
+     */
+    char buffer[16];
+    code_addr_t name_addr = (
+        addr + NVMEM_BLOCK_HEADER + offsetof(NVMEM_MODULEBLOCK, name));
+    nvmem_fetch(
+        module, addr + NVMEM_BLOCK_HEADER, offsetof(NVMEM_MODULEBLOCK, name));
+    if (module->namelen != namelen) {
+        return FALSE;
+    }
+    for (uint8_t i=0; i<namelen; i+=sizeof(buffer)) {
+        uint8_t len = namelen - i < sizeof(buffer) ? namelen - i : sizeof(buffer);
+        nvmem_fetch(buffer, name_addr + i, len);
+        if (memcmp(buffer, &name[i], len) != 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+
+static uint8_t nvmem_namelen(const char *name) {
+    /**
+     * @return The length of a module name, which must fit namelen
+     */
+    size_t namelen = strlen(name);
+    lassert(namelen <= UINT8_MAX, NVMEM_ADDRESS_ERROR);
+    return namelen;
+}
+
+
+code_addr_t nvmem_findmodule(const char *name, NVMEM_MODULEBLOCK *module) {
+    uint8_t namelen = nvmem_namelen(name);
+    code_addr_t addr;
+    nvmem_fetch(&addr, nvmem_bucket_address(name, namelen), sizeof(addr));
+    while (addr) {
+        if (nvmem_module_named(addr, module, name, namelen)) {
+            return addr;
+        }
+        addr = module->nextblock_addr;
+    }
+    return 0;
+}
+
+
+static void nvmem_unlinkmodule(
+        code_addr_t bucket_addr, code_addr_t prev, NVMEM_MODULEBLOCK *module) {
+    /**
+     * Points whatever referred to module, the bucket or the previous module
+     * of its chain, at the module after it.
+     */
+    code_addr_t next = module->nextblock_addr;
+    if (prev) {
+        nvmem_set(
+            prev + NVMEM_BLOCK_HEADER +
+            offsetof(NVMEM_MODULEBLOCK, nextblock_addr),
+            &next,
+            sizeof(next));
+    } else {
+        nvmem_set(bucket_addr, &next, sizeof(next));
+    }
+}
+
+
+static void nvmem_freemodule_blocks(code_addr_t addr, NVMEM_MODULEBLOCK *module) {
+    if (module->symbols) {
+        nvmem_releaseblock(module->symbols);
+    }
+    if (module->ast) {
+        nvmem_releaseblock(module->ast);
+    }
+    nvmem_freeblock(addr);
+}
+
+
+code_addr_t nvmem_savemodule(
+        const char *name,
+        void *symbols, size_t symbols_len,
+        void *ast, size_t ast_len) {
+    uint8_t namelen = nvmem_namelen(name);
+    code_addr_t bucket_addr = nvmem_bucket_address(name, namelen);
+    lassert(ast_len < NVMEM_END_ADDRESS, NVMEM_WRITE_ERROR);
+
+    // a module block with room for its name, which replaces name[1]
+    struct {
+        NVMEM_MODULEBLOCK module;
+        char name[255];
+    } block;
+    block.module.symbols = (
+        symbols_len ? nvmem_saveshared(symbols, symbols_len) : 0);
+    block.module.ast = ast_len ? nvmem_saveshared(ast, ast_len) : 0;
+    nvmem_fetch(
+        &block.module.nextblock_addr, bucket_addr, sizeof(code_addr_t));
+    block.module.size = ast_len;
+    block.module.namelen = namelen;
+    memcpy(block.module.name, name, namelen);
+    code_addr_t addr = nvmem_saveblock(
+        &block, offsetof(NVMEM_MODULEBLOCK, name) + namelen);
+
+    // publishing the new head makes the module visible in one write, an
+    // older module of the same name is then shadowed until removed below
+    nvmem_set(bucket_addr, &addr, sizeof(addr));
+
+    code_addr_t prev = addr;
+    NVMEM_MODULEBLOCK module = block.module;
+    for (code_addr_t old=module.nextblock_addr; old; old=module.nextblock_addr) {
+        if (nvmem_module_named(old, &module, name, namelen)) {
+            nvmem_unlinkmodule(bucket_addr, prev, &module);
+            nvmem_freemodule_blocks(old, &module);
+            break;
+        }
+        prev = old;
+    }
+    return addr;
+}
+
+
+char nvmem_freemodule(const char *name) {
+    uint8_t namelen = nvmem_namelen(name);
+    code_addr_t bucket_addr = nvmem_bucket_address(name, namelen);
+    code_addr_t prev = 0;
+    NVMEM_MODULEBLOCK module;
+    code_addr_t addr;
+    nvmem_fetch(&addr, bucket_addr, sizeof(addr));
+    while (addr) {
+        if (nvmem_module_named(addr, &module, name, namelen)) {
+            nvmem_unlinkmodule(bucket_addr, prev, &module);
+            nvmem_freemodule_blocks(addr, &module);
+            return TRUE;
+        }
+        prev = addr;
+        addr = module.nextblock_addr;
+    }
+    return FALSE;
+}
+
+
+char nvmem_modulenext(NVMEM_MODULEITR *itr, NVMEM_MODULEBLOCK *module) {
+    while (itr->addr == 0) {
+        if (itr->bucket == NVMEM_MODULE_BUCKETS) {
+            return FALSE;
+        }
+        nvmem_fetch(
+            &itr->addr,
+            NVMEM_DIRECTORY_ADDRESS + itr->bucket++ * sizeof(code_addr_t),
+            sizeof(itr->addr));
+    }
+    itr->module_addr = itr->addr;
+    nvmem_fetch(
+        module,
+        itr->addr + NVMEM_BLOCK_HEADER,
+        offsetof(NVMEM_MODULEBLOCK, name));
+    itr->addr = module->nextblock_addr;
+    return TRUE;
+}
+
+
+void nvmem_modulename(code_addr_t addr, char *dest, uint8_t namelen) {
+    nvmem_fetch(
+        dest,
+        addr + NVMEM_BLOCK_HEADER + offsetof(NVMEM_MODULEBLOCK, name),
+        namelen);
+    dest[namelen] = '\0';
+}
+
+
 #ifdef NVMEM_TEST
 #include <string.h>
 #include <stdlib.h>
@@ -262,9 +818,10 @@ static char * test_block_alloc_and_free() {
     code_addr_t block1 = nvmem_saveblock(data, 197);
     code_addr_t block2 = nvmem_saveblock(data, 13);
     code_addr_t block3 = nvmem_saveblock(data, 200);
-    code_addr_t last_block3;
-    code_addr_t last_block2;
-    code_addr_t last_block1;
+    // assigned between setjmp and longjmp
+    volatile code_addr_t last_block3 = 0;
+    volatile code_addr_t last_block2 = 0;
+    volatile code_addr_t last_block1 = 0;
     nvmem_saveblock(data, 99);
     nvmem_saveblock(data, 13);
     nvmem_saveblock(data, 17);
@@ -275,7 +832,6 @@ static char * test_block_alloc_and_free() {
 
     if (!setjmp(__jmpbuff)) {
         // use up all available memory which causes a longjmp style exception
-        code_addr_t last_block1, last_block2, last_block3;
         while (1) {
             nvmem_freeblock(block2);
             last_block1 = block1;
@@ -300,7 +856,240 @@ static char * test_block_alloc_and_free() {
 }
 
 
+static char * test_modules() {
+    nvmem_initmem();
+    nvmem_init();
+    char name[16];
+    char ast[64];
+    NVMEM_MODULEBLOCK module;
+
+    // more modules than buckets, so chains form
+    for (int i=0; i<40; i++) {
+        sprintf(name, "module%d", i);
+        sprintf(ast, "(ast of %s)", name);
+        nvmem_savemodule(name, "syms", 4, ast, strlen(ast) + 1);
+    }
+    // replacing keeps one module of the name
+    nvmem_savemodule("module7", "new", 3, "(new ast)", 10);
+    mu_assert("module not freed", nvmem_freemodule("module12"));
+    mu_assert("missing module freed", !nvmem_freemodule("module12"));
+
+    for (int i=0; i<40; i++) {
+        sprintf(name, "module%d", i);
+        code_addr_t addr = nvmem_findmodule(name, &module);
+        if (i == 12) {
+            mu_assert("freed module found", addr == 0);
+            continue;
+        }
+        mu_assert("module not found", addr != 0);
+        nvmem_loadblock(ast, module.ast);
+        if (i == 7) {
+            mu_assert("module not replaced", strcmp(ast, "(new ast)") == 0);
+            continue;
+        }
+        char expected[32];
+        sprintf(expected, "(ast of module%d)", i);
+        mu_assert("wrong ast", strcmp(ast, expected) == 0);
+        mu_assert("wrong size", module.size == strlen(expected) + 1);
+        nvmem_loadblock(name, module.symbols);
+        mu_assert("wrong symbols", memcmp(name, "syms", 4) == 0);
+    }
+    mu_assert("unknown module found", nvmem_findmodule("module", &module) == 0);
+
+    NVMEM_MODULEITR itr = {0};
+    int count = 0;
+    while (nvmem_modulenext(&itr, &module)) {
+        nvmem_modulename(itr.module_addr, name, module.namelen);
+        mu_assert("listed module not found",
+            nvmem_findmodule(name, &module) == itr.module_addr);
+        count++;
+    }
+    mu_assert("wrong number of modules listed", count == 39);
+
+    // a name longer than namelen holds is rejected rather than truncated
+    static char long_name[300];
+    memset(long_name, 'm', sizeof(long_name) - 1);
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        nvmem_savemodule(long_name, "syms", 4, "(long)", 7);
+        mu_assert("long name accepted", 0);
+    }
+    mu_assert("wrong error", exctype == NVMEM_ADDRESS_ERROR);
+    return 0;
+}
+
+
+static char * test_window() {
+    nvmem_initmem();
+    nvmem_init();
+    uint8_t code[300];
+    for (int i=0; i<sizeof(code); i++) {
+        code[i] = i * 7;
+    }
+    code_addr_t addr = nvmem_saveblock(code, sizeof(code)) + NVMEM_BLOCK_HEADER;
+
+    NVMEM_WINDOW window;
+    nvmem_window_init(&window);
+    code_addr_t pc = addr;
+    for (int i=0; i<sizeof(code); i++) {
+        mu_assert("sequential fetch wrong",
+            nvmem_window_next(&window, &pc) == code[i]);
+    }
+    mu_assert("pc not advanced", pc == addr + sizeof(code));
+
+    // jumps backwards and forwards refill the window as needed
+    for (int i=0; i<sizeof(code); i+=37) {
+        int target = (i * 113) % sizeof(code);
+        mu_assert("random fetch wrong",
+            nvmem_window_byte(&window, addr + target) == code[target]);
+    }
+    mu_assert("word fetch wrong",
+        nvmem_window_word(&window, addr + 10) == (code[10] | code[11] << 8));
+
+    // writes are seen through a window already holding the old bytes
+    nvmem_window_byte(&window, addr + 5);
+    uint8_t patched = 0xa5;
+    nvmem_set(addr + 5, &patched, 1);
+    mu_assert("stale window", nvmem_window_byte(&window, addr + 5) == 0xa5);
+    return 0;
+}
+
+
+static char * test_chunked() {
+    nvmem_initmem();
+    nvmem_init();
+    char data[1001];
+    for (int i=0; i<sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    // written in uneven pieces, read back in small chunks
+    NVMEM_BLOCKWRITER writer;
+    nvmem_blockwriter_begin(&writer, sizeof(data));
+    for (int i=0; i<sizeof(data); i+=37) {
+        int len = sizeof(data) - i < 37 ? sizeof(data) - i : 37;
+        nvmem_blockwriter_write(&writer, &data[i], len);
+    }
+    code_addr_t addr = nvmem_blockwriter_end(&writer);
+    mu_assert("block in use was reused", nvmem_saveblock("x", 1) != addr);
+
+    uint8_t buffer[16];
+    uint8_t *chunk;
+    uint8_t len;
+    int pos = 0;
+    NVMEM_BLOCKREADER reader;
+    nvmem_blockreader_init(&reader, addr, buffer, sizeof(buffer));
+    while ((len = nvmem_blockreader_next(&reader, &chunk))) {
+        mu_assert("chunk too large", len <= sizeof(buffer));
+        for (uint8_t i=0; i<len && pos<sizeof(data); i++) {
+            mu_assert("wrong chunk data", chunk[i] == data[pos++]);
+        }
+    }
+    mu_assert("block not read to its end", pos == sizeof(data));
+
+    // text reads character by character up to its end
+    nvmem_blockreader_init(&reader, addr, buffer, sizeof(buffer));
+    for (pos=0; pos<sizeof(data); pos++) {
+        mu_assert("wrong character",
+            nvmem_blockreader_getc(&reader) == data[pos]);
+    }
+    mu_assert("padding read as text", nvmem_blockreader_getc(&reader) == -1);
+    mu_assert("end not repeated", nvmem_blockreader_getc(&reader) == -1);
+
+    // aligned text in a reused block too large to split ends at its data
+    code_addr_t stale = nvmem_saveblock("ZZZZZZZZZZ", 10);
+    nvmem_saveblock("x", 1);
+    nvmem_freeblock(stale);
+    addr = nvmem_saveblock("(a b)\n", 6);
+    mu_assert("free block not reused", addr == stale);
+    mu_assert("free block split", nvmem_blocksize(addr) > 8);
+    nvmem_blockreader_init(&reader, addr, buffer, sizeof(buffer));
+    for (pos=0; pos<6; pos++) {
+        mu_assert("wrong reused character",
+            nvmem_blockreader_getc(&reader) == "(a b)\n"[pos]);
+    }
+    mu_assert("stale bytes read as text",
+        nvmem_blockreader_getc(&reader) == -1);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        nvmem_blockwriter_begin(&writer, 4);
+        nvmem_blockwriter_write(&writer, data, 5);
+        mu_assert("overlong write accepted", 0);
+    } else {
+        mu_assert("wrong error", exctype == NVMEM_WRITE_ERROR);
+    }
+    return 0;
+}
+
+
+static char * test_shared() {
+    nvmem_initmem();
+    nvmem_init();
+    char table[100];
+    for (int i=0; i<sizeof(table); i++) {
+        table[i] = i * 3;
+    }
+
+    code_addr_t first = nvmem_saveshared(table, sizeof(table));
+    code_addr_t other = nvmem_saveshared(table, sizeof(table) - 1);
+    mu_assert("shorter data shared", other != first);
+    mu_assert("same data stored twice",
+        nvmem_saveshared(table, sizeof(table)) == first);
+    mu_assert("wrong reference count", nvmem_blockrefs(first) == 2);
+    mu_assert("unshared block counted",
+        nvmem_blockrefs(nvmem_saveblock(table, sizeof(table))) == 1);
+
+    // the block survives until its last reference is released
+    nvmem_releaseblock(first);
+    mu_assert("released too soon", nvmem_blockrefs(first) == 1);
+    mu_assert("released block reused",
+        nvmem_saveblock(table, sizeof(table)) != first);
+    nvmem_releaseblock(first);
+    nvmem_releaseblock(other);
+    code_addr_t again = nvmem_saveshared(table, sizeof(table));
+    mu_assert("released block still counted", nvmem_blockrefs(again) == 1);
+
+    // modules with the same symbol table store it once
+    NVMEM_MODULEBLOCK a, b;
+    nvmem_savemodule("a", "syms", 4, "(a)", 4);
+    nvmem_savemodule("b", "syms", 4, "(b)", 4);
+    nvmem_findmodule("a", &a);
+    nvmem_findmodule("b", &b);
+    mu_assert("symbol table not shared", a.symbols == b.symbols);
+    mu_assert("ast shared", a.ast != b.ast);
+    nvmem_freemodule("a");
+    mu_assert("shared table freed", nvmem_blockrefs(b.symbols) == 1);
+    char syms[4];
+    nvmem_fetch(syms, b.symbols + NVMEM_BLOCK_HEADER, sizeof(syms));
+    mu_assert("shared table damaged", memcmp(syms, "syms", 4) == 0);
+
+    // a reused block left unsplit is still found, and released cleanly
+    nvmem_initmem();
+    nvmem_init();
+    code_addr_t stale = nvmem_saveblock(table, 14);
+    nvmem_saveblock("x", 1);
+    nvmem_freeblock(stale);
+    first = nvmem_saveshared(table + 1, 10);
+    mu_assert("free block not reused", first == stale);
+    mu_assert("free block split",
+        nvmem_blocksize(first) > NVMEM_BLOCK_HEADER + 10 + 1);
+    mu_assert("reused block not shared",
+        nvmem_saveshared(table + 1, 10) == first);
+    mu_assert("wrong reused reference count", nvmem_blockrefs(first) == 2);
+    nvmem_releaseblock(first);
+    nvmem_releaseblock(first);
+    again = nvmem_saveshared(table + 1, 10);
+    mu_assert("released entry left behind", nvmem_blockrefs(again) == 1);
+    return 0;
+}
+
+
 static char *all_tests() {
+    mu_run_test(test_shared);
+    mu_run_test(test_chunked);
+    mu_run_test(test_window);
+    mu_run_test(test_modules);
     mu_run_test(test_block_alloc_and_contents);
     mu_run_test(test_block_alloc);
     mu_run_test(test_block_alloc_and_free);
@@ -3,34 +3,117 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include "runtime.h"
 #include "defines.h"
+#include "nvdevice.h"
 
 #define POSIX
+
+/*
+ * The width of code addresses and block headers.  16 bits keeps headers to
+ * two bytes on tiny targets with stores up to 32 KB, 24 or 32 bits allow
+ * larger stores on external flash or the host image builder, which set
+ * NVMEM_END_ADDRESS to match.  A block header is NVMEM_ADDRESS_BYTES little
+ * endian bytes holding the block's size, with the free flag in the top bit,
+ * so a block is smaller than 1 << (NVMEM_ADDRESS_BITS - 1) bytes.
+ */
+#ifndef NVMEM_ADDRESS_BITS
+#define NVMEM_ADDRESS_BITS 16
+#endif
+#define NVMEM_ADDRESS_BYTES ((NVMEM_ADDRESS_BITS + 7) / 8)
+
+#if NVMEM_ADDRESS_BITS == 16
+typedef uint16_t code_addr_t;
+#elif NVMEM_ADDRESS_BITS == 24 || NVMEM_ADDRESS_BITS == 32
+typedef uint32_t code_addr_t;
+#else
+#error "NVMEM_ADDRESS_BITS must be 16, 24 or 32"
+#endif
+
 #define NVMEM_START_ADDRESS 8000
+#ifndef NVMEM_END_ADDRESS
 #define NVMEM_END_ADDRESS (1<<15)
-#define MAGIC_WORD PSTR("slimlisp")
+#endif
+#if NVMEM_END_ADDRESS > (1 << (NVMEM_ADDRESS_BITS - 1))
+#error "NVMEM_END_ADDRESS is too large for NVMEM_ADDRESS_BITS"
+#endif
+
+// changed whenever the layout below changes, so old stores are reinitialized
+#define NVMEM_STRINGIFY(X) #X
+#define NVMEM_XSTRINGIFY(X) NVMEM_STRINGIFY(X)
+#define NVMEM_LAYOUT_VERSION 3
+#define MAGIC_WORD PSTR("slim" NVMEM_XSTRINGIFY(NVMEM_LAYOUT_VERSION) "/" \
+  NVMEM_XSTRINGIFY(NVMEM_ADDRESS_BITS))
 #define EEPROM_SIZE (1<<15)
-#define NVMEM_SPLIT_BLOCK_THRESHOLD (sizeof(NVMEM_BLOCK)<<1)
+#define NVMEM_BLOCK_HEADER NVMEM_ADDRESS_BYTES
+#define NVMEM_SPLIT_BLOCK_THRESHOLD (NVMEM_BLOCK_HEADER<<1)
 #define BLOCK_ALIGNMENT 2
+// the erase unit of flash, see nvmem_erase
+#define NVMEM_PAGE_SIZE 256
 
+// the module directory follows the magic word, then the index of shared
+// blocks, then the first block
+#define NVMEM_MODULE_BUCKETS 16
+#define NVMEM_SHARED_BUCKETS 16
+#define NVMEM_DIRECTORY_ADDRESS (NVMEM_START_ADDRESS + sizeof(MAGIC_WORD))
+#define NVMEM_SHARED_ADDRESS \
+  (NVMEM_DIRECTORY_ADDRESS + NVMEM_MODULE_BUCKETS * sizeof(code_addr_t))
+#define NVMEM_FIRST_BLOCK_ADDRESS \
+  (NVMEM_SHARED_ADDRESS + NVMEM_SHARED_BUCKETS * sizeof(code_addr_t))
 
-typedef size_t code_addr_t;
+
+// a block header as loaded into RAM, see NVMEM_BLOCK_HEADER for its storage
 typedef struct {
   // size includes header
-  size_t free:1;
-  size_t size:15;
+  code_addr_t free:1;
+  code_addr_t size:NVMEM_ADDRESS_BITS - 1;
 } NVMEM_BLOCK;
 
+/*
+ * A module is a block holding an NVMEM_MODULEBLOCK, which names the blocks of
+ * its symbol table and its AST or bytecode.  The directory is a table of
+ * NVMEM_MODULE_BUCKETS addresses, each the first module of a chain linked by
+ * nextblock_addr, and a name's bucket is picked by hashstr_8.
+ */
 typedef struct {
-  uint8_t symbols;
-  uint8_t ast;
-  uint16_t nextblock_addr;
-  uint16_t size;
+  // block addresses of the symbol table and of the AST or bytecode, or 0
+  code_addr_t symbols;
+  code_addr_t ast;
+  // the next module in the same bucket, or 0
+  code_addr_t nextblock_addr;
+  // the length of the AST or bytecode
+  code_addr_t size;
   uint8_t namelen;
+  // namelen characters, not terminated
   char name[1];
 } NVMEM_MODULEBLOCK;
 
+/*
+ * Blocks saved with nvmem_saveshared are content addressed: an index maps the
+ * fnv_32_buf hash of each one's contents, less any trailing zeros, to an
+ * entry block, chained from one of NVMEM_SHARED_BUCKETS addresses like the
+ * module directory.  A save of the same bytes counts another reference
+ * instead of writing them.
+ */
+typedef struct {
+  uint32_t hash;
+  // the shared block, and the length it was saved with
+  code_addr_t addr;
+  code_addr_t len;
+  // the next entry in the same bucket, or 0
+  code_addr_t next;
+  uint16_t refs;
+} NVMEM_SHAREDENTRY;
+
+typedef struct {
+  uint8_t bucket;
+  // the module to visit next in the current bucket's chain, or 0
+  code_addr_t addr;
+  // the block address of the module last returned
+  code_addr_t module_addr;
+} NVMEM_MODULEITR;
+
 
 /**
  * Stores data in nvmem
@@ -40,6 +123,82 @@ typedef struct {
  */
 code_addr_t nvmem_saveblock(void *data, size_t len);
 
+/*
+ * Blocks larger than free RAM are written and read in pieces.  A writer
+ * claims its block only when it ends, and no other block may be saved while
+ * it is open.
+ */
+typedef struct {
+  code_addr_t addr;
+  code_addr_t free_size;
+  size_t len;
+  size_t pos;
+} NVMEM_BLOCKWRITER;
+
+typedef struct {
+  code_addr_t pos;
+  code_addr_t end;
+  uint8_t *buffer;
+  uint8_t size;
+  // characters in buffer, and the next one nvmem_blockreader_getc returns
+  uint8_t len;
+  uint8_t i;
+} NVMEM_BLOCKREADER;
+
+/**
+ * Starts writing a block of len bytes.
+ * @param[out] writer The writer to start
+ * @param[in] len The total length of the data to be written
+ */
+void nvmem_blockwriter_begin(NVMEM_BLOCKWRITER *writer, size_t len);
+
+/**
+ * Appends the next len bytes of the block's data.
+ */
+void nvmem_blockwriter_write(
+    NVMEM_BLOCKWRITER *writer, const void *data, size_t len);
+
+/**
+ * Ends writing once all of the block's data was written.
+ * @return The code address of the stored block
+ */
+code_addr_t nvmem_blockwriter_end(NVMEM_BLOCKWRITER *writer);
+
+/**
+ * Starts reading the block at addr through a staging buffer.
+ * @param[out] reader The reader to start
+ * @param[in] addr The address of the block
+ * @param[in] buffer The staging buffer
+ * @param[in] size The size of buffer
+ */
+void nvmem_blockreader_init(
+    NVMEM_BLOCKREADER *reader,
+    code_addr_t addr,
+    uint8_t *buffer,
+    uint8_t size);
+
+/**
+ * Reads the next chunk of the block into the staging buffer.  The final
+ * chunk includes the block's zeroed padding, and the zeroed remainder of a
+ * free block too small to split.
+ * @param[out] chunk Receives the staging buffer
+ * @return The length of the chunk, 0 at the end of the block
+ */
+uint8_t nvmem_blockreader_next(NVMEM_BLOCKREADER *reader, uint8_t **chunk);
+
+/**
+ * Reads the block a byte at a time, for binary blocks.
+ * @return The next byte, or -1 at the end of the block
+ */
+int16_t nvmem_blockreader_getb(void *reader);
+
+/**
+ * A getc for reader_set_getc over a block of text, with the reader as its
+ * streamobj.  The zeroed padding ends the text.
+ * @return The next character, or -1 at the end of the text
+ */
+char nvmem_blockreader_getc(void *reader);
+
 /**
  * Frees data in nvmem
  * @param[in] addr The address of the block to free.  This is the address
@@ -47,6 +206,27 @@ code_addr_t nvmem_saveblock(void *data, size_t len);
  */
 void nvmem_freeblock(code_addr_t addr);
 
+/**
+ * Stores data in nvmem, or counts another reference to a block already
+ * holding the same bytes.
+ * @param[in] data A ptr to the data to store
+ * @param[in] len The length of data in ptr to store
+ * @return The code address of the block, to be freed with nvmem_releaseblock
+ */
+code_addr_t nvmem_saveshared(void *data, size_t len);
+
+/**
+ * Drops a reference to a block, freeing it with the last one.  A block saved
+ * by nvmem_saveblock has a single reference.
+ * @param[in] addr The address of the block
+ */
+void nvmem_releaseblock(code_addr_t addr);
+
+/**
+ * @return The number of references to the block at addr
+ */
+uint16_t nvmem_blockrefs(code_addr_t addr);
+
 /**
  * An internal method for loading data from a block to dest.
  * The destination must have sufficient space as returned by nvmem_blocksize.
@@ -69,11 +249,77 @@ char nvmem_newitr(code_addr_t *addr, NVMEM_BLOCK *block);
  */
 char nvmem_itrnext(code_addr_t *addr, NVMEM_BLOCK *block);
 
+/**
+ * Saves a module under name, replacing any module already called name.
+ * The module becomes visible with a single write to its directory bucket.
+ * Its symbol table and AST are saved with nvmem_saveshared, so modules with
+ * identical ones store them once.
+ * @param[in] name The module's name, at most 255 characters, longer names
+ *     raise NVMEM_ADDRESS_ERROR as they do in the functions below
+ * @param[in] symbols The module's symbol table
+ * @param[in] symbols_len The length of symbols, or 0 for none
+ * @param[in] ast The module's AST or bytecode
+ * @param[in] ast_len The length of ast, or 0 for none
+ * @return The code address of the module block
+ */
+code_addr_t nvmem_savemodule(
+    const char *name,
+    void *symbols, size_t symbols_len,
+    void *ast, size_t ast_len);
+
+/**
+ * Looks name up in the module directory, reading only its bucket's chain.
+ * @param[in] name The module's name
+ * @param[out] module Receives the module's fields, except its name
+ * @return The code address of the module block, or 0 if there is none
+ */
+code_addr_t nvmem_findmodule(const char *name, NVMEM_MODULEBLOCK *module);
+
+/**
+ * Removes a module and releases its blocks.
+ * @param[in] name The module's name
+ * @return FALSE if there was no such module
+ */
+char nvmem_freemodule(const char *name);
+
+/**
+ * Visits every module in the directory.  Start with a zeroed iterator.
+ * @param[in,out] itr The iterator, itr->module_addr receives the module's
+ *     code address
+ * @param[out] module Receives the module's fields, except its name
+ * @return FALSE once all modules were visited
+ */
+char nvmem_modulenext(NVMEM_MODULEITR *itr, NVMEM_MODULEBLOCK *module);
+
+/**
+ * Copies a module's name into dest and terminates it.
+ * @param[in] addr The code address of the module block
+ * @param[out] dest Room for namelen + 1 characters
+ * @param[in] namelen The module's namelen
+ */
+void nvmem_modulename(code_addr_t addr, char *dest, uint8_t namelen);
+
+#ifdef POSIX
+/*
+ * The device holding the store, by default code.mem.  A simulated device
+ * measures what the allocators' accesses would cost on hardware.
+ */
+extern NVDEVICE *nvmem_device;
+
+/**
+ * Moves the store onto another device, which is not copied or initialized.
+ * @param[in] device The device, at least NVMEM_END_ADDRESS bytes
+ * @return The device used until now
+ */
+NVDEVICE *nvmem_use_device(NVDEVICE *device);
+#endif
+
 /**
  * An internal method for loading data from code address src into dest
  * @param[out] dest Pointer to destination of loaded data
  * @param[in] src Code address of source data
  * @param[in] len Number of bytes to load
+ */
 void nvmem_fetch(void *dest, code_addr_t src, const size_t len);
 
 /**
@@ -84,6 +330,77 @@ void nvmem_fetch(void *dest, code_addr_t src, const size_t len);
  */
 void nvmem_set(code_addr_t dest, void *src, const size_t len);
 
+/**
+ * Erases whole pages, setting every byte to 0xff.
+ * @param[in] dest Code address of the first page
+ * @param[in] len Length to erase, a multiple of NVMEM_PAGE_SIZE
+ */
+void nvmem_erase(code_addr_t dest, const size_t len);
+
+
+/*
+ * A prefetch window lets code be executed in place: bytes are fetched from
+ * nvmem a window at a time instead of copying a whole block into RAM.  On
+ * the AVR program memory is directly addressable, so bytes are read with
+ * pgm_read_byte and the window holds nothing.
+ */
+#define NVMEM_WINDOW_SIZE 32
+
+typedef struct {
+#ifndef ARDUINO
+  code_addr_t start;
+  uint8_t len;
+  // nvmem_generation when filled
+  uint16_t generation;
+  uint8_t buffer[NVMEM_WINDOW_SIZE];
+#endif
+} NVMEM_WINDOW;
+
+extern uint16_t nvmem_generation;
+
+/**
+ * An internal method which refills window starting at addr.
+ */
+void nvmem_window_fill(NVMEM_WINDOW *window, code_addr_t addr);
+
+static inline void nvmem_window_init(NVMEM_WINDOW *window) {
+#ifndef ARDUINO
+  window->start = 0;
+  window->len = 0;
+#endif
+}
+
+/**
+ * Fetches the byte at addr, refilling the window only when addr is outside
+ * it or nvmem was written since it was filled.
+ */
+static inline uint8_t nvmem_window_byte(NVMEM_WINDOW *window, code_addr_t addr) {
+#ifdef ARDUINO
+  return pgm_read_byte(addr);
+#else
+  // the cast keeps addresses below start out, as 16 bit operands promote
+  if ((code_addr_t)(addr - window->start) >= window->len ||
+      window->generation != nvmem_generation) {
+    nvmem_window_fill(window, addr);
+  }
+  return window->buffer[addr - window->start];
+#endif
+}
+
+/**
+ * Fetches the little endian 16 bit word at addr.
+ */
+static inline uint16_t nvmem_window_word(NVMEM_WINDOW *window, code_addr_t addr) {
+  uint8_t low = nvmem_window_byte(window, addr);
+  return low | (uint16_t)nvmem_window_byte(window, addr + 1) << 8;
+}
+
+/**
+ * Fetches the byte at *pc and advances it, for instruction fetch.
+ */
+static inline uint8_t nvmem_window_next(NVMEM_WINDOW *window, code_addr_t *pc) {
+  return nvmem_window_byte(window, (*pc)++);
+}
 
 /**
  * Accepts a addr and returns the block size.
@@ -92,6 +409,11 @@ void nvmem_set(code_addr_t dest, void *src, const size_t len);
  */
 code_addr_t nvmem_blocksize(code_addr_t addr);
 
+/**
+ * Erases the whole of nvmem_device on POSIX hosts.
+ */
+void nvmem_initmem();
+
 /**
  * A public method which loads the inmemory fs metadata or creates the fs in
  *  nvmem if it is not currently there.
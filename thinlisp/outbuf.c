@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "defines.h"
+#include "outbuf.h"
+
+OUTBUF *outbuf_init(
+    OUTBUF *ob,
+    char *buffer,
+    uint16_t size,
+    uint16_t (*write)(void *streamobj, const char *ptr, uint16_t len),
+    void *streamobj) {
+  ob->buffer = buffer;
+  ob->size = size;
+  ob->len = 0;
+  ob->flushed = 0;
+  ob->write = write;
+  ob->streamobj = streamobj;
+  return ob;
+}
+
+char outbuf_flush(OUTBUF *ob) {
+  while (ob->flushed < ob->len) {
+    uint16_t count = ob->write(
+      ob->streamobj, &ob->buffer[ob->flushed], ob->len - ob->flushed);
+    if (count == 0) {
+      return FALSE;
+    }
+    ob->flushed += count;
+  }
+  ob->len = 0;
+  ob->flushed = 0;
+  return TRUE;
+}
+
+char outbuf_putc(void *ob_void, char c) {
+  OUTBUF *ob = (OUTBUF*)ob_void;
+  if (ob->len == ob->size && !outbuf_flush(ob)) {
+    return FALSE;
+  }
+  ob->buffer[ob->len++] = c;
+  if (c == '\n' || ob->len == ob->size) {
+    // c is accepted either way, a failed flush is retried later
+    outbuf_flush(ob);
+  }
+  return TRUE;
+}
+
+uint16_t outbuf_write(void *ob_void, const char *ptr, uint16_t len) {
+  OUTBUF *ob = (OUTBUF*)ob_void;
+  uint16_t accepted = 0;
+
+  while (accepted < len) {
+    if (ob->len == 0 && len - accepted >= ob->size) {
+      // nothing buffered and too much to buffer, skip the copy
+      uint16_t count = ob->write(ob->streamobj, ptr, len - accepted);
+      if (count == 0) {
+        break;
+      }
+      accepted += count;
+      ptr += count;
+      continue;
+    }
+
+    if (ob->len == ob->size) {
+      if (!outbuf_flush(ob)) {
+        break;
+      }
+      continue;
+    }
+    uint16_t count = ob->size - ob->len;
+    if (count > len - accepted) {
+      count = len - accepted;
+    }
+    memcpy(&ob->buffer[ob->len], ptr, count);
+    ob->len += count;
+    accepted += count;
+    ptr += count;
+  }
+
+  if (accepted && (ob->len == ob->size ||
+      memchr(ptr - accepted, '\n', accepted) != NULL)) {
+    outbuf_flush(ob);
+  }
+  return accepted;
+}
+
+
+#ifdef OUTBUF_TEST
+#include <stdio.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+typedef struct {
+  char data[1024];
+  uint16_t len;
+  uint16_t calls;
+  // the most the sink accepts per call, 0 means it is busy
+  uint16_t limit;
+} SINK;
+
+static uint16_t sink_write(void *streamobj, const char *ptr, uint16_t len) {
+  SINK *sink = (SINK*)streamobj;
+  sink->calls++;
+  if (len > sink->limit) {
+    len = sink->limit;
+  }
+  memcpy(&sink->data[sink->len], ptr, len);
+  sink->len += len;
+  return len;
+}
+
+static char *test_batches_until_newline() {
+  char buffer[16];
+  SINK sink = { .len=0, .calls=0, .limit=1024 };
+  OUTBUF ob;
+  outbuf_init(&ob, buffer, sizeof(buffer), sink_write, &sink);
+
+  for (const char *c="(a b c)"; *c; c++) {
+    mu_assert("putc refused", outbuf_putc(&ob, *c));
+  }
+  mu_assert("flushed before newline", sink.calls == 0);
+  outbuf_putc(&ob, '\n');
+  mu_assert("newline did not flush", sink.calls == 1 && sink.len == 8);
+
+  for (int i=0; i<40; i++) {
+    outbuf_putc(&ob, 'x');
+  }
+  mu_assert("full buffer not flushed in one call", sink.calls == 3);
+  mu_assert("explicit flush failed", outbuf_flush(&ob));
+  mu_assert("data lost", sink.len == 48 && memcmp(sink.data, "(a b c)\n", 8) == 0);
+  return 0;
+}
+
+static char *test_busy_sink() {
+  char buffer[8];
+  SINK sink = { .len=0, .calls=0, .limit=0 };
+  OUTBUF ob;
+  outbuf_init(&ob, buffer, sizeof(buffer), sink_write, &sink);
+
+  int accepted = 0;
+  while (outbuf_putc(&ob, 'a' + accepted)) {
+    accepted++;
+  }
+  mu_assert("busy sink should fill buffer", accepted == 8);
+  mu_assert("flush succeeded on busy sink", !outbuf_flush(&ob));
+
+  // the sink drains a few characters at a time
+  sink.limit = 3;
+  mu_assert("flush did not complete", outbuf_flush(&ob));
+  mu_assert("wrong data", sink.len == 8 && memcmp(sink.data, "abcdefgh", 8) == 0);
+  return 0;
+}
+
+static char *test_write_fast_path() {
+  char buffer[8];
+  char big[100];
+  SINK sink = { .len=0, .calls=0, .limit=1024 };
+  OUTBUF ob;
+  outbuf_init(&ob, buffer, sizeof(buffer), sink_write, &sink);
+
+  memset(big, 'z', sizeof(big));
+  mu_assert("short write", outbuf_write(&ob, "ab", 2) == 2);
+  mu_assert("write not buffered", sink.calls == 0);
+  mu_assert("short write", outbuf_write(&ob, big, sizeof(big)) == sizeof(big));
+  outbuf_flush(&ob);
+  mu_assert("wrong data", sink.len == 102 && sink.data[0] == 'a' && sink.data[101] == 'z');
+  mu_assert("large write was copied through buffer", sink.calls == 2);
+  return 0;
+}
+
+static char *all_tests() {
+  mu_run_test(test_batches_until_newline);
+  mu_run_test(test_busy_sink);
+  mu_run_test(test_write_fast_path);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdint.h>
+#include "defines.h"
+
+/*
+ * Batches output characters in front of a write function, flushing on
+ * newline, when the buffer fills or on outbuf_flush.  The write function may
+ * accept fewer characters than offered (a busy serial link), in which case
+ * the remainder stays buffered for the next flush.
+ */
+typedef struct outbuf {
+    char *buffer;
+    uint16_t size;
+    // characters in buffer, of which the first flushed are already written
+    uint16_t len;
+    uint16_t flushed;
+
+    void *streamobj;
+    uint16_t (*write)(void *streamobj, const char *ptr, uint16_t len);
+} OUTBUF;
+
+/**
+ * Initializes an output buffer.
+ * @param[out] ob The buffer to initialize
+ * @param[in] buffer Storage for buffered characters
+ * @param[in] size The size of buffer
+ * @param[in] write Called with buffered characters, returns how many it took
+ * @param[in] streamobj Passed to write
+ * @return ob
+ */
+OUTBUF *outbuf_init(
+    OUTBUF *ob,
+    char *buffer,
+    uint16_t size,
+    uint16_t (*write)(void *streamobj, const char *ptr, uint16_t len),
+    void *streamobj);
+
+/**
+ * Writes out as much of the buffer as the write function accepts.
+ * @return TRUE if the buffer is now empty
+ */
+char outbuf_flush(OUTBUF *ob);
+
+/**
+ * A putc for reader_set_putc with the OUTBUF as its streamobj.
+ * @return FALSE if the buffer is full and could not be flushed
+ */
+char outbuf_putc(void *ob, char c);
+
+/**
+ * A write for reader_set_write with the OUTBUF as its streamobj.  Writes at
+ * least a buffer's worth pass straight to the write function once the buffer
+ * is empty.
+ * @return The number of characters accepted
+ */
+uint16_t outbuf_write(void *ob, const char *ptr, uint16_t len);
+
+#endif
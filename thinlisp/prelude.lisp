@@ -0,0 +1,44 @@
+;; The standard library, built into the firmware's ROM image by romgen.
+
+(label null (lambda (x) (eq x nil)))
+
+(label list (lambda args args))
+
+(label caar (lambda (x) (car (car x))))
+(label cadr (lambda (x) (car (cdr x))))
+(label cdar (lambda (x) (cdr (car x))))
+(label cddr (lambda (x) (cdr (cdr x))))
+
+(label append (lambda (a b)
+  (cond ((null a) b)
+        (t (cons (car a) (append (cdr a) b))))))
+
+(label reverse (lambda (l)
+  (label rev (lambda (l acc)
+    (cond ((null l) acc)
+          (t (rev (cdr l) (cons (car l) acc))))))
+  (rev l nil)))
+
+(label length (lambda (l)
+  (cond ((null l) 0)
+        (t (+ 1 (length (cdr l)))))))
+
+(label mapcar (lambda (f l)
+  (cond ((null l) nil)
+        (t (cons (apply f (list (car l))) (mapcar f (cdr l)))))))
+
+(label nth (lambda (n l)
+  (cond ((eq n 0) (car l))
+        (t (nth (- n 1) (cdr l))))))
+
+(label member (lambda (x l)
+  (cond ((null l) nil)
+        ((eq x (car l)) l)
+        (t (member x (cdr l))))))
+
+(label > (lambda (a b) (< b a)))
+(label <= (lambda (a b) (not (< b a))))
+(label >= (lambda (a b) (not (< a b))))
+(label zerop (lambda (n) (eq n 0)))
+(label 1+ (lambda (n) (+ n 1)))
+(label 1- (lambda (n) (- n 1)))
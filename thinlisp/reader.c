@@ -20,6 +20,7 @@ ENVIRONMENT *environment_new(BISTACK *bs) {
 
 READER *reader_init(READER *reader) {
     reader->in_comment = FALSE;
+    reader->sized_lists = FALSE;
     reader->put_missing_context = NULL;
     reader->pprint_context = NULL;
     reader->reader_context = new_reader_context(
@@ -32,8 +33,16 @@ READER *reader_init(READER *reader) {
     reader->ungetbuff_i = 0;
     reader->putc_streamobj = NULL;
     reader->putc = NULL;
+    reader->write = NULL;
     reader->getc_streamobj = NULL;
     reader->getc = NULL;
+    reader->events = NULL;
+    reader->pprint_width = READER_PPRINT_WIDTH;
+    reader->form_streamobj = NULL;
+    reader->form_ready = NULL;
+    reader->builtin_seed = 0;
+    reader->symbol_hash = 0;
+    reader->symbol_builtin_hash = 0;
     return reader;
 }
 
@@ -176,9 +185,11 @@ bool reader_integer_context(READER *reader, READER_CONTEXT *reader_context) {
     lassert(reader_context->asttype.type == AST_INTEGER, READER_STATE_ERROR);
 
     CELLHEADER *header = reader_context->cellheader;
-    uint16_t value = header->Integer.value;
+    int32_t value = cell_integer_value(header);
     while (1) {
         char c = reader_getc(reader);
+        char is_negative = (
+            cell_is_int32(header) ? value < 0 : !header->Integer.sign);
         if (c == -1) {
             return FALSE;
 
@@ -186,8 +197,15 @@ bool reader_integer_context(READER *reader, READER_CONTEXT *reader_context) {
             header->Integer.sign = (c == '-' ? 0 : 1);
 
         } else if (c >= '0' && c <= '9') {
-            value = value * 10 + (c - '0');
-            header->Integer.value = value;
+            int32_t digit = c - '0';
+            lassert(
+                is_negative ?
+                value >= (INT32_MIN + digit) / 10 :
+                value <= (INT32_MAX - digit) / 10,
+                READER_SYNTAX_ERROR,
+                "integer too large");
+            value = value * 10 + (is_negative ? -digit : digit);
+            cell_set_integer(reader->environment->bs, header, value);
 
         } else {
             reader_ungetc(reader, c);
@@ -234,34 +252,21 @@ bool reader_symbol_context(READER *reader, READER_CONTEXT *reader_context) {
         if (header->Symbol.length < ((1 << 6) - 1)) {
             ((char*)(&header[1]))[header->Symbol.length++] = c;
             symbol_context->is_escaped = 0;
+            symbol_context->hash = hashstr_8_step(symbol_context->hash, c);
+            symbol_context->builtin_hash = hashstr_8_step(
+                symbol_context->builtin_hash, c);
         }
     }
 
-    header->Symbol.hash = hashstr_8(
-        (char*)(&header[1]),
-        header->Symbol.length);
+    // the hashes were kept up as characters arrived, not rescanned here
+    header->Symbol.hash = symbol_context->hash;
+    reader->symbol_hash = symbol_context->hash;
+    reader->symbol_builtin_hash = symbol_context->builtin_hash;
 
     bistack_allocf(reader->environment->bs, header->Symbol.length);
     return TRUE;
 }
 
-/**
- * @return TRUE iff a non-zero digit was printed
- */
-char putc_tens(READER *r, uint16_t* value, uint16_t tens, char* print_zero) {
-    char c = '0';
-    for (; *value >= tens; *value -= tens) {
-        c++;
-    }
-    if (*print_zero || c > '0') {
-        *print_zero = TRUE;
-        return reader_putc(r, c);
-    } else {
-        return TRUE;
-    }
-}
-
-
 char reader_consume_comment(READER *reader) {
     // reads comment characters until newline
     while (reader->in_comment) {
@@ -305,6 +310,8 @@ READER_CONTEXT *new_reader_context(AST_TYPE asttype, BISTACK *bs) {
             AST_PREFIX_CHAR2(asttype.prefix));
         rc->symbol = bistack_alloc(bs, sizeof(READER_SYMBOL_CONTEXT));
         rc->symbol->is_escaped = 0;
+        rc->symbol->hash = 0;
+        rc->symbol->builtin_hash = 0;
         rc->cellheader = bistack_allocf(bs, sizeof(CELLHEADER));
         rc->cellheader->Symbol.type = asttype.type;
         rc->cellheader->Symbol.prefix = asttype.prefix;
@@ -314,7 +321,7 @@ READER_CONTEXT *new_reader_context(AST_TYPE asttype, BISTACK *bs) {
         rc->integer = bistack_alloc(bs, sizeof(READER_INTEGER_CONTEXT));
         rc->cellheader = bistack_allocf(bs, sizeof(CELLHEADER));
         rc->cellheader->Integer.type = asttype.type;
-        rc->cellheader->Integer.sign = 1;
+        rc->cellheader->Integer.sign = asttype.prefix != AST_MINUS;
         rc->cellheader->Integer.value = 0;
         break;
     default:
@@ -334,6 +341,87 @@ void destroy_reader_context(BISTACK *bs, READER_CONTEXT *reader_context) {
 }
 
 
+void reader_emit(READER *reader, READER_CONTEXT *reader_context, bool is_end) {
+    /**
+    * Sends the event for reader_context to the reader's event callbacks.
+    * List open events are sent when the list starts, all others on completion.
+    */
+    READER_EVENTS *events = reader->events;
+    CELLHEADER *header = reader_context->cellheader;
+
+    switch (reader_context->asttype.type) {
+    case AST_LIST:
+        if (!is_end && events->list_open) {
+            events->list_open(events->streamobj, header->List.prefix);
+        } else if (is_end && events->list_close) {
+            events->list_close(events->streamobj);
+        }
+        break;
+    case AST_SYMBOL:
+        if (header->Symbol.prefix == AST_DOUBLEQUOTE) {
+            if (events->string) {
+                events->string(
+                    events->streamobj,
+                    (char*)&header[1],
+                    header->Symbol.length);
+            }
+        } else if (events->symbol) {
+            events->symbol(
+                events->streamobj,
+                header->Symbol.prefix,
+                (char*)&header[1],
+                header->Symbol.length);
+        }
+        break;
+    case AST_INTEGER:
+        if (events->integer) {
+            events->integer(events->streamobj, cell_integer_value(header));
+        }
+        break;
+    }
+}
+
+
+void reader_finish_cell(
+        READER *reader,
+        READER_CONTEXT *parent_reader_context,
+        READER_CONTEXT *reader_context) {
+    /**
+    * Counts a completed cell in its parent list and destroys its context.
+    * In event mode the cell is released once its event is sent.  Otherwise a
+    * completed top-level form is passed to form_ready and then released, so
+    * the next form is read into the same space.
+    */
+    BISTACK *bs = reader->environment->bs;
+    CELLHEADER *header = reader_context->cellheader;
+    char is_top_level = parent_reader_context == reader->reader_context;
+
+    parent_reader_context->list->reader_context = NULL;
+    if (reader->events) {
+        reader_emit(reader, reader_context, TRUE);
+    }
+    destroy_reader_context(bs, reader_context);
+
+    if (reader->events) {
+        bistack_releasef(bs, header);
+    } else {
+        // lists already extended past CELL_LIST_PLAIN_MAX children are
+        // sized too, and they are the ones most in need of a table
+        if (reader->sized_lists && cell_is_list(header)) {
+            cell_size_list(bs, header);
+        }
+        if (reader->form_ready && is_top_level) {
+            reader->form_ready(reader->form_streamobj, header);
+            bistack_releasef(bs, header);
+            return;
+        }
+    }
+
+    // counted last, as widening the parent's header moves its children
+    cell_list_add(bs, parent_reader_context->cellheader, 1);
+}
+
+
 bool reader_put_missing(READER *reader) {
     /**
     * calls `reader_putc` with the characters missing to conclude the read.
@@ -462,18 +550,24 @@ char reader_read(READER *reader) {
                 lassert(
                     parent_parent_reader_context != NULL,
                     READER_SYNTAX_SPURIOUS_LIST_TERMINATOR);
-                parent_parent_reader_context->cellheader->List.length++;
-                parent_parent_reader_context->list->reader_context = NULL;
-                destroy_reader_context(bs, parent_reader_context);
+                reader_finish_cell(
+                    reader, parent_parent_reader_context,
+                    parent_reader_context);
                 continue;
 
             } else {
                 // new cell
                 reader_context = new_reader_context(asttype, bs);
+                if (asttype.type == AST_SYMBOL) {
+                    reader_context->symbol->builtin_hash = reader->builtin_seed;
+                }
 
                 // set parent_reader_context to be currently reading
                 //  reader_context
                 parent_reader_context->list->reader_context = reader_context;
+                if (reader->events && asttype.type == AST_LIST) {
+                    reader_emit(reader, reader_context, FALSE);
+                }
             }
 
         }
@@ -490,9 +584,7 @@ char reader_read(READER *reader) {
                     return 0;
                 }
             }
-            parent_reader_context->cellheader->List.length++;
-            parent_reader_context->list->reader_context = NULL;
-            destroy_reader_context(bs, reader_context);
+            reader_finish_cell(reader, parent_reader_context, reader_context);
             reader_context = NULL;
             continue;
 
@@ -505,262 +597,865 @@ char reader_read(READER *reader) {
 
 
 uint16_t cellheader_character_count(CELLHEADER *cellheader) {
-    uint8_t frame_stack[16] = {0};
-    int8_t frame_i = -1;
     uint16_t char_count = 0;
+    CELL_WALK walk;
+    cell_walk_init(&walk, cellheader, 1);
 
-    do {
-        if (cellheader->List.type == AST_LIST) {
+    while ((cellheader = cell_walk_next(&walk))) {
+        if (cell_is_list(cellheader)) {
             char_count += 4;
-            frame_stack[++frame_i] = cellheader->List.length;
-            cellheader = &cellheader[1];
-
-        } else if (cellheader->Integer.type == AST_INTEGER) {
-            char_count += 6;
-            frame_stack[frame_i]--;
-            cellheader = &cellheader[1];
-
+        } else if (cell_is_integer(cellheader)) {
+            char_count += cell_is_int32(cellheader) ? 12 : 6;
         } else if (cellheader->Symbol.type == AST_SYMBOL) {
             char_count += 2 + cellheader->Symbol.length;
-            frame_stack[frame_i]--;
-            cellheader = (CELLHEADER*)(
-                (void*)&cellheader[1] + cellheader->Symbol.length);
-        }
-
-        while (frame_i > 0 && frame_stack[frame_i] == 0) {
-            frame_stack[--frame_i]--;
         }
-    } while (frame_stack[0] > 0);
+    }
 
     return char_count;
 }
 
 
-char reader_pprint(READER *reader) {
-    lassert(reader->putc != NULL, READER_STATE_ERROR);
+/*
+ * Pretty printing follows Oppen's algorithm.  The tree walk turns cells into
+ * a stream of tokens, the scanner holds them in a ring until the size of each
+ * block and break is known (or the ring fills) and the printer decides where
+ * lines break, queueing output that is drained through reader_putc.  Memory
+ * is bounded by the ring (a few lines' worth of tokens) and the nesting depth,
+ * and every cell is visited once.
+ */
+enum {
+    PP_BEGIN=0,
+    PP_END,
+    PP_BREAK,
+    // tokens printed as text
+    PP_TEXT,
+    PP_SYMBOL,
+    PP_INTEGER,
+    // queued output
+    PP_NEWLINE,
+    PP_SPACES,
+};
+
+#define PP_INFINITY 0x3fffffff
+#define PP_MAX_TEXT (2 * (1 << CELL_SYMBOL_LENGTH_BITS) + 4)
+
+// a list's prefix and opening parenthesis, indexed by prefix
+static const char *const PP_LIST_OPEN[] = {
+    "(", ",(", "@(", ",@(", "#'(", "#(", "'(", "\"(", "'#(", "`(", "+(", "-(",
+};
+
+typedef struct pprint_token {
+    uint8_t type;
+    // characters of text, offset of a block, or count of spaces
+    uint8_t len;
+    // size as in Oppen's algorithm, negative until known
+    int32_t size;
+    const void *ptr;
+} PPRINT_TOKEN;
+
+typedef struct pprint_frame {
+    // the list, the next cell to print and the number of cells left in it
+    CELLHEADER *list;
+    CELLHEADER *next;
+    uint16_t remaining;
+    uint8_t is_first;
+} PPRINT_FRAME;
+
+// lists printed flat are tracked in chunks of this many, allocated only
+// as deep as the printing goes
+#define PPRINT_FLAT_CHUNK_SIZE 16
+
+typedef struct pprint_flat_chunk {
+    struct pprint_flat_chunk *prev;
+    struct pprint_flat_chunk *next;
+    // an open list and the number of its children left to print
+    struct {
+        CELLHEADER *list;
+        uint16_t remaining;
+    } open[PPRINT_FLAT_CHUNK_SIZE];
+} PPRINT_FLAT_CHUNK;
+
+typedef struct pprint_block {
+    // space left on the line when the block's breaks are taken
+    int16_t offset;
+    uint8_t is_broken;
+} PPRINT_BLOCK;
+
+typedef struct pprint_context {
+    void *start_mark;
+    BISTACK *bs;
+    uint8_t width;
+
+    // tree walk, frames[0] holds the forms being printed
+    PPRINT_FRAME frames[READER_PPRINT_DEPTH + 1];
+    int8_t frame_i;
+
+    // scanner ring, occupying left..right, and its stack of pending tokens
+    PPRINT_TOKEN *ring;
+    uint16_t *scan_stack;
+    uint16_t ring_size;
+    uint16_t left;
+    uint16_t right;
+    uint16_t scan_bottom;
+    uint16_t scan_count;
+    int32_t left_total;
+    int32_t right_total;
+
+    // lists nested beyond READER_PPRINT_DEPTH, printed flat: the chunk
+    // holding the innermost open one and its place in it, the next cell to
+    // print and the number of lists open around that cell
+    PPRINT_FLAT_CHUNK *flat_chunk;
+    uint8_t flat_i;
+    CELLHEADER *flat_next;
+    uint16_t flat_depth;
+
+    // printer
+    int16_t space;
+    PPRINT_BLOCK blocks[READER_PPRINT_DEPTH];
+    uint8_t block_i;
+
+    // output not yet accepted by reader_putc
+    PPRINT_TOKEN *out;
+    uint16_t out_size;
+    uint16_t out_head;
+    uint16_t out_count;
+    uint8_t out_pos;
+} PPRINT_CONTEXT;
+
+
+static char pprint_is_symbol_char(char c) {
+    return !is_whitespace(c) && c != '(' && c != ')' && c != ';' && c != '\\';
+}
 
-    typedef struct frame {
-        // pointer to this frame's CELLHEADER
-        CELLHEADER *cellheader;
-        // counter counts down list elements, symbol characters or integer tens
-        uint8_t counter;
-        // if true, this list frame should print a newline after every element
-        uint8_t is_newline_per_cell;
-        // counts number of prefix characters printed
-        uint8_t prefix_counter;
-    } FRAME;
+static uint8_t pprint_symbol_text(CELLHEADER *header, char *buffer) {
+    /**
+     * Writes the printed form of a symbol or string into buffer, escaping
+     * what the reader would otherwise split or misread.
+     * If buffer is NULL only the length is computed.
+     * @return The number of characters in the printed form
+     */
+    char *str = (char*)&header[1];
+    uint8_t length = header->Symbol.length;
+    uint8_t prefix = header->Symbol.prefix;
+    uint8_t count = 0;
+
+#define PP_OUT(C) do { if (buffer) { buffer[count] = (C); } count++; } while (0)
+    char c = AST_PREFIX_CHAR1(prefix);
+    if (c) {
+        PP_OUT(c);
+    }
+    c = AST_PREFIX_CHAR2(prefix);
+    if (c) {
+        PP_OUT(c);
+    }
+    for (uint8_t i=0; i<length; i++) {
+        c = str[i];
+        char is_escaped;
+        if (prefix == AST_DOUBLEQUOTE) {
+            is_escaped = c == '"' || c == '\\';
+        } else if (i == 0 && length > 1) {
+            // a leading prefix, quote or digit would change how it reads
+            is_escaped = (
+                !pprint_is_symbol_char(c) || strchr("\"'`,@#+-", c) ||
+                (c >= '0' && c <= '9'));
+        } else {
+            is_escaped = !pprint_is_symbol_char(c);
+        }
+        if (is_escaped) {
+            PP_OUT('\\');
+        }
+        PP_OUT(c);
+    }
+    c = AST_POSTFIX_CHAR(prefix);
+    if (c) {
+        PP_OUT(c);
+    }
+#undef PP_OUT
+    return count;
+}
 
-    typedef struct pprint_context {
-        LIST *frame_stack;
-        void *start_mark;
-        uint8_t indent_countdown;
-        uint8_t is_printing_newline;
-        uint8_t indent;
-    } PPRINT_CONTEXT;
+static uint8_t pprint_integer_text(CELLHEADER *header, char *buffer) {
+    /**
+     * Writes the decimal form of an integer into buffer, or only counts its
+     * characters if buffer is NULL.
+     */
+    char digits[10];
+    uint8_t ndigits = 0;
+    int32_t value = cell_integer_value(header);
+    uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+    do {
+        digits[ndigits++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+
+    uint8_t count = 0;
+    if (value < 0) {
+        if (buffer) {
+            buffer[count] = '-';
+        }
+        count++;
+    }
+    while (ndigits) {
+        ndigits--;
+        if (buffer) {
+            buffer[count] = digits[ndigits];
+        }
+        count++;
+    }
+    return count;
+}
 
-    ENVIRONMENT *e = reader->environment;
-    PPRINT_CONTEXT *pprint_context = NULL;
-    char c = '\0';
 
-    if (reader->pprint_context == NULL) {
-        // first call, create context
-        void *start_mark = bistack_mark(e->bs);
-        pprint_context = bistack_alloc(e->bs, sizeof(PPRINT_CONTEXT));
-        pprint_context->frame_stack = list_new(e->bs);
-        pprint_context->start_mark = start_mark;
-        reader->pprint_context = pprint_context;
-
-        // push top frame onto stack
-        FRAME *frame = bistack_alloc(e->bs, sizeof(FRAME));
-        frame->cellheader = reader->reader_context->cellheader;
-        frame->counter = 0;
-        list_unshift(pprint_context->frame_stack, e->bs, frame);
+static void pprint_queue(PPRINT_CONTEXT *ctx, uint8_t type, uint8_t len,
+        const void *ptr) {
+    lassert(ctx->out_count < ctx->out_size, READER_STATE_ERROR);
+    PPRINT_TOKEN *out = &ctx->out[
+        (ctx->out_head + ctx->out_count++) % ctx->out_size];
+    out->type = type;
+    out->len = len;
+    out->ptr = ptr;
+}
 
-    } else {
-        // continue from last invocation
-        pprint_context = (PPRINT_CONTEXT*)reader->pprint_context;
+static void pprint_print(PPRINT_CONTEXT *ctx, PPRINT_TOKEN *token,
+        int32_t size) {
+    /**
+     * Oppen's print: lays out a token whose size is known.
+     */
+    PPRINT_BLOCK *block;
+    switch (token->type) {
+    case PP_BEGIN:
+        lassert(ctx->block_i < READER_PPRINT_DEPTH, READER_STATE_ERROR);
+        block = &ctx->blocks[ctx->block_i++];
+        block->is_broken = size > ctx->space;
+        block->offset = ctx->space - token->len;
+        break;
+    case PP_END:
+        ctx->block_i--;
+        break;
+    case PP_BREAK:
+        block = &ctx->blocks[ctx->block_i - 1];
+        if (block->is_broken && size > ctx->space) {
+            ctx->space = block->offset;
+            pprint_queue(ctx, PP_NEWLINE, ctx->width - ctx->space, NULL);
+        } else {
+            ctx->space -= token->len;
+            pprint_queue(ctx, PP_SPACES, token->len, NULL);
+        }
+        break;
+    default:
+        ctx->space -= size;
+        pprint_queue(ctx, token->type, size, token->ptr);
     }
+}
 
+static char pprint_advance_left(PPRINT_CONTEXT *ctx) {
+    /**
+     * Prints tokens from the left of the ring while their sizes are known.
+     * @return TRUE if any token was printed
+     */
+    char is_printed = FALSE;
     while (TRUE) {
-        if (pprint_context->is_printing_newline) {
-            if (pprint_context->indent_countdown == 0) {
-                // indent_countdown not set yet, print newline
-                if (!reader_putc(reader, '\n')) {
-                    return FALSE;
-                }
-                pprint_context->indent_countdown = pprint_context->indent;
-            }
-            while (pprint_context->indent_countdown) {
-                if (!reader_putc(reader, ' ')) {
-                    return FALSE;
-                }
-                pprint_context->indent_countdown--;
-            }
-            pprint_context->is_printing_newline = FALSE;
+        PPRINT_TOKEN *token = &ctx->ring[ctx->left];
+        if (token->size < 0) {
+            break;
+        }
+        pprint_print(ctx, token, token->size);
+        is_printed = TRUE;
+        if (token->type == PP_BREAK) {
+            ctx->left_total += token->len;
+        } else if (token->type >= PP_TEXT) {
+            ctx->left_total += token->size;
+        }
+        if (ctx->left == ctx->right) {
+            break;
         }
-        FRAME *frame = list_first(pprint_context->frame_stack);
-        FRAME *parent_frame = list_second(pprint_context->frame_stack);
+        ctx->left = (ctx->left + 1) % ctx->ring_size;
+    }
+    return is_printed;
+}
 
-        CELLHEADER *cellheader = frame->cellheader;
-        if (cellheader->Symbol.type == AST_SYMBOL) {
-            switch (frame->prefix_counter) {
-            case 0:
-                c = AST_PREFIX_CHAR1(cellheader->Symbol.prefix);
-                if (c && !reader_putc(reader, c)) {
-                    return FALSE;
-                }
-                frame->prefix_counter++;
-            case 1:
-                c = AST_PREFIX_CHAR2(cellheader->Symbol.prefix);
-                if (c && !reader_putc(reader, c)) {
-                    return FALSE;
-                }
-                frame->prefix_counter++;
-                frame->counter = frame->cellheader->Symbol.length;
-            }
-            while (frame->counter) {
-                uint8_t i = frame->cellheader->Symbol.length - frame->counter;
-                if (!reader_putc(reader, ((char*)(&cellheader[1]))[i])) {
-                    return FALSE;
-                }
-                frame->counter--;
+static uint16_t pprint_scan_pop(PPRINT_CONTEXT *ctx) {
+    ctx->scan_count--;
+    return ctx->scan_stack[
+        (ctx->scan_bottom + ctx->scan_count) % ctx->ring_size];
+}
+
+static uint16_t pprint_scan_top(PPRINT_CONTEXT *ctx) {
+    return ctx->scan_stack[
+        (ctx->scan_bottom + ctx->scan_count - 1) % ctx->ring_size];
+}
+
+static void pprint_scan_push(PPRINT_CONTEXT *ctx, uint16_t i) {
+    ctx->scan_stack[(ctx->scan_bottom + ctx->scan_count++) % ctx->ring_size] = i;
+}
+
+static void pprint_force_left(PPRINT_CONTEXT *ctx) {
+    /**
+     * Gives up waiting on the oldest pending token, which is then treated as
+     * too large for the line, and prints what that releases.
+     */
+    if (ctx->scan_count && ctx->scan_stack[ctx->scan_bottom] == ctx->left) {
+        ctx->ring[ctx->left].size = PP_INFINITY;
+        ctx->scan_bottom = (ctx->scan_bottom + 1) % ctx->ring_size;
+        ctx->scan_count--;
+    }
+    pprint_advance_left(ctx);
+}
+
+static void pprint_check_stream(PPRINT_CONTEXT *ctx) {
+    while (ctx->right_total - ctx->left_total > ctx->space) {
+        uint16_t left = ctx->left;
+        pprint_force_left(ctx);
+        if (left == ctx->left || ctx->left == ctx->right) {
+            break;
+        }
+    }
+}
+
+static void pprint_check_stack(PPRINT_CONTEXT *ctx, int16_t k) {
+    /**
+     * Oppen's checkstack: fills in the sizes of the pending tokens that a
+     * break or the end of the stream completes.
+     */
+    while (ctx->scan_count) {
+        PPRINT_TOKEN *token = &ctx->ring[pprint_scan_top(ctx)];
+        if (token->type == PP_BEGIN) {
+            if (k == 0) {
+                break;
             }
-            c = AST_POSTFIX_CHAR(cellheader->Symbol.prefix);
-            if (c && !reader_putc(reader, c)) {
-                return FALSE;
+            pprint_scan_pop(ctx);
+            token->size += ctx->right_total;
+            k--;
+        } else if (token->type == PP_END) {
+            pprint_scan_pop(ctx);
+            token->size = 1;
+            k++;
+        } else {
+            pprint_scan_pop(ctx);
+            token->size += ctx->right_total;
+            if (k == 0) {
+                break;
             }
-        } else if (cellheader->Integer.type == AST_INTEGER) {
-            // print_zeros switches to true on first non-zero digit
-            char should_print_zeros = FALSE;
-            uint16_t value = cellheader->Integer.value;
+        }
+    }
+}
+
+static PPRINT_TOKEN *pprint_advance_right(PPRINT_CONTEXT *ctx) {
+    if ((ctx->right + 1) % ctx->ring_size == ctx->left) {
+        // ring is full, stop waiting on the oldest token
+        pprint_force_left(ctx);
+    }
+    ctx->right = (ctx->right + 1) % ctx->ring_size;
+    return &ctx->ring[ctx->right];
+}
+
+static void pprint_scan(PPRINT_CONTEXT *ctx, uint8_t type, uint8_t len,
+        const void *ptr) {
+    /**
+     * Oppen's scan: accepts the next token of the stream.
+     */
+    PPRINT_TOKEN *token;
+    PPRINT_TOKEN stack_token = { .type=type, .len=len, .size=len, .ptr=ptr };
+
+    if (ctx->scan_count == 0 && (type == PP_BEGIN || type == PP_BREAK)) {
+        ctx->left_total = ctx->right_total = 1;
+        ctx->left = ctx->right = 0;
+        token = &ctx->ring[0];
+    } else if (ctx->scan_count == 0) {
+        // nothing pending, print immediately
+        pprint_print(ctx, &stack_token, type == PP_END ? 0 : len);
+        return;
+    } else {
+        token = pprint_advance_right(ctx);
+    }
+    *token = stack_token;
+    uint16_t i = token - ctx->ring;
+
+    switch (type) {
+    case PP_BEGIN:
+        token->size = -ctx->right_total;
+        pprint_scan_push(ctx, i);
+        break;
+    case PP_END:
+        token->size = -1;
+        pprint_scan_push(ctx, i);
+        break;
+    case PP_BREAK:
+        pprint_check_stack(ctx, 0);
+        pprint_scan_push(ctx, i);
+        token->size = -ctx->right_total;
+        ctx->right_total += len;
+        break;
+    default:
+        ctx->right_total += len;
+        pprint_check_stream(ctx);
+    }
+}
+
+static void pprint_end_form(PPRINT_CONTEXT *ctx) {
+    /**
+     * Prints everything pending for a finished form and starts a new line.
+     */
+    if (ctx->scan_count) {
+        pprint_check_stack(ctx, 0);
+        pprint_advance_left(ctx);
+    }
+    lassert(ctx->scan_count == 0, READER_STATE_ERROR);
+    pprint_queue(ctx, PP_NEWLINE, 0, NULL);
+    ctx->space = ctx->width;
+    ctx->block_i = 0;
+}
+
+static void pprint_scan_atom(PPRINT_CONTEXT *ctx, CELLHEADER *cellheader) {
+    if (cell_is_integer(cellheader)) {
+        pprint_scan(
+            ctx, PP_INTEGER, pprint_integer_text(cellheader, NULL), cellheader);
+    } else {
+        pprint_scan(
+            ctx, PP_SYMBOL, pprint_symbol_text(cellheader, NULL), cellheader);
+    }
+}
 
-            if (frame->counter == 0) {
-                frame->counter = 6;
+static void pprint_flat_push(PPRINT_CONTEXT *ctx, CELLHEADER *list) {
+    /**
+     * Opens list, scanning its opening text.  Chunks popped earlier are
+     * reused before any more are allocated.
+     */
+    if (ctx->flat_chunk == NULL || ctx->flat_i == PPRINT_FLAT_CHUNK_SIZE) {
+        PPRINT_FLAT_CHUNK *chunk = (
+            ctx->flat_chunk ? ctx->flat_chunk->next : NULL);
+        if (chunk == NULL) {
+            chunk = bistack_alloc(ctx->bs, sizeof(PPRINT_FLAT_CHUNK));
+            chunk->prev = ctx->flat_chunk;
+            chunk->next = NULL;
+            if (ctx->flat_chunk) {
+                ctx->flat_chunk->next = chunk;
             }
-            switch (frame->counter) {
-            case 6:
-                c = cellheader->Integer.sign ? '+' : '-';
-                if (!reader_putc(reader, c)) {
-                    return FALSE;
-                }
-                frame->counter--;
-            case 5:
-                if (!putc_tens(reader, &value, 10000, &should_print_zeros)) {
-                    return FALSE;
-                }
-                frame->counter--;
-            case 4:
-                if (!putc_tens(reader, &value, 1000, &should_print_zeros)) {
-                    return FALSE;
-                }
-                frame->counter--;
-            case 3:
-                if (!putc_tens(reader, &value, 100, &should_print_zeros)) {
-                    return FALSE;
-                }
-                frame->counter--;
-            case 2:
-                if (!putc_tens(reader, &value, 10, &should_print_zeros)) {
-                    return FALSE;
-                }
-                frame->counter--;
-            case 1:
-                if (!putc_tens(reader, &value, 1, &should_print_zeros)) {
+        }
+        ctx->flat_chunk = chunk;
+        ctx->flat_i = 0;
+    }
+    ctx->flat_chunk->open[ctx->flat_i].list = list;
+    ctx->flat_chunk->open[ctx->flat_i].remaining = cell_list_length(list);
+    ctx->flat_i++;
+    ctx->flat_depth++;
+    ctx->flat_next = cell_list_first(list);
+
+    const char *open = PP_LIST_OPEN[cell_list_prefix(list)];
+    pprint_scan(ctx, PP_TEXT, strlen(open), open);
+}
+
+static void pprint_flat_step(PPRINT_CONTEXT *ctx) {
+    /**
+     * Scans the next cell of a list nested too deep for the frames, without
+     * breaks, in constant time.
+     */
+    CELLHEADER *list = ctx->flat_chunk->open[ctx->flat_i - 1].list;
+    uint16_t *remaining = &ctx->flat_chunk->open[ctx->flat_i - 1].remaining;
+
+    if (*remaining == 0) {
+        // a sized list may end with an offset table after its last child
+        if (cell_is_sized_list(list)) {
+            ctx->flat_next = cell_next(list);
+        }
+        if (--ctx->flat_i == 0 && ctx->flat_chunk->prev) {
+            ctx->flat_chunk = ctx->flat_chunk->prev;
+            ctx->flat_i = PPRINT_FLAT_CHUNK_SIZE;
+        }
+        ctx->flat_depth--;
+        pprint_scan(ctx, PP_TEXT, 1, ")");
+        if (ctx->flat_depth == 0) {
+            ctx->frames[ctx->frame_i].next = ctx->flat_next;
+        }
+        return;
+    }
+
+    CELLHEADER *cellheader = ctx->flat_next;
+    if ((*remaining)-- != cell_list_length(list)) {
+        pprint_scan(ctx, PP_TEXT, 1, " ");
+    }
+    if (cell_is_list(cellheader)) {
+        pprint_flat_push(ctx, cellheader);
+    } else {
+        pprint_scan_atom(ctx, cellheader);
+        ctx->flat_next = cell_next(cellheader);
+    }
+}
+
+static void pprint_step(PPRINT_CONTEXT *ctx) {
+    /**
+     * Walks to the next cell and scans its tokens.
+     */
+    if (ctx->flat_depth) {
+        pprint_flat_step(ctx);
+        return;
+    }
+    PPRINT_FRAME *frame = &ctx->frames[ctx->frame_i];
+
+    if (frame->remaining == 0) {
+        // end of list, the next cell of the parent follows the list
+        ctx->frame_i--;
+        ctx->frames[ctx->frame_i].next = (
+            cell_is_sized_list(frame->list) ?
+            cell_next(frame->list) : frame->next);
+        pprint_scan(ctx, PP_TEXT, 1, ")");
+        pprint_scan(ctx, PP_END, 0, NULL);
+        if (ctx->frame_i == 0) {
+            pprint_end_form(ctx);
+        }
+        return;
+    }
+
+    CELLHEADER *cellheader = frame->next;
+    frame->remaining--;
+    if (!frame->is_first) {
+        pprint_scan(ctx, PP_BREAK, 1, NULL);
+    }
+    frame->is_first = ctx->frame_i == 0;
+
+    if (cell_is_list(cellheader) && ctx->frame_i == READER_PPRINT_DEPTH) {
+        // no frame is left for the list, it is printed flat
+        pprint_flat_push(ctx, cellheader);
+        return;
+    } else if (cell_is_list(cellheader)) {
+        const char *open = PP_LIST_OPEN[cell_list_prefix(cellheader)];
+        uint8_t len = strlen(open);
+        frame = &ctx->frames[++ctx->frame_i];
+        frame->list = cellheader;
+        frame->next = cell_list_first(cellheader);
+        frame->remaining = cell_list_length(cellheader);
+        frame->is_first = TRUE;
+        // elements line up after the opening parenthesis
+        pprint_scan(ctx, PP_BEGIN, len, NULL);
+        pprint_scan(ctx, PP_TEXT, len, open);
+        return;
+    }
+
+    pprint_scan_atom(ctx, cellheader);
+    frame->next = cell_next(cellheader);
+    if (ctx->frame_i == 0) {
+        pprint_end_form(ctx);
+    }
+}
+
+static char pprint_drain(READER *reader, PPRINT_CONTEXT *ctx) {
+    /**
+     * Writes queued output through the reader.
+     * @return FALSE if the reader's output stopped accepting characters
+     */
+    char text[PP_MAX_TEXT];
+
+    while (ctx->out_count) {
+        PPRINT_TOKEN *out = &ctx->out[ctx->out_head];
+        const char *ptr = out->ptr;
+        uint8_t len = out->len;
+
+        if (out->type == PP_NEWLINE || out->type == PP_SPACES) {
+            if (out->type == PP_NEWLINE && ctx->out_pos == 0) {
+                if (!reader_putc(reader, '\n')) {
                     return FALSE;
                 }
-                frame->counter--;
+                ctx->out_pos++;
             }
-        } else if (cellheader->List.type == AST_LIST) {
-            switch (frame->prefix_counter) {
-            case 0:
-                c = AST_PREFIX_CHAR1(cellheader->List.prefix);
-                if (c && !reader_putc(reader, c)) {
-                    return FALSE;
-                }
-                frame->prefix_counter++;
-            case 1:
-                c = AST_PREFIX_CHAR2(cellheader->List.prefix);
-                if (c && !reader_putc(reader, c)) {
-                    return FALSE;
-                }
-                frame->prefix_counter++;
-            case 2:
-                if (!reader_putc(reader, '(')) {
-                    return FALSE;
-                }
-                frame->prefix_counter++;
-            case 3:
+            while (ctx->out_pos < len + (out->type == PP_NEWLINE)) {
                 if (!reader_putc(reader, ' ')) {
                     return FALSE;
                 }
-                frame->prefix_counter++;
-                frame->counter = frame->cellheader->List.length;
+                ctx->out_pos++;
             }
-
-            list_shift(pprint_context->frame_stack);
-            frame->counter--;
+            len = 0;
+        } else if (out->type == PP_SYMBOL) {
+            len = pprint_symbol_text((CELLHEADER*)ptr, text);
+            ptr = text;
+        } else if (out->type == PP_INTEGER) {
+            len = pprint_integer_text((CELLHEADER*)ptr, text);
+            ptr = text;
         }
 
-        while ((frame = list_shift(pprint_context->frame_stack))) {
-            frame->counter--;
-            if (frame->counter > 0) {
-                break;
+        while (ctx->out_pos < len) {
+            uint16_t count = reader_write(
+                reader, ptr + ctx->out_pos, len - ctx->out_pos);
+            if (!count) {
+                return FALSE;
             }
+            ctx->out_pos += count;
+        }
+
+        ctx->out_pos = 0;
+        ctx->out_head = (ctx->out_head + 1) % ctx->out_size;
+        ctx->out_count--;
+    }
+    return TRUE;
+}
+
+static char reader_pprint_cells(
+        READER *reader, CELLHEADER *first, uint16_t count) {
+    /**
+     * Prints count cells starting at first, one per line.  Returns FALSE when
+     * output stops being accepted; calling again with the same arguments
+     * continues where it left off.
+     */
+    lassert(reader->putc != NULL, READER_STATE_ERROR);
+
+    BISTACK *bs = reader->environment->bs;
+    PPRINT_CONTEXT *ctx = (PPRINT_CONTEXT*)reader->pprint_context;
+
+    if (ctx == NULL) {
+        // first call, create context
+        void *start_mark = bistack_mark(bs);
+        ctx = bistack_alloc(bs, sizeof(PPRINT_CONTEXT));
+        ctx->start_mark = start_mark;
+        ctx->width = reader->pprint_width;
+        ctx->ring_size = 3 * ctx->width;
+        ctx->ring = bistack_alloc(bs, ctx->ring_size * sizeof(PPRINT_TOKEN));
+        ctx->scan_stack = bistack_alloc(bs, ctx->ring_size * sizeof(uint16_t));
+        ctx->left = ctx->right = 0;
+        ctx->scan_bottom = ctx->scan_count = 0;
+        ctx->left_total = ctx->right_total = 1;
+        ctx->space = ctx->width;
+        ctx->block_i = 0;
+        // a step scans at most 3 tokens on top of a ring's worth of output
+        ctx->out_size = ctx->ring_size + 4;
+        ctx->out = bistack_alloc(bs, ctx->out_size * sizeof(PPRINT_TOKEN));
+        ctx->out_head = ctx->out_count = ctx->out_pos = 0;
+
+        ctx->bs = bs;
+        ctx->flat_chunk = NULL;
+        ctx->flat_i = 0;
+        ctx->flat_depth = 0;
+        ctx->frame_i = 0;
+        ctx->frames[0].list = NULL;
+        ctx->frames[0].next = first;
+        ctx->frames[0].remaining = count;
+        ctx->frames[0].is_first = TRUE;
+        reader->pprint_context = ctx;
+    }
+
+    while (TRUE) {
+        if (!pprint_drain(reader, ctx)) {
+            return FALSE;
         }
+        if (ctx->frame_i == 0 && ctx->frames[0].remaining == 0) {
+            break;
+        }
+        pprint_step(ctx);
     }
 
     // rewind and assert rewound mark is where this continuation began
-    lassert(
-        pprint_context->start_mark == bistack_rewind(reader->environment->bs),
-        READER_STATE_ERROR);
+    lassert(ctx->start_mark == bistack_rewind(bs), READER_STATE_ERROR);
     reader->pprint_context = NULL;
     return TRUE;
 }
 
+char reader_pprint(READER *reader) {
+    CELLHEADER *root = reader->reader_context->cellheader;
+    return reader_pprint_cells(
+        reader, cell_list_first(root), cell_list_length(root));
+}
+
+char reader_pprint_cell(READER *reader, CELLHEADER *cellheader) {
+    return reader_pprint_cells(reader, cellheader, 1);
+}
+
 
 #ifdef READER_MAIN
-#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "outbuf.h"
+#include "tlc.h"
 
 typedef struct {
     READER *reader;
+    int fd;
     char is_done;
     char last_char;
-    char is_paused;
+    // bytes received by the last read() that the reader has not consumed
+    char buffer[128];
+    uint8_t len;
+    uint8_t pos;
 } INPUT_STREAM;
 
 typedef struct {
     READER *reader;
+    int fd;
+    OUTBUF outbuf;
+    char buffer[256];
 } OUTPUT_STREAM;
 
 char mygetc(void *streamobj) {
+    /**
+    * Returns the next received character or -1 when all of them have been
+    * consumed, which suspends reader_read until the next repl_ready.
+    */
     INPUT_STREAM *is = (INPUT_STREAM*)streamobj;
-    READER *reader = is->reader;
-
-    if (is->is_paused == FALSE && is->last_char == '\n') {
-        is->is_paused = TRUE;
+    if (is->pos == is->len) {
         return -1;
-    } else {
-        is->is_paused = FALSE;
     }
+    is->last_char = is->buffer[is->pos++];
+    return is->last_char;
+}
 
-    int c = getchar();
-    is->last_char = c;
-    if (c == -1) {
-        is->is_done = TRUE;
-        return -1;
+uint16_t fdwrite(void *streamobj, const char *ptr, uint16_t len) {
+    ssize_t count = write(((OUTPUT_STREAM*)streamobj)->fd, ptr, len);
+    return count < 0 ? 0 : count;
+}
+
+void repl_printf(OUTPUT_STREAM *os, const char *format, ...) {
+    char line[128];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    outbuf_write(
+        &os->outbuf, line,
+        (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+char filegetc(void *streamobj) {
+    int c = fgetc((FILE*)streamobj);
+    return c == EOF ? -1 : c;
+}
+
+void repl_eval(void *streamobj, CELLHEADER *form) {
+    /**
+    * Called with each form as soon as it is read.  Stands in for compiling
+    * and evaluating the form by echoing it, the form is released on return.
+    */
+    OUTPUT_STREAM *os = (OUTPUT_STREAM*)streamobj;
+    while (!reader_pprint_cell(os->reader, form)) {
+        // the buffer filled, retry once it is written out
+        if (!outbuf_flush(&os->outbuf)) {
+            lerror(READER_STATE_ERROR, "output closed");
+        }
+    }
+}
+
+void repl_load(READER *reader, char *filename) {
+    /**
+    * Reads filename form by form, each is evaluated as soon as it closes.
+    * Forms precompiled into a .tlc file are evaluated without reading.
+    */
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror(filename);
+        return;
+    }
+    size_t namelen = strlen(filename);
+    if (namelen > 4 && strcmp(&filename[namelen - 4], ".tlc") == 0) {
+        BISTACK *bs = reader->environment->bs;
+        TLC_MODULE module;
+        tlc_load(bs, file, &module);
+        CELLHEADER *form = module.forms;
+        for (uint16_t i=0; i<module.nforms; i++) {
+            reader->form_ready(reader->form_streamobj, form);
+            form = cell_next(form);
+        }
+        bistack_releasef(bs, module.forms);
     } else {
-        return c;
+        reader_set_getc(reader, filegetc, file);
+        if (!reader_read(reader)) {
+            printf(" *** %s: unterminated form\n", filename);
+        }
     }
+    fclose(file);
 }
 
-char myputc(void *streamobj, char c) {
-    putchar(c);
-    return c;
+int repl_compile(READER *reader, char *outname, int nfiles, char **filenames) {
+    /**
+    * Reads all forms of the files and saves them to outname as a .tlc file.
+    */
+    reader_set_form_ready(reader, NULL, NULL);
+    reader_set_sized_lists(reader, TRUE);
+    for (int i=0; i<nfiles; i++) {
+        FILE *file = fopen(filenames[i], "rb");
+        if (file == NULL) {
+            perror(filenames[i]);
+            return 1;
+        }
+        reader_set_getc(reader, filegetc, file);
+        char is_complete = reader_read(reader);
+        fclose(file);
+        if (!is_complete) {
+            printf(" *** %s: unterminated form\n", filenames[i]);
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(outname, "wb");
+    if (out == NULL) {
+        perror(outname);
+        return 1;
+    }
+    CELLHEADER *root = reader->reader_context->cellheader;
+    tlc_save(
+        reader->environment->bs, out,
+        cell_list_first(root), cell_list_length(root));
+    fclose(out);
+    return 0;
 }
 
-void sleep_15ms() {
-    static struct timespec fifteen_millis = {.tv_sec=0, .tv_nsec=15000};
-    nanosleep(&fifteen_millis, NULL);
+void repl_prompt(OUTPUT_STREAM *os) {
+    outbuf_write(&os->outbuf, "> ", 2);
+    outbuf_flush(&os->outbuf);
+}
+
+void repl_ready(INPUT_STREAM *is, OUTPUT_STREAM *os) {
+    /**
+    * Called whenever input is ready.  Receives what is available and resumes
+    * the reader over it.  A UART receive interrupt would drive the same path
+    * on a device, feeding the reader as bytes arrive instead of polling.
+    */
+    ssize_t count = read(is->fd, is->buffer, sizeof(is->buffer));
+    if (count <= 0) {
+        is->is_done = TRUE;
+        return;
+    }
+    is->len = count;
+    is->pos = 0;
+
+    while (is->pos < is->len) {
+        bool is_complete = reader_read(is->reader);
+        if (is->last_char == '\n') {
+            if (!is_complete) {
+                // show what remains to close the current form
+                while (!reader_put_missing(is->reader));
+                outbuf_putc(&os->outbuf, '\n');
+            }
+            repl_prompt(os);
+        }
+    }
+}
+
+int repl_accept(uint16_t port) {
+    /**
+    * Listens on port and returns the first connection to serve the REPL on.
+    */
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = { .s_addr = htonl(INADDR_ANY) },
+    };
+    int one = 1;
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0 ||
+            setsockopt(
+                listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+            bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            listen(listenfd, 1) < 0) {
+        perror("unable to listen");
+        exit(-1);
+    }
+    int fd = accept(listenfd, NULL, NULL);
+    close(listenfd);
+    // a closed connection ends the REPL instead of raising SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    return fd;
 }
 
 int main(int argc, char **argv) {
@@ -771,39 +1466,69 @@ int main(int argc, char **argv) {
 
     INPUT_STREAM is = {
         .reader=reader,
+        .fd=STDIN_FILENO,
         .is_done=FALSE,
         .last_char=' ',
-        .is_paused=TRUE,
+        .len=0,
+        .pos=0,
     };
     OUTPUT_STREAM os = {
-        .reader=reader
+        .reader=reader,
+        .fd=STDOUT_FILENO,
     };
+    outbuf_init(&os.outbuf, os.buffer, sizeof(os.buffer), fdwrite, &os);
+
+    // usage: reader [-p port] [file ...]
+    //        reader -c out.tlc file ...
+    char is_compile = argc > 2 && strcmp(argv[1], "-c") == 0;
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        is.fd = os.fd = repl_accept(atoi(argv[2]));
+        argc -= 2;
+        argv += 2;
+    }
 
+    // the next file to load, passed over before loading so an error in one
+    // file resumes with the next instead of loading it again
+    volatile int nextfile = 1;
     int exctype = setjmp(__jmpbuff);
     if (exctype != 0) {
-        printf("\n *** %s\n", thrown_error_to_string(exctype));
+        repl_printf(&os, "\n *** %s\n", thrown_error_to_string(exctype));
+        if (is_compile) {
+            outbuf_flush(&os.outbuf);
+            return 1;
+        }
+        // drop the rest of the input that raised the error
+        is.pos = is.len;
     }
 
     reader_init(reader);
+    if (is_compile) {
+        return repl_compile(reader, argv[2], argc - 3, &argv[3]);
+    }
+    reader_set_form_ready(reader, repl_eval, &os);
+    reader_set_putc(reader, outbuf_putc, &os.outbuf);
+    reader_set_write(reader, outbuf_write);
+    while (nextfile < argc) {
+        repl_load(reader, argv[nextfile++]);
+    }
     reader_set_getc(reader, mygetc, &is);
-    reader_set_putc(reader, myputc, &os);
-    is.is_paused = TRUE;
-    is.last_char = ' ';
 
+    repl_prompt(&os);
+    struct pollfd pollfd = { .fd=is.fd, .events=POLLIN };
     while (!is.is_done) {
-        putchar('>');
-        putchar(' ');
-        while (!reader_read(reader)) {
-            if (is.last_char == '\n') {
-                while(!reader_put_missing(reader)) {
-                    sleep_15ms();
-                }
-                break;
+        // sleep until input arrives, nothing runs while idle
+        if (poll(&pollfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            break;
+        }
+        if (pollfd.revents & (POLLIN | POLLHUP)) {
+            repl_ready(&is, &os);
         }
-        sleep_15ms();
     }
+    outbuf_flush(&os.outbuf);
     return 0;
 }
 
-#endif
\ No newline at end of file
+#endif
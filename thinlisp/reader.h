@@ -10,12 +10,21 @@
 #include "list.h"
 #include "bistack.h"
 #include "runtime.h"
+#include "cell.h"
+
+// default line width of reader_pprint, and the deepest nesting it lays out,
+// lists nested deeper are printed on one line
+#define READER_PPRINT_WIDTH 80
+#define READER_PPRINT_DEPTH 32
 
 typedef struct reader READER;
 typedef struct reader_context READER_CONTEXT;
 
 typedef struct reader_symbolcontext {
     char is_escaped;
+    // hashes of the characters accepted so far, kept up as they are read
+    uint8_t hash;
+    uint8_t builtin_hash;
 } READER_SYMBOL_CONTEXT;
 
 typedef struct reader_integercontext {
@@ -49,6 +58,20 @@ typedef struct environment {
 
 } ENVIRONMENT;
 
+/**
+ * Callbacks invoked as cells complete when reading in event mode.  Completed
+ * cells are released from the bistack after their event, so no tree is built.
+ * Any callback may be NULL.
+ */
+typedef struct reader_events {
+    void *streamobj;
+    void (*list_open)(void *streamobj, uint8_t prefix);
+    void (*list_close)(void *streamobj);
+    void (*symbol)(void *streamobj, uint8_t prefix, char *str, uint8_t len);
+    void (*string)(void *streamobj, char *str, uint8_t len);
+    void (*integer)(void *streamobj, int32_t value);
+} READER_EVENTS;
+
 typedef struct reader {
     ENVIRONMENT *environment;
 
@@ -57,15 +80,29 @@ typedef struct reader {
 
     void *putc_streamobj;
     char (*putc)(void *putc_streamobj, char c);
+    uint16_t (*write)(void *putc_streamobj, const char *ptr, uint16_t len);
 
     char ungetbuff[4];
 
     uint8_t ungetbuff_i:4;
     uint8_t in_comment:1;
+    uint8_t sized_lists:1;
+
+    READER_EVENTS *events;
+
+    void *form_streamobj;
+    void (*form_ready)(void *form_streamobj, CELLHEADER *form);
+
+    // the starting value of builtin hashes, see reader_set_builtin_seed
+    uint8_t builtin_seed;
+    // the hashes of the symbol or string read last
+    uint8_t symbol_hash;
+    uint8_t symbol_builtin_hash;
 
     READER_CONTEXT *reader_context;
     void *put_missing_context;
     void *pprint_context;
+    uint8_t pprint_width;
 } READER;
 
 ENVIRONMENT *environment_new(BISTACK *bs);
@@ -74,7 +111,14 @@ READER *reader_init(READER *reader);
 char reader_consume_comment(READER *reader);
 char reader_read(READER *reader);
 char reader_pprint(READER *reader);
+char reader_pprint_cell(READER *reader, CELLHEADER *cellheader);
 bool reader_put_missing(READER *reader);
+
+/**
+ * Estimates the characters cellheader prints as, allowing each cell room
+ * for its prefix and separators.  Offset tables are not counted.
+ */
+uint16_t cellheader_character_count(CELLHEADER *cellheader);
 READER_CONTEXT *new_reader_context(AST_TYPE asttype, BISTACK *bs);
 
 static inline char reader_getc(READER *r) {
@@ -118,11 +162,87 @@ static inline void reader_set_putc(
     r->putc_streamobj = putc_streamobj;
 }
 
+static inline void reader_set_events(READER *r, READER_EVENTS *events) {
+    r->events = events;
+}
+
+/**
+ * Sets a function called with each top-level form as soon as it is read.
+ * The form is released when form_ready returns, so it must be compiled or
+ * evaluated before returning.
+ */
+static inline void reader_set_form_ready(
+        READER *r,
+        void (*form_ready)(void *, CELLHEADER *),
+        void *form_streamobj) {
+    r->form_ready = form_ready;
+    r->form_streamobj = form_streamobj;
+}
+
+
+/**
+ * Sets whether completed lists are stored sized (see cell.h), so they can be
+ * skipped and indexed without walking their children.
+ */
+static inline void reader_set_sized_lists(READER *r, char is_sized) {
+    r->sized_lists = is_sized;
+}
+
+/**
+ * Sets the seed of a second hash kept up as symbols are read, such as
+ * rom_builtin_seed, so builtins are recognized without another pass over
+ * the name.  See reader_symbol_builtin_hash.
+ */
+static inline void reader_set_builtin_seed(READER *r, uint8_t seed) {
+    r->builtin_seed = seed;
+}
+
+/**
+ * The full hashstr_8 of the symbol or string read last, of which its cell
+ * keeps the low 5 bits.  Valid in its symbol or string event, and until the
+ * next symbol is read.
+ */
+static inline uint8_t reader_symbol_hash(READER *r) {
+    return r->symbol_hash;
+}
+
+/**
+ * The hash of the symbol or string read last from the builtin seed, for
+ * rom_findbuiltin.
+ */
+static inline uint8_t reader_symbol_builtin_hash(READER *r) {
+    return r->symbol_builtin_hash;
+}
+
+static inline void reader_set_pprint_width(READER *r, uint8_t width) {
+    r->pprint_width = width;
+}
+
+/**
+ * Sets an optional function writing several characters to the putc stream
+ * at once, returning how many it accepted.
+ */
+static inline void reader_set_write(
+        READER *r,
+        uint16_t (*write)(void *, const char *, uint16_t)) {
+    r->write = write;
+}
 
 static inline char reader_putc(READER *r, char c) {
     return r->putc(r->putc_streamobj, c);
 }
 
+static inline uint16_t reader_write(READER *r, const char *ptr, uint16_t len) {
+    if (r->write) {
+        return r->write(r->putc_streamobj, ptr, len);
+    }
+    uint16_t count = 0;
+    while (count < len && reader_putc(r, ptr[count])) {
+        count++;
+    }
+    return count;
+}
+
 static inline char is_whitespace(char c) {
     return c == '\n' || c == ' ' || c == '\t';
 }
@@ -0,0 +1,474 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "defines.h"
+#include "reader.h"
+#include "reader_parallel.h"
+#include "runtime.h"
+#include "bistack.h"
+
+// the backward stack space of each open list: a mark and its contexts
+#define READER_PARALLEL_DEPTH_SIZE ( \
+    sizeof(void*) + sizeof(READER_CONTEXT) + sizeof(READER_LIST_CONTEXT))
+
+typedef struct reader_parallel_worker {
+    // the chunk of source text this worker reads
+    const char *buffer;
+    size_t len;
+    size_t pos;
+
+    BISTACK *bs;
+    READER *reader;
+
+    // error thrown while reading, or 0
+    int error;
+} READER_PARALLEL_WORKER;
+
+
+uint8_t reader_split_forms(
+        const char *buffer, size_t len, size_t *chunk_ends, uint8_t nchunks) {
+    /**
+     * Walks buffer tracking list depth, strings, comments and escapes with the
+     * reader's own rules: a symbol runs until whitespace, ')' or ';', so '('
+     * and '"' inside one are part of it, an integer runs until its first
+     * non-digit, and a string is not closed by a '"' before its first
+     * character.  A form ends when a list closes or an atom ends at depth 0.
+     * The first form end past each 1/nchunks of buffer becomes a chunk
+     * boundary.
+     */
+    int16_t depth = 0;
+    char in_atom = FALSE;
+    char in_integer = FALSE;
+    char is_zero = FALSE;
+    char in_string = FALSE;
+    char is_empty = FALSE;
+    char in_comment = FALSE;
+    char is_escaped = FALSE;
+    uint8_t chunk_i = 0;
+
+    for (size_t i=0; i<len && chunk_i < nchunks - 1; i++) {
+        char c = buffer[i];
+        size_t form_end = 0;
+        // whether c belongs to the string or atom being read
+        char is_part = in_string || in_atom || in_integer;
+
+        if (in_comment) {
+            in_comment = c != '\n';
+            continue;
+
+        } else if (is_escaped) {
+            is_escaped = FALSE;
+            is_empty = FALSE;
+            continue;
+
+        } else if (in_string) {
+            if (c == '\\') {
+                is_escaped = TRUE;
+            } else if (c == '"' && !is_empty) {
+                in_string = FALSE;
+                form_end = depth == 0 ? i + 1 : 0;
+            } else if (c != '"') {
+                is_empty = FALSE;
+            }
+
+        } else if (in_atom) {
+            if (c == '\\') {
+                is_escaped = TRUE;
+            } else if (is_whitespace(c) || c == ')' || c == ';') {
+                // the character ending the symbol is read again below
+                in_atom = FALSE;
+                is_part = FALSE;
+                form_end = depth == 0 ? i : 0;
+            }
+        }
+
+        if (in_integer) {
+            if (c >= '0' && c <= '9') {
+                is_zero = is_zero && c == '0';
+            } else if (!is_zero || (c != '-' && c != '+')) {
+                // the character ending the integer is read again below
+                in_integer = FALSE;
+                is_part = FALSE;
+                form_end = depth == 0 ? i : 0;
+            }
+        }
+
+        if (!is_part) {
+            switch (c) {
+            case ' ':
+            case '\t':
+            case '\n':
+                // the whitespace of is_whitespace, any other character is
+                // part of an atom as it is to the reader
+                break;
+            case ';':
+                in_comment = TRUE;
+                break;
+            case '"':
+                in_string = TRUE;
+                is_empty = TRUE;
+                break;
+            case '(':
+                depth++;
+                break;
+            case ')':
+                lassert(depth > 0, READER_SYNTAX_SPURIOUS_LIST_TERMINATOR);
+                depth--;
+                form_end = depth == 0 ? i + 1 : 0;
+                break;
+            case '\'':
+            case '`':
+            case ',':
+            case '@':
+            case '#':
+            case '+':
+            case '-':
+                // prefixes belong to the form that follows them
+                break;
+            case '\\':
+                in_atom = TRUE;
+                is_escaped = TRUE;
+                break;
+            default:
+                if (c >= '0' && c <= '9') {
+                    in_integer = TRUE;
+                    is_zero = c == '0';
+                } else {
+                    in_atom = TRUE;
+                }
+            }
+        }
+
+        if (form_end && form_end >= (len / nchunks) * (chunk_i + 1)) {
+            chunk_ends[chunk_i++] = form_end;
+        }
+    }
+
+    // the final chunk takes everything remaining, including trailing comments
+    chunk_ends[chunk_i++] = len;
+    return chunk_i;
+}
+
+
+static char reader_parallel_getc(void *streamobj) {
+    /**
+     * Reads from the worker's chunk, yielding one trailing newline so an atom
+     * ending the chunk is terminated.
+     */
+    READER_PARALLEL_WORKER *worker = (READER_PARALLEL_WORKER*)streamobj;
+    if (worker->pos < worker->len) {
+        return worker->buffer[worker->pos++];
+    } else if (worker->pos == worker->len) {
+        worker->pos++;
+        return '\n';
+    } else {
+        return -1;
+    }
+}
+
+
+static void *reader_parallel_run(void *worker_void) {
+    READER_PARALLEL_WORKER *worker = (READER_PARALLEL_WORKER*)worker_void;
+
+    // cells are never larger than twice the text they were read from, but
+    // the reader contexts of open lists grow with nesting depth.  A read
+    // which runs out starts over with twice the space, until there is room
+    // for every character of the chunk to open a list.
+    volatile size_t size = worker->len * 2 + 1024;
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == BISTACK_OUT_OF_MEMORY &&
+            size < worker->len * READER_PARALLEL_DEPTH_SIZE) {
+        bistack_destroy(worker->bs);
+        size *= 2;
+        worker->pos = 0;
+    } else if (exctype != 0) {
+        worker->error = exctype;
+        return NULL;
+    }
+
+    worker->bs = bistack_new(size);
+    bistack_pushdir(worker->bs, BS_BACKWARD);
+    ENVIRONMENT *environment = environment_new(worker->bs);
+    worker->reader = reader_new(environment);
+    reader_set_getc(worker->reader, reader_parallel_getc, worker);
+
+    // the chunk ends on a form boundary, so an unfinished read is an error
+    lassert(reader_read(worker->reader), READER_SYNTAX_ERROR);
+    return NULL;
+}
+
+
+static void reader_parallel_append(
+        READER *reader, CELLHEADER *root, READER_PARALLEL_WORKER *worker) {
+    /**
+     * Copies the children of the worker's root list onto the end of root.
+     */
+    BISTACK *bs = reader->environment->bs;
+    CELLHEADER *worker_root = worker->reader->reader_context->cellheader;
+    char *src = (char*)cell_list_first(worker_root);
+    size_t remaining = (char*)worker->bs->forwardptr - src;
+
+    // bistack allocations are limited to 16 bits, copy in pieces
+    while (remaining) {
+        uint16_t piece = remaining > 0x8000 ? 0x8000 : remaining;
+        memcpy(bistack_allocf(bs, piece), src, piece);
+        src += piece;
+        remaining -= piece;
+    }
+    cell_list_add(bs, root, cell_list_length(worker_root));
+}
+
+
+CELLHEADER *reader_read_parallel(
+        READER *reader, const char *buffer, size_t len, uint8_t nthreads) {
+    READER_PARALLEL_WORKER workers[READER_PARALLEL_MAX_THREADS];
+    pthread_t threads[READER_PARALLEL_MAX_THREADS];
+    size_t chunk_ends[READER_PARALLEL_MAX_THREADS];
+    CELLHEADER *root = reader->reader_context->cellheader;
+
+    lassert(
+        reader->reader_context->list->reader_context == NULL,
+        READER_STATE_ERROR);
+    if (nthreads > READER_PARALLEL_MAX_THREADS) {
+        nthreads = READER_PARALLEL_MAX_THREADS;
+    } else if (nthreads == 0) {
+        nthreads = 1;
+    }
+
+    uint8_t nchunks = reader_split_forms(buffer, len, chunk_ends, nthreads);
+    size_t start = 0;
+    for (uint8_t i=0; i<nchunks; i++) {
+        workers[i] = (READER_PARALLEL_WORKER){
+            .buffer = buffer + start,
+            .len = chunk_ends[i] - start,
+            .pos = 0,
+            .bs = NULL,
+            .reader = NULL,
+            .error = 0,
+        };
+        start = chunk_ends[i];
+        if (pthread_create(&threads[i], NULL, reader_parallel_run,
+                &workers[i]) != 0) {
+            // unable to spawn, read the chunk on this thread instead, where
+            // the worker's setjmp must not replace the caller's
+            jmp_buf caller;
+            memcpy(caller, __jmpbuff, sizeof(jmp_buf));
+            threads[i] = 0;
+            reader_parallel_run(&workers[i]);
+            memcpy(__jmpbuff, caller, sizeof(jmp_buf));
+        }
+    }
+
+    int error = 0;
+    for (uint8_t i=0; i<nchunks; i++) {
+        if (threads[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        if (error == 0) {
+            error = workers[i].error;
+        }
+    }
+
+    // concatenate in source order, then release the worker bistacks
+    for (uint8_t i=0; i<nchunks; i++) {
+        if (error == 0) {
+            reader_parallel_append(reader, root, &workers[i]);
+        }
+        if (workers[i].bs) {
+            bistack_destroy(workers[i].bs);
+        }
+    }
+
+    if (error != 0) {
+        lerror(error, PSTR("reader_read_parallel"));
+    }
+    return root;
+}
+
+
+#ifdef READER_PARALLEL_TEST
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static char *read_file(char *filename, size_t *len) {
+    FILE *file = fopen(filename, "rb");
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *buffer = malloc(*len);
+    fread(buffer, *len, 1, file);
+    fclose(file);
+    return buffer;
+}
+
+static READER *new_test_reader() {
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    ENVIRONMENT *environment = environment_new(bs);
+    return reader_new(environment);
+}
+
+static char *test_split_forms() {
+    char source[] = (
+        "(a \")\" b) ; (\n"
+        "c \"x\\\"(\" d\\( '(e (f))\n"
+        "; trailing comment )");
+    size_t ends[16];
+    uint8_t nchunks = reader_split_forms(source, strlen(source), ends, 16);
+
+    mu_assert("wrong number of chunks", nchunks == 6);
+    mu_assert("string paren closed form", ends[0] == strlen("(a \")\" b)"));
+    mu_assert("comment not skipped",
+        source[ends[1] - 1] == 'c' && source[ends[1]] == ' ');
+    mu_assert("escaped quote ended string", source[ends[2] - 1] == '"');
+    mu_assert("escaped paren ended symbol", source[ends[3] - 1] == '(');
+    mu_assert("prefixed list not one form", source[ends[4] - 1] == ')');
+    mu_assert("last chunk not at end", ends[5] == strlen(source));
+
+    // a carriage return is part of an atom, as it is to the reader
+    nchunks = reader_split_forms("ab\rcd e", 7, ends, 16);
+    mu_assert("carriage return ended atom", ends[0] == 5);
+
+    // a '"' within a symbol does not start a string, nor does '(' a list
+    nchunks = reader_split_forms("abc\"d e\" f(g h", 13, ends, 16);
+    mu_assert("quote in symbol started string", ends[0] == 5);
+    mu_assert("symbol ending in quote not a form", ends[1] == 8);
+    mu_assert("paren in symbol opened list", ends[2] == 12 && ends[3] == 13);
+
+    // an integer ends at its first non-digit, which may start a string
+    nchunks = reader_split_forms("12\"a b\" 0-5 x", 13, ends, 16);
+    mu_assert("integer not ended by quote", ends[0] == 2 && ends[1] == 7);
+    mu_assert("signed zero ended integer", ends[2] == 11);
+
+    // a '"' before the first character of a string does not close it
+    nchunks = reader_split_forms("\"\" a\" b", 7, ends, 16);
+    mu_assert("empty string closed", ends[0] == 5);
+    return 0;
+}
+
+static char *source_getc_buffer;
+static size_t source_getc_len;
+static size_t source_getc_pos;
+
+static char source_getc(void *streamobj) {
+    if (source_getc_pos < source_getc_len) {
+        return source_getc_buffer[source_getc_pos++];
+    } else if (source_getc_pos++ == source_getc_len) {
+        return '\n';
+    }
+    return -1;
+}
+
+static READER *read_sequential(char *source, size_t len) {
+    // the oracle: one plain reader_read, no splitting or appending
+    READER *reader = new_test_reader();
+    source_getc_buffer = source;
+    source_getc_len = len;
+    source_getc_pos = 0;
+    reader_set_getc(reader, source_getc, NULL);
+    reader_read(reader);
+    return reader;
+}
+
+static char *check_matches_sequential(char *source, size_t len) {
+    READER *sequential = read_sequential(source, len);
+    CELLHEADER *expected = sequential->reader_context->cellheader;
+    size_t expected_len = (
+        (char*)sequential->environment->bs->forwardptr - (char*)expected);
+
+    for (uint8_t nthreads=1; nthreads<=8; nthreads++) {
+        READER *parallel = new_test_reader();
+        reader_read_parallel(parallel, source, len, nthreads);
+        CELLHEADER *got = parallel->reader_context->cellheader;
+        size_t got_len = (
+            (char*)parallel->environment->bs->forwardptr - (char*)got);
+        mu_assert("parallel read length differs", got_len == expected_len);
+        mu_assert("parallel read differs",
+            memcmp(got, expected, expected_len) == 0);
+        bistack_destroy(parallel->environment->bs);
+    }
+    bistack_destroy(sequential->environment->bs);
+    return 0;
+}
+
+static char *test_parallel_matches_sequential() {
+    size_t len;
+    char *source = read_file("tests/samples/sample2.lisp", &len);
+    char *result = check_matches_sequential(source, len);
+    free(source);
+    if (result) {
+        return result;
+    }
+
+    char atoms[] = (
+        "abc\"d e\" f(g h 12\"a b\" 0-5 x \"\" a\" (i \"j)\" k\\ l) m\n");
+    return check_matches_sequential(atoms, strlen(atoms));
+}
+
+static char *test_deep_forms() {
+    // the reader contexts of deeply nested lists outgrow the first stack
+    char source[1024];
+    size_t len = 0;
+    for (int form=0; form<4; form++) {
+        for (int i=0; i<100; i++) {
+            source[len++] = '(';
+        }
+        source[len++] = 'a';
+        for (int i=0; i<100; i++) {
+            source[len++] = ')';
+        }
+        source[len++] = '\n';
+    }
+
+    READER *sequential = new_test_reader();
+    reader_read_parallel(sequential, source, len, 1);
+    CELLHEADER *expected = sequential->reader_context->cellheader;
+    READER *parallel = new_test_reader();
+    reader_read_parallel(parallel, source, len, 4);
+    CELLHEADER *got = parallel->reader_context->cellheader;
+    mu_assert("deep forms not read", cell_list_length(got) == 4);
+    mu_assert("deep forms differ", memcmp(
+        got, expected,
+        (char*)sequential->environment->bs->forwardptr - (char*)expected) == 0);
+    bistack_destroy(parallel->environment->bs);
+    bistack_destroy(sequential->environment->bs);
+    return 0;
+}
+
+static char *test_worker_error_rethrown() {
+    char source[] = "(a b) (c d) (e (f";
+    READER *reader = new_test_reader();
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        reader_read_parallel(reader, source, strlen(source), 3);
+        mu_assert("unclosed list not reported", 0);
+    } else {
+        mu_assert("wrong error", exctype == READER_SYNTAX_ERROR);
+    }
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_split_forms);
+    mu_run_test(test_parallel_matches_sequential);
+    mu_run_test(test_deep_forms);
+    mu_run_test(test_worker_error_rethrown);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
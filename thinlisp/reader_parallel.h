@@ -0,0 +1,37 @@
+#ifndef READER_PARALLEL_H
+#define READER_PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "reader.h"
+
+#define READER_PARALLEL_MAX_THREADS 16
+
+/**
+ * Splits a source buffer into at most nchunks pieces which each end on a
+ * top-level form boundary.  Strings, comments and escaped characters are
+ * respected so a ')' inside "..." or after ';' never closes a form.
+ * @param[in] buffer The source text
+ * @param[in] len The length of buffer
+ * @param[out] chunk_ends Receives the end offset of each chunk
+ * @param[in] nchunks The maximum number of chunks to produce
+ * @return The number of chunks written to chunk_ends
+ */
+uint8_t reader_split_forms(
+    const char *buffer, size_t len, size_t *chunk_ends, uint8_t nchunks);
+
+/**
+ * Reads every form in buffer using up to nthreads worker threads.  Each
+ * worker reads its chunk into its own bistack, then the resulting cells are
+ * appended in source order to the root list of reader.
+ * The reader must not be part way through a form.
+ * @param[in] reader The reader whose root list receives the forms
+ * @param[in] buffer The source text
+ * @param[in] len The length of buffer
+ * @param[in] nthreads The number of worker threads to use
+ * @return The root list of reader
+ */
+CELLHEADER *reader_read_parallel(
+    READER *reader, const char *buffer, size_t len, uint8_t nthreads);
+
+#endif
@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "ringbuf.h"
+
+RINGBUF *ringbuf_init(RINGBUF *rb, char *buffer, ringbuf_index_t size) {
+  lassert(
+    size > 0 && size <= RINGBUF_MAX_SIZE && (size & (size - 1)) == 0,
+    RINGBUF_SIZE_ERROR);
+  rb->buffer = buffer;
+  rb->mask = size - 1;
+  rb->head = 0;
+  rb->tail = 0;
+  rb->overruns = 0;
+  return rb;
+}
+
+ringbuf_index_t ringbuf_write(
+    RINGBUF *rb, const char *data, ringbuf_index_t len) {
+  ringbuf_index_t head = rb->head;
+  ringbuf_index_t space = (
+    rb->mask + 1 - (ringbuf_index_t)(head - RINGBUF_LOAD(rb->tail)));
+  if (len > space) {
+    rb->overruns += len - space;
+    len = space;
+  }
+
+  // copy up to the end of the buffer, then wrap to its start
+  ringbuf_index_t start = head & rb->mask;
+  ringbuf_index_t first = rb->mask + 1 - start;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(&rb->buffer[start], data, first);
+  memcpy(rb->buffer, data + first, len - first);
+
+  // publish the characters only after they are in place
+  RINGBUF_STORE(rb->head, (ringbuf_index_t)(head + len));
+  return len;
+}
+
+ringbuf_index_t ringbuf_read(RINGBUF *rb, char *dest, ringbuf_index_t len) {
+  ringbuf_index_t tail = rb->tail;
+  ringbuf_index_t count = (ringbuf_index_t)(RINGBUF_LOAD(rb->head) - tail);
+  if (len > count) {
+    len = count;
+  }
+
+  ringbuf_index_t start = tail & rb->mask;
+  ringbuf_index_t first = rb->mask + 1 - start;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(dest, &rb->buffer[start], first);
+  memcpy(dest + first, rb->buffer, len - first);
+
+  // hand the space back to the producer only after copying out
+  RINGBUF_STORE(rb->tail, (ringbuf_index_t)(tail + len));
+  return len;
+}
+
+char ringbuf_getc(void *streamobj) {
+  RINGBUF *rb = (RINGBUF*)streamobj;
+  ringbuf_index_t tail = rb->tail;
+  if (tail == RINGBUF_LOAD(rb->head)) {
+    return -1;
+  }
+  char c = rb->buffer[tail & rb->mask];
+  RINGBUF_STORE(rb->tail, (ringbuf_index_t)(tail + 1));
+  return c;
+}
+
+
+#ifdef RINGBUF_TEST
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include "reader.h"
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+#define STRESS_COUNT 2000000
+
+static char pattern(uint32_t i) {
+  return 'a' + i % 23;
+}
+
+static void *stress_producer(void *rb_void) {
+  RINGBUF *rb = (RINGBUF*)rb_void;
+  char chunk[37];
+  uint32_t i = 0;
+  while (i < STRESS_COUNT) {
+    if (i % 3 == 0) {
+      // single character path, as an interrupt would use
+      if (ringbuf_put(rb, pattern(i))) {
+        i++;
+      } else {
+        sched_yield();
+      }
+    } else {
+      ringbuf_index_t len = sizeof(chunk);
+      if (len > STRESS_COUNT - i) {
+        len = STRESS_COUNT - i;
+      }
+      for (ringbuf_index_t j=0; j<len; j++) {
+        chunk[j] = pattern(i + j);
+      }
+      ringbuf_index_t written = ringbuf_write(rb, chunk, len);
+      if (written == 0) {
+        sched_yield();
+      }
+      i += written;
+    }
+  }
+  return NULL;
+}
+
+static char *test_wraparound() {
+  char buffer[8];
+  char out[8];
+  RINGBUF rb;
+  ringbuf_init(&rb, buffer, sizeof(buffer));
+
+  for (int round=0; round<40; round++) {
+    mu_assert("write short", ringbuf_write(&rb, "abcde", 5) == 5);
+    mu_assert("count wrong", ringbuf_count(&rb) == 5);
+    mu_assert("read short", ringbuf_read(&rb, out, 3) == 3);
+    mu_assert("wrong data", memcmp(out, "abc", 3) == 0);
+    mu_assert("getc wrong", ringbuf_getc(&rb) == 'd');
+    mu_assert("getc wrong", ringbuf_getc(&rb) == 'e');
+    mu_assert("getc on empty", ringbuf_getc(&rb) == -1);
+  }
+
+  mu_assert("overfilled", ringbuf_write(&rb, "0123456789", 10) == 8);
+  mu_assert("overrun not counted", rb.overruns == 2);
+  mu_assert("put into full ring", !ringbuf_put(&rb, 'x'));
+  return 0;
+}
+
+static char *test_stress_threaded() {
+  static char buffer[64];
+  RINGBUF rb;
+  ringbuf_init(&rb, buffer, sizeof(buffer));
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, stress_producer, &rb);
+
+  char chunk[29];
+  uint32_t i = 0;
+  while (i < STRESS_COUNT) {
+    if (i % 2) {
+      char c = ringbuf_getc(&rb);
+      if (c != -1) {
+        mu_assert("getc out of order", c == pattern(i));
+        i++;
+      } else {
+        sched_yield();
+      }
+    } else {
+      ringbuf_index_t len = ringbuf_read(&rb, chunk, sizeof(chunk));
+      for (ringbuf_index_t j=0; j<len; j++) {
+        mu_assert("read out of order", chunk[j] == pattern(i + j));
+      }
+      if (len == 0) {
+        sched_yield();
+      }
+      i += len;
+    }
+  }
+  pthread_join(producer, NULL);
+  mu_assert("characters left over", ringbuf_count(&rb) == 0);
+  return 0;
+}
+
+static void *source_producer(void *rb_void) {
+  RINGBUF *rb = (RINGBUF*)rb_void;
+  const char *source = "(defun f (x) (g x \"(str)\" 12)) (h)\n";
+  for (int repeat=0; repeat<200; repeat++) {
+    for (const char *c=source; *c; ) {
+      if (ringbuf_put(rb, *c)) {
+        c++;
+      } else {
+        sched_yield();
+      }
+    }
+  }
+  return NULL;
+}
+
+static void count_form(void *streamobj, CELLHEADER *form) {
+  (*(int*)streamobj)++;
+}
+
+static char *test_reader_from_thread() {
+  static char buffer[16];
+  RINGBUF rb;
+  ringbuf_init(&rb, buffer, sizeof(buffer));
+
+  BISTACK *bs = bistack_new(1<<14);
+  bistack_pushdir(bs, BS_BACKWARD);
+  READER *reader = reader_new(environment_new(bs));
+  int forms = 0;
+  reader_set_getc(reader, ringbuf_getc, &rb);
+  reader_set_form_ready(reader, count_form, &forms);
+
+  pthread_t producer;
+  pthread_create(&producer, NULL, source_producer, &rb);
+  while (forms < 400) {
+    reader_read(reader);
+    sched_yield();
+  }
+  pthread_join(producer, NULL);
+  mu_assert("too many forms", forms == 400);
+  bistack_destroy(bs);
+  return 0;
+}
+
+static char *all_tests() {
+  mu_run_test(test_wraparound);
+  mu_run_test(test_stress_threaded);
+  mu_run_test(test_reader_from_thread);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
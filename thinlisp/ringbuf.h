@@ -0,0 +1,100 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+#include "defines.h"
+
+/*
+ * A lock-free single-producer/single-consumer byte ring.  The producer (a
+ * UART receive interrupt or an I/O thread) only writes head and overruns,
+ * the consumer (the reader) only writes tail, so neither side needs a lock.
+ * Indices run freely and are masked on access; the size must be a power of
+ * two no larger than half the index range.
+ */
+#ifdef ARDUINO
+// single byte indices are read and written atomically by the AVR, and the
+// compiler barriers keep the characters' accesses on the right side of them
+typedef uint8_t ringbuf_index_t;
+
+static inline ringbuf_index_t ringbuf_load(volatile ringbuf_index_t *x) {
+    ringbuf_index_t value = *x;
+    __asm__ volatile("" ::: "memory");
+    return value;
+}
+
+static inline void ringbuf_store(
+        volatile ringbuf_index_t *x, ringbuf_index_t value) {
+    __asm__ volatile("" ::: "memory");
+    *x = value;
+}
+
+#define RINGBUF_LOAD(X) ringbuf_load(&(X))
+#define RINGBUF_STORE(X, V) ringbuf_store(&(X), (V))
+#else
+typedef uint16_t ringbuf_index_t;
+#define RINGBUF_LOAD(X) __atomic_load_n(&(X), __ATOMIC_ACQUIRE)
+#define RINGBUF_STORE(X, V) __atomic_store_n(&(X), (V), __ATOMIC_RELEASE)
+#endif
+
+#define RINGBUF_MAX_SIZE (((ringbuf_index_t)-1 >> 1) + 1)
+
+typedef struct ringbuf {
+    char *buffer;
+    ringbuf_index_t mask;
+
+    // next position written by the producer
+    volatile ringbuf_index_t head;
+    // next position read by the consumer
+    volatile ringbuf_index_t tail;
+
+    // characters the producer dropped because the ring was full
+    volatile uint16_t overruns;
+} RINGBUF;
+
+/**
+ * Initializes a ring over buffer.
+ * @param[out] rb The ring to initialize
+ * @param[in] buffer Storage for the ring's characters
+ * @param[in] size The size of buffer, a power of two up to RINGBUF_MAX_SIZE
+ * @return rb
+ */
+RINGBUF *ringbuf_init(RINGBUF *rb, char *buffer, ringbuf_index_t size);
+
+/**
+ * Producer side: writes up to len characters from data.
+ * @return The number of characters written, less than len if the ring filled
+ */
+ringbuf_index_t ringbuf_write(RINGBUF *rb, const char *data, ringbuf_index_t len);
+
+/**
+ * Consumer side: moves up to len characters into dest.
+ * @return The number of characters read
+ */
+ringbuf_index_t ringbuf_read(RINGBUF *rb, char *dest, ringbuf_index_t len);
+
+/**
+ * Consumer side: a getc for reader_set_getc with the ring as its streamobj.
+ * @return The next character, or -1 if the ring is empty
+ */
+char ringbuf_getc(void *rb);
+
+static inline ringbuf_index_t ringbuf_count(RINGBUF *rb) {
+    return (ringbuf_index_t)(RINGBUF_LOAD(rb->head) - RINGBUF_LOAD(rb->tail));
+}
+
+/**
+ * Producer side: writes a single character, safe to call from an interrupt.
+ * @return FALSE if the ring was full and c was dropped
+ */
+static inline char ringbuf_put(RINGBUF *rb, char c) {
+    ringbuf_index_t head = rb->head;
+    if ((ringbuf_index_t)(head - RINGBUF_LOAD(rb->tail)) > rb->mask) {
+        rb->overruns++;
+        return FALSE;
+    }
+    rb->buffer[head & rb->mask] = c;
+    RINGBUF_STORE(rb->head, (ringbuf_index_t)(head + 1));
+    return TRUE;
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include <string.h>
+
+#include "defines.h"
+#include "tlc.h"
+#include "rom.h"
+
+
+int16_t rom_findsymbol(const char *name, uint8_t length, ROM_SYMBOL *symbol) {
+    ROM_SYMBOL entry;
+    int16_t low = 0;
+    int16_t high = rom_nsymbols - 1;
+    while (low <= high) {
+        int16_t mid = (low + high) >> 1;
+        memcpy_P(&entry, &rom_symbols[mid], sizeof(entry));
+        int c = rom_compare(name, length, entry.name, entry.length);
+        if (c == 0) {
+            if (symbol) {
+                *symbol = entry;
+            }
+            return mid;
+        } else if (c < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+
+uint8_t rom_findbuiltin(const char *name, uint8_t length, uint8_t hash) {
+    ROM_SYMBOL entry;
+    uint8_t builtin;
+    memcpy_P(&builtin, &rom_builtin_slots[hash], sizeof(builtin));
+    if (builtin == ROM_NOT_BUILTIN) {
+        return ROM_NOT_BUILTIN;
+    }
+    memcpy_P(&entry, &rom_builtins[builtin], sizeof(entry));
+    if (rom_compare(name, length, entry.name, entry.length) != 0) {
+        return ROM_NOT_BUILTIN;
+    }
+    return builtin;
+}
+
+
+char rom_check() {
+    CELLHEADER probe;
+    memcpy_P(&probe, rom_probe, sizeof(probe));
+    return memcmp(&probe, &TLC_PROBE, sizeof(probe)) == 0;
+}
+
+
+#ifdef ROM_TEST
+#include <stdio.h>
+#include "utils.h"
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static const char *builtin_names[] = { BUILTIN_NAMES(BUILTIN_NAME_STRING) };
+
+static char * test_symbols() {
+    ROM_SYMBOL symbol;
+    for (uint8_t i=0; i<BUILTIN_COUNT; i++) {
+        const char *name = builtin_names[i];
+        mu_assert("builtin missing",
+            rom_findsymbol(name, strlen(name), &symbol) >= 0);
+        mu_assert("wrong builtin index", symbol.builtin == i);
+        mu_assert("wrong hash",
+            symbol.hash == hashstr_8((char*)name, strlen(name)));
+    }
+
+    // the prelude's own symbols are interned too, and names are not prefixes
+    mu_assert("prelude symbol missing",
+        rom_findsymbol("caar", 4, &symbol) >= 0);
+    mu_assert("prelude symbol is a builtin",
+        symbol.builtin == ROM_NOT_BUILTIN);
+    mu_assert("prefix found", rom_findsymbol("ca", 2, NULL) == -1);
+    mu_assert("unterminated name not found",
+        rom_findsymbol("carx", 3, &symbol) >= 0 && symbol.length == 3);
+    mu_assert("unknown symbol found", rom_findsymbol("zzz", 3, NULL) == -1);
+
+    for (uint16_t i=1; i<rom_nsymbols; i++) {
+        mu_assert("symbols not sorted", rom_compare(
+            rom_symbols[i - 1].name, rom_symbols[i - 1].length,
+            rom_symbols[i].name, rom_symbols[i].length) < 0);
+    }
+    return 0;
+}
+
+
+static char * test_builtins() {
+    for (uint8_t i=0; i<BUILTIN_COUNT; i++) {
+        const char *name = builtin_names[i];
+        uint8_t length = strlen(name);
+        mu_assert("builtin not recognized", rom_findbuiltin(
+            name, length, rom_builtin_hash(name, length)) == i);
+
+        // the hash kept up a character at a time is the same
+        uint8_t hash = rom_builtin_seed;
+        for (uint8_t j=0; j<length; j++) {
+            hash = hashstr_8_step(hash, name[j]);
+        }
+        mu_assert("incremental hash differs",
+            hash == rom_builtin_hash(name, length));
+    }
+
+    // every other symbol lands in an empty slot or fails the compare
+    for (uint16_t i=0; i<rom_nsymbols; i++) {
+        const ROM_SYMBOL *symbol = &rom_symbols[i];
+        mu_assert("wrong builtin found", rom_findbuiltin(
+            symbol->name, symbol->length,
+            rom_builtin_hash(symbol->name, symbol->length)) ==
+            symbol->builtin);
+    }
+    mu_assert("prefix recognized",
+        rom_findbuiltin("co", 2, rom_builtin_hash("co", 2)) ==
+        ROM_NOT_BUILTIN);
+    return 0;
+}
+
+
+static char * test_forms() {
+    mu_assert("wrong layout", rom_check());
+    mu_assert("no forms", rom_nforms > 0);
+
+    // the forms are complete cells, whose symbols are all interned
+    CELL_WALK walk;
+    CELLHEADER *cell;
+    cell_walk_init(&walk, (CELLHEADER*)rom_forms, rom_nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        if (cell->Symbol.type == AST_SYMBOL &&
+                cell->Symbol.prefix != AST_DOUBLEQUOTE) {
+            mu_assert("symbol not interned", rom_findsymbol(
+                (char*)&cell[1], cell->Symbol.length, NULL) >= 0);
+        }
+    }
+    mu_assert("wrong forms length",
+        (uint8_t*)walk.next - rom_forms == rom_forms_len);
+    return 0;
+}
+
+
+static char *all_tests() {
+    mu_run_test(test_symbols);
+    mu_run_test(test_builtins);
+    mu_run_test(test_forms);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "defines.h"
+#include "utils.h"
+#include "cell.h"
+#include "builtin_names.h"
+
+/*
+ * The standard library as built into the firmware.  romgen reads the
+ * prelude on the host and writes a C source defining the tables below, all
+ * in program memory, so the firmware boots with the builtins and the
+ * prelude's symbols already interned and its forms already read:
+ *
+ *   rom_symbols  every symbol of the builtins and the prelude, sorted by
+ *                rom_compare so they can be searched in place
+ *   rom_forms    the prelude's forms, as cells laid out by the reader
+ *
+ * Cells are stored as the host lays them out; rom_check compares the
+ * generator's TLC_PROBE with the firmware's before the forms are used.
+ */
+#define ROM_NOT_BUILTIN 0xff
+
+typedef struct rom_symbol {
+  // in program memory, length characters and a terminator
+  const char *name;
+  uint8_t length;
+  // hashstr_8 of the name, as in a symbol cell
+  uint8_t hash;
+  // the symbol's index in BUILTIN_NAMES, or ROM_NOT_BUILTIN
+  uint8_t builtin;
+} ROM_SYMBOL;
+
+extern const ROM_SYMBOL rom_symbols[] PROGMEM;
+extern const uint16_t rom_nsymbols;
+extern const uint8_t rom_forms[] PROGMEM;
+extern const uint16_t rom_forms_len;
+extern const uint16_t rom_nforms;
+extern const uint8_t rom_probe[] PROGMEM;
+
+/*
+ * Builtins are recognized with a perfect hash.  romgen picks a seed for
+ * which hashstr_8_step, started from the seed, sends every builtin name to
+ * its own slot, so a name is a builtin only if it equals the one builtin in
+ * its slot.  The hash can be kept up as a name is read, see rom_findbuiltin.
+ */
+#define ROM_BUILTIN_SLOTS 256
+
+extern const uint8_t rom_builtin_seed;
+// the builtin index of each slot, or ROM_NOT_BUILTIN
+extern const uint8_t rom_builtin_slots[ROM_BUILTIN_SLOTS] PROGMEM;
+// the entry of each builtin, in BUILTIN_NAMES order
+extern const ROM_SYMBOL rom_builtins[BUILTIN_COUNT] PROGMEM;
+
+/**
+ * The order of rom_symbols.
+ * @param[in] name A name in RAM
+ * @param[in] rom_name A name in program memory
+ * @return Less than, equal to or greater than 0 as name sorts before, with
+ *     or after rom_name
+ */
+static inline int rom_compare(
+    const char *name, uint8_t length, const char *rom_name, uint8_t rom_length) {
+  int c = strncmp_P(name, rom_name, length < rom_length ? length : rom_length);
+  return c ? c : (int)length - rom_length;
+}
+
+/**
+ * Looks a name up in rom_symbols with a binary search.
+ * @param[in] name The name, not necessarily terminated
+ * @param[in] length The length of name
+ * @param[out] symbol Receives the symbol's entry if found, or may be NULL
+ * @return The symbol's index in rom_symbols, or -1 if it is not there
+ */
+int16_t rom_findsymbol(const char *name, uint8_t length, ROM_SYMBOL *symbol);
+
+/**
+ * @return The perfect hash of name, for rom_findbuiltin
+ */
+static inline uint8_t rom_builtin_hash(const char *name, uint8_t length) {
+  uint8_t hash = rom_builtin_seed;
+  for (uint8_t i=0; i<length; i++) {
+    hash = hashstr_8_step(hash, name[i]);
+  }
+  return hash;
+}
+
+/**
+ * Recognizes a builtin with one slot lookup and one compare.
+ * @param[in] name The name, not necessarily terminated
+ * @param[in] length The length of name
+ * @param[in] hash rom_builtin_hash of name, or hashstr_8_step applied to
+ *     each of its characters from rom_builtin_seed
+ * @return The builtin's index in BUILTIN_NAMES, or ROM_NOT_BUILTIN
+ */
+uint8_t rom_findbuiltin(const char *name, uint8_t length, uint8_t hash);
+
+/**
+ * @return TRUE if rom_forms were generated for this build's cell layout
+ */
+char rom_check();
+
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "utils.h"
+#include "bistack.h"
+#include "cell.h"
+#include "tlc.h"
+#include "rom.h"
+#include "romgen.h"
+
+typedef struct romgen_symbol {
+    const char *name;
+    uint8_t length;
+    uint8_t builtin;
+} ROMGEN_SYMBOL;
+
+static const char *romgen_builtin_names[] = {
+    BUILTIN_NAMES(BUILTIN_NAME_STRING)
+};
+
+
+static int romgen_symbol_cmp(const void *a, const void *b) {
+    const ROMGEN_SYMBOL *x = a;
+    const ROMGEN_SYMBOL *y = b;
+    return rom_compare(x->name, x->length, y->name, y->length);
+}
+
+
+static uint16_t romgen_add_symbol(
+        ROMGEN_SYMBOL *symbols,
+        uint16_t nsymbols,
+        const char *name,
+        uint8_t length,
+        uint8_t builtin) {
+    /**
+     * Appends name unless it is already in symbols.
+     * @return The new number of symbols
+     */
+    for (uint16_t i=0; i<nsymbols; i++) {
+        if (rom_compare(
+                name, length, symbols[i].name, symbols[i].length) == 0) {
+            return nsymbols;
+        }
+    }
+    symbols[nsymbols].name = name;
+    symbols[nsymbols].length = length;
+    symbols[nsymbols].builtin = builtin;
+    return nsymbols + 1;
+}
+
+
+static void romgen_write_string(FILE *out, const char *str, uint8_t length) {
+    fputc('"', out);
+    for (uint8_t i=0; i<length; i++) {
+        if (str[i] == '"' || str[i] == '\\') {
+            fprintf(out, "\\%c", str[i]);
+        } else if (str[i] < ' ' || str[i] > '~') {
+            fprintf(out, "\\%03o", (uint8_t)str[i]);
+        } else {
+            fputc(str[i], out);
+        }
+    }
+    fputc('"', out);
+}
+
+
+static void romgen_write_bytes(FILE *out, const uint8_t *bytes, size_t len) {
+    for (size_t i=0; i<len; i++) {
+        fprintf(out, "%s0x%02x,", i % 12 ? " " : "\n  ", bytes[i]);
+    }
+    fputc('\n', out);
+}
+
+
+static char romgen_builtin_seed(uint8_t *seed, uint8_t *slots) {
+    /**
+     * Finds the first seed for which no two builtins share a slot.
+     * @param[out] seed Receives the seed
+     * @param[out] slots Receives the builtin of each slot
+     * @return FALSE if there is no such seed
+     */
+    for (uint16_t s=0; s<256; s++) {
+        memset(slots, ROM_NOT_BUILTIN, ROM_BUILTIN_SLOTS);
+        uint8_t i;
+        for (i=0; i<BUILTIN_COUNT; i++) {
+            uint8_t hash = s;
+            for (const char *c=romgen_builtin_names[i]; *c; c++) {
+                hash = hashstr_8_step(hash, *c);
+            }
+            if (slots[hash] != ROM_NOT_BUILTIN) {
+                break;
+            }
+            slots[hash] = i;
+        }
+        if (i == BUILTIN_COUNT) {
+            *seed = s;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+void romgen_write(BISTACK *bs, FILE *out, CELLHEADER *forms, uint16_t nforms) {
+    void *start_mark = bistack_mark(bs);
+
+    // room for every builtin and symbol cell, the bound on distinct names
+    CELL_WALK walk;
+    CELLHEADER *cell;
+    uint16_t capacity = BUILTIN_COUNT;
+    cell_walk_init(&walk, forms, nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        capacity += cell->Symbol.type == AST_SYMBOL;
+    }
+    size_t forms_len = (uint8_t*)walk.next - (uint8_t*)forms;
+    lassert(forms_len <= UINT16_MAX, CELL_OVERFLOW_ERROR);
+    ROMGEN_SYMBOL *symbols = bistack_alloc(
+        bs, capacity * sizeof(ROMGEN_SYMBOL));
+
+    uint16_t nsymbols = 0;
+    for (uint8_t i=0; i<BUILTIN_COUNT; i++) {
+        nsymbols = romgen_add_symbol(
+            symbols, nsymbols,
+            romgen_builtin_names[i], strlen(romgen_builtin_names[i]), i);
+    }
+    cell_walk_init(&walk, forms, nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        if (cell->Symbol.type == AST_SYMBOL &&
+                cell->Symbol.prefix != AST_DOUBLEQUOTE) {
+            nsymbols = romgen_add_symbol(
+                symbols, nsymbols,
+                (char*)&cell[1], cell->Symbol.length, ROM_NOT_BUILTIN);
+        }
+    }
+    qsort(symbols, nsymbols, sizeof(ROMGEN_SYMBOL), romgen_symbol_cmp);
+
+    fprintf(out, "/* Generated by romgen, do not edit. */\n");
+    fprintf(out, "#include \"rom.h\"\n\n");
+    for (uint16_t i=0; i<nsymbols; i++) {
+        fprintf(out, "static const char rom_name_%u[] PROGMEM = ", i);
+        romgen_write_string(out, symbols[i].name, symbols[i].length);
+        fprintf(out, ";\n");
+    }
+
+    fprintf(out, "\nconst ROM_SYMBOL rom_symbols[] PROGMEM = {\n");
+    for (uint16_t i=0; i<nsymbols; i++) {
+        fprintf(out, "  { rom_name_%u, %u, 0x%02x, %u },\n",
+            i, symbols[i].length,
+            hashstr_8((char*)symbols[i].name, symbols[i].length),
+            symbols[i].builtin);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "const uint16_t rom_nsymbols = %u;\n\n", nsymbols);
+
+    uint8_t seed;
+    uint8_t slots[ROM_BUILTIN_SLOTS];
+    lassert(romgen_builtin_seed(&seed, slots), CELL_OVERFLOW_ERROR);
+    fprintf(out, "const uint8_t rom_builtin_seed = %u;\n", seed);
+    fprintf(out, "const uint8_t rom_builtin_slots[] PROGMEM = {");
+    romgen_write_bytes(out, slots, ROM_BUILTIN_SLOTS);
+    fprintf(out, "};\n");
+    fprintf(out, "const ROM_SYMBOL rom_builtins[] PROGMEM = {\n");
+    for (uint8_t i=0; i<BUILTIN_COUNT; i++) {
+        uint16_t j = 0;
+        while (symbols[j].builtin != i) {
+            j++;
+        }
+        fprintf(out, "  { rom_name_%u, %u, 0x%02x, %u },\n",
+            j, symbols[j].length,
+            hashstr_8((char*)symbols[j].name, symbols[j].length), i);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const uint8_t rom_forms[] PROGMEM = {");
+    romgen_write_bytes(out, (uint8_t*)forms, forms_len);
+    fprintf(out, "};\n");
+    fprintf(out, "const uint16_t rom_forms_len = %u;\n", (unsigned)forms_len);
+    fprintf(out, "const uint16_t rom_nforms = %u;\n\n", nforms);
+
+    // the host's layout of TLC_PROBE, for rom_check
+    fprintf(out, "const uint8_t rom_probe[] PROGMEM = {");
+    romgen_write_bytes(out, (uint8_t*)&TLC_PROBE, sizeof(TLC_PROBE));
+    fprintf(out, "};\n");
+
+    lassert(start_mark == bistack_rewind(bs), READER_STATE_ERROR);
+}
+
+
+#ifdef ROMGEN_MAIN
+#include "reader.h"
+
+static char filegetc(void *streamobj) {
+    int c = fgetc((FILE*)streamobj);
+    return c == EOF ? -1 : c;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s out.c prelude.lisp ...\n", argv[0]);
+        return 1;
+    }
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    reader_set_form_ready(reader, NULL, NULL);
+    reader_set_sized_lists(reader, TRUE);
+    for (int i=2; i<argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        reader_set_getc(reader, filegetc, file);
+        char is_complete = reader_read(reader);
+        fclose(file);
+        if (!is_complete) {
+            fprintf(stderr, " *** %s: unterminated form\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    CELLHEADER *root = reader->reader_context->cellheader;
+    romgen_write(bs, out, cell_list_first(root), cell_list_length(root));
+    fclose(out);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ROMGEN_H
+#define ROMGEN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "defines.h"
+#include "bistack.h"
+#include "cell.h"
+
+/*
+ * The host side of rom.h: writes the C source of a ROM image holding the
+ * builtins and the forms of a prelude.  Run as
+ *
+ *   romgen out.c prelude.lisp ...
+ */
+
+/**
+ * Writes a ROM image of the builtins and forms to out.
+ * @param[in] bs Temporary space for collecting the symbols
+ * @param[in] out The C source file to write
+ * @param[in] forms The first form, followed by the others
+ * @param[in] nforms The number of forms
+ */
+void romgen_write(BISTACK *bs, FILE *out, CELLHEADER *forms, uint16_t nforms);
+
+#endif
@@ -4,7 +4,7 @@
 #include "defines.h"
 #include "runtime.h"
 
-jmp_buf __jmpbuff;
+THREAD_LOCAL jmp_buf __jmpbuff;
 
 void lerror(uint16_t exctype, char *err, ...) {
   #ifndef LIMITED_ENVIRONMENT
@@ -19,12 +19,34 @@ enum {
   NVMEM_WRITE_ERROR,
   NVMEM_OUT_OF_MEMORY,
   NVMEM_ADDRESS_ERROR,
+  RINGBUF_SIZE_ERROR,
+  CELL_INDEX_ERROR,
+  CELL_OVERFLOW_ERROR,
+  TLC_IO_ERROR,
+  TLC_FORMAT_ERROR,
+  TLC_VERSION_ERROR,
+  TLC_CHECKSUM_ERROR,
+  CODECACHE_SIZE_ERROR,
+  ASTCODEC_FORMAT_ERROR,
+  SNAPSHOT_FORMAT_ERROR,
+  VALUE_TYPE_ERROR,
+  VALUE_RANGE_ERROR,
+  ARITH_DIVIDE_BY_ZERO,
+  ARITH_OVERFLOW_ERROR,
+  ARITH_ARITY_ERROR,
 };
 
 
 char *thrown_error_to_string(char err);
 
-extern jmp_buf __jmpbuff;
+// each host thread throws to its own setjmp point
+#ifdef ARDUINO
+#define THREAD_LOCAL
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+extern THREAD_LOCAL jmp_buf __jmpbuff;
 
 void lerror(uint16_t exctype, char *err, ...);
 void lassert(uint16_t truefalse, uint16_t exctype, ...);
@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "nvmem.h"
+#include "bistack.h"
+#include "snapshot.h"
+
+
+static void *snapshot_end(BISTACK *bs) {
+    /**
+     * bistack_init marks the backward stack first, so the end of the bistack
+     * is just past the mark which ends the backward chain.
+     */
+    void **mark = bs->backwardmark;
+    lassert(mark != NULL, SNAPSHOT_FORMAT_ERROR);
+    while (*mark) {
+        mark = *mark;
+    }
+    return (void*)mark + sizeof(void*);
+}
+
+
+static snapshot_offset_t snapshot_offset(BISTACK *bs, void *end, void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    } else if (ptr >= bs->backwardptr) {
+        return SNAPSHOT_BACKWARD | (snapshot_offset_t)(end - ptr);
+    }
+    return ptr - (void*)bs;
+}
+
+
+static void *snapshot_pointer(
+        BISTACK *bs, void *end, snapshot_offset_t offset) {
+    if (offset == 0) {
+        return NULL;
+    } else if (offset & SNAPSHOT_BACKWARD) {
+        return end - (offset & ~SNAPSHOT_BACKWARD);
+    }
+    return (void*)bs + offset;
+}
+
+
+static void snapshot_chain_to_offsets(BISTACK *bs, void *end, void **mark) {
+    while (mark) {
+        void **next = *mark;
+        *mark = (void*)snapshot_offset(bs, end, next);
+        mark = next;
+    }
+}
+
+
+static void snapshot_chain_to_pointers(BISTACK *bs, void *end, void **mark) {
+    while (mark) {
+        *mark = snapshot_pointer(bs, end, (snapshot_offset_t)*mark);
+        mark = *mark;
+    }
+}
+
+
+code_addr_t snapshot_save(BISTACK *bs, void ***roots, uint8_t nroots) {
+    void *end = snapshot_end(bs);
+    void *forward = (void*)bs + sizeof(BISTACK);
+    SNAPSHOT_HEADER header = {
+        .magic=SNAPSHOT_MAGIC,
+        .pointer_size=sizeof(void*),
+        .direction_stack=bs->direction_stack,
+        .forward_len=bs->forwardptr - forward,
+        .backward_len=end - bs->backwardptr,
+        .forwardmark=snapshot_offset(bs, end, bs->forwardmark),
+        .backwardmark=snapshot_offset(bs, end, bs->backwardmark),
+        .nroots=nroots
+    };
+
+    // claiming the space first means nothing below can run out of it
+    NVMEM_BLOCKWRITER writer;
+    nvmem_blockwriter_begin(
+        &writer,
+        sizeof(header) + nroots * sizeof(snapshot_offset_t) +
+        header.forward_len + header.backward_len);
+    nvmem_blockwriter_write(&writer, &header, sizeof(header));
+    for (uint8_t i=0; i<nroots; i++) {
+        snapshot_offset_t offset = snapshot_offset(bs, end, *roots[i]);
+        nvmem_blockwriter_write(&writer, &offset, sizeof(offset));
+    }
+
+    // the marks are relocated in place while the stacks are written
+    snapshot_chain_to_offsets(bs, end, bs->forwardmark);
+    snapshot_chain_to_offsets(bs, end, bs->backwardmark);
+    nvmem_blockwriter_write(&writer, forward, header.forward_len);
+    nvmem_blockwriter_write(&writer, bs->backwardptr, header.backward_len);
+    snapshot_chain_to_pointers(bs, end, bs->forwardmark);
+    snapshot_chain_to_pointers(bs, end, bs->backwardmark);
+    return nvmem_blockwriter_end(&writer);
+}
+
+
+BISTACK *snapshot_restore(
+        code_addr_t addr,
+        void *buffer,
+        size_t size,
+        void ***roots,
+        uint8_t nroots) {
+    SNAPSHOT_HEADER header;
+    code_addr_t pos = addr + NVMEM_BLOCK_HEADER;
+    code_addr_t block_end = addr + nvmem_blocksize(addr);
+    lassert(pos + sizeof(header) <= block_end, SNAPSHOT_FORMAT_ERROR);
+    nvmem_fetch(&header, pos, sizeof(header));
+    pos += sizeof(header);
+    lassert(
+        header.magic == SNAPSHOT_MAGIC &&
+        header.pointer_size == sizeof(void*) &&
+        header.nroots == nroots &&
+        pos + nroots * sizeof(snapshot_offset_t) +
+            header.forward_len + header.backward_len <= block_end &&
+        sizeof(BISTACK) + header.forward_len + header.backward_len <= size,
+        SNAPSHOT_FORMAT_ERROR);
+
+    BISTACK *bs = (BISTACK*)buffer;
+    void *end = buffer + size;
+    bs->forwardptr = buffer + sizeof(BISTACK) + header.forward_len;
+    bs->backwardptr = end - header.backward_len;
+    bs->direction_stack = header.direction_stack;
+
+    for (uint8_t i=0; i<nroots; i++) {
+        snapshot_offset_t offset;
+        nvmem_fetch(&offset, pos, sizeof(offset));
+        pos += sizeof(offset);
+        *roots[i] = snapshot_pointer(bs, end, offset);
+    }
+    nvmem_fetch(buffer + sizeof(BISTACK), pos, header.forward_len);
+    pos += header.forward_len;
+    nvmem_fetch(bs->backwardptr, pos, header.backward_len);
+
+    bs->forwardmark = snapshot_pointer(bs, end, header.forwardmark);
+    bs->backwardmark = snapshot_pointer(bs, end, header.backwardmark);
+    snapshot_chain_to_pointers(bs, end, bs->forwardmark);
+    snapshot_chain_to_pointers(bs, end, bs->backwardmark);
+    return bs;
+}
+
+
+#ifdef SNAPSHOT_TEST
+#include <stdio.h>
+#include <setjmp.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static char * test_restore() {
+    nvmem_initmem();
+    nvmem_init();
+    uint8_t heap[512];
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+    char *first = bistack_allocf(bs, 12);
+    strcpy(first, "first form");
+    bistack_markf(bs);
+    char *second = bistack_allocf(bs, 13);
+    strcpy(second, "second form");
+    bistack_markb(bs);
+    char *scratch = bistack_allocb(bs, 8);
+    strcpy(scratch, "scratch");
+    char *none = NULL;
+    void **roots[] = {
+        (void**)&first, (void**)&second, (void**)&scratch, (void**)&none};
+
+    code_addr_t addr = snapshot_save(bs, roots, 4);
+    mu_assert("saved marks damaged", strcmp(second, "second form") == 0);
+    bistack_rewindf(bs);
+    mu_assert("saved forward chain damaged", bs->forwardptr == second - 8);
+
+    // restored elsewhere and larger, as after a reboot
+    uint8_t other[600];
+    first = second = scratch = none = (char*)heap;
+    BISTACK *restored = snapshot_restore(addr, other, sizeof(other), roots, 4);
+    mu_assert("wrong forward root",
+        first == (char*)other + sizeof(BISTACK) + sizeof(void*));
+    mu_assert("forward data lost", strcmp(first, "first form") == 0);
+    mu_assert("second root lost", strcmp(second, "second form") == 0);
+    mu_assert("wrong backward root",
+        scratch == (char*)other + sizeof(other) - 2 * sizeof(void*) - 8);
+    mu_assert("backward data lost", strcmp(scratch, "scratch") == 0);
+    mu_assert("null root moved", none == NULL);
+
+    // the marks still rewind to where they were taken
+    mu_assert("wrong backward rewind",
+        bistack_rewindb(restored) == other + sizeof(other) - sizeof(void*));
+    bistack_rewindf(restored);
+    mu_assert("wrong forward rewind", restored->forwardptr == second - 8);
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        bistack_rewindf(restored);
+        mu_assert("rewound past the start", 0);
+    } else {
+        mu_assert("wrong rewind error", exctype == BISTACK_REWIND_TOO_FAR);
+    }
+    mu_assert("restored stack unusable",
+        bistack_allocf(restored, 4) == (void*)second - 8);
+    return 0;
+}
+
+
+static char * test_rejects() {
+    nvmem_initmem();
+    nvmem_init();
+    uint8_t heap[256];
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+    bistack_allocf(bs, 100);
+    code_addr_t addr = snapshot_save(bs, NULL, 0);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        snapshot_restore(addr, heap, 100, NULL, 0);
+        mu_assert("restored into too small a buffer", 0);
+    } else {
+        mu_assert("wrong error", exctype == SNAPSHOT_FORMAT_ERROR);
+    }
+
+    exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        snapshot_restore(nvmem_saveblock("not a snapshot", 14),
+            heap, sizeof(heap), NULL, 0);
+        mu_assert("restored a block which is not a snapshot", 0);
+    } else {
+        mu_assert("wrong error", exctype == SNAPSHOT_FORMAT_ERROR);
+    }
+    return 0;
+}
+
+
+static char *all_tests() {
+    mu_run_test(test_restore);
+    mu_run_test(test_rejects);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
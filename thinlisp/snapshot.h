@@ -0,0 +1,71 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "defines.h"
+#include "bistack.h"
+#include "nvmem.h"
+
+/*
+ * A snapshot saves the used ends of a bistack to one nvmem block, so a warm
+ * start restores the heap left by the init script with a single copy instead
+ * of reading and evaluating it again:
+ *
+ *   SNAPSHOT_HEADER | nroots * offset | forward bytes | backward bytes
+ *
+ * Pointers the snapshot knows about, the mark chains and the roots, are
+ * saved as offsets: from the start of the bistack for the forward stack, and
+ * from its end, with SNAPSHOT_BACKWARD set, for the backward stack.  A
+ * restored bistack may then be at another address or of another size.
+ * Cells are position independent, but any other pointer kept inside the
+ * stacks is only valid when the bistack is restored at the address it was
+ * saved from, as with a statically allocated heap.
+ */
+#define SNAPSHOT_MAGIC 0x534e
+
+// offsets are pointer sized, so marks can hold them while saving
+typedef uintptr_t snapshot_offset_t;
+#define SNAPSHOT_BACKWARD \
+  ((snapshot_offset_t)1 << (sizeof(snapshot_offset_t) * 8 - 1))
+
+typedef struct {
+  uint16_t magic;
+  // sizeof(void*) of the build which saved it, the size of a mark
+  uint8_t pointer_size;
+  uint8_t direction_stack;
+  snapshot_offset_t forward_len;
+  snapshot_offset_t backward_len;
+  snapshot_offset_t forwardmark;
+  snapshot_offset_t backwardmark;
+  uint8_t nroots;
+} SNAPSHOT_HEADER;
+
+/**
+ * Saves bs and the roots pointing into it.
+ * @param[in] bs The bistack to save
+ * @param[in] roots The locations, outside bs, of pointers into bs or NULL
+ * @param[in] nroots The number of roots
+ * @return The code address of the snapshot's block
+ */
+code_addr_t snapshot_save(BISTACK *bs, void ***roots, uint8_t nroots);
+
+/**
+ * Restores a snapshot into buffer, which becomes the bistack, and points
+ * each root at its saved place.  Throws SNAPSHOT_FORMAT_ERROR if the block
+ * is not a snapshot of this build, or does not fit in size.
+ * @param[in] addr The code address of the snapshot's block
+ * @param[out] buffer The memory for the bistack
+ * @param[in] size The size of buffer
+ * @param[in] roots The locations of the roots, in the order they were saved
+ * @param[in] nroots The number of roots, as saved
+ * @return The restored bistack
+ */
+BISTACK *snapshot_restore(
+    code_addr_t addr,
+    void *buffer,
+    size_t size,
+    void ***roots,
+    uint8_t nroots);
+
+#endif
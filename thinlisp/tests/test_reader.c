@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include "reader.h"
@@ -106,10 +107,56 @@ static char * test_reader_result(
 }
 
 /**
- * Verifies reader_pprint can be invoked successfully.
+ * Collects pprint output in memory, refusing every third character so the
+ * printer has to resume.
  */
-static char * test_reader_pprint(
-        char *test_lisp_file, char *expected_output) {
+struct pprint_output {
+  char buffer[1<<16];
+  int len;
+  int calls;
+};
+
+char memputc(void *streamobj_void, char c) {
+    struct pprint_output *streamobj = (struct pprint_output*)streamobj_void;
+    if (++streamobj->calls % 3 == 0 || streamobj->len >= sizeof(streamobj->buffer)) {
+        return FALSE;
+    }
+    streamobj->buffer[streamobj->len++] = c;
+    return TRUE;
+}
+
+char memgetc(void *streamobj_void) {
+    struct pprint_output *streamobj = (struct pprint_output*)streamobj_void;
+    if (streamobj->calls >= streamobj->len) {
+        return -1;
+    }
+    return streamobj->buffer[streamobj->calls++];
+}
+
+static char is_one_atom(const char *line, int len) {
+    /**
+     * A line holds one atom if its only spaces are inside a string.
+     */
+    char in_string = FALSE;
+    for (int i=0; i<len; i++) {
+        if (line[i] == '\\') {
+            i++;
+        } else if (line[i] == '"') {
+            in_string = !in_string;
+        } else if (line[i] == ' ' && !in_string) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Verifies reader_pprint output fits its width and reads back to the same
+ * cells.
+ */
+static char * check_pprint(
+        char *test_lisp_file, char *expected_output, char is_sized) {
+    static struct pprint_output output;
     struct file_with_eof_flag streamobj;
     streamobj.file = fopen(test_lisp_file, "rb");
     streamobj.characters_to_read = -1;
@@ -119,18 +166,126 @@ static char * test_reader_pprint(
     ENVIRONMENT *environment = environment_new(bs);
     READER *reader = reader_new(environment);
     reader_set_getc(reader, mygetc, &streamobj);
-    reader_set_putc(reader, myputc, NULL);
+    reader_set_putc(reader, memputc, &output);
+    reader_set_pprint_width(reader, 40);
+    reader_set_sized_lists(reader, is_sized);
     while (!feof(streamobj.file)) {
         bool res = reader_read(reader);
         mu_assert("reader should complete", res);
     }
-    reader_pprint(reader);
-    mu_assert(
-        "root cell type should be list",
-        reader->reader_context->cellheader->List.type == AST_LIST);
+    fclose(streamobj.file);
+
+    output.len = output.calls = 0;
+    void *forwardptr = bs->forwardptr;
+    while (!reader_pprint(reader));
+    mu_assert("pprint left allocations", bs->forwardptr == forwardptr);
+    mu_assert("pprint left a context", reader->pprint_context == NULL);
+
+    // only a line holding a single atom wider than the page may overflow
+    char *line = output.buffer;
+    for (int i=0; i<output.len; i++) {
+        if (output.buffer[i] != '\n') {
+            continue;
+        }
+        if (&output.buffer[i] - line > 40) {
+            while (*line == ' ') {
+                line++;
+            }
+            mu_assert("pprint line exceeds width",
+                is_one_atom(line, &output.buffer[i] - line));
+        }
+        line = &output.buffer[i + 1];
+    }
+
+    BISTACK *reread_bs = bistack_new(1<<18);
+    bistack_pushdir(reread_bs, BS_BACKWARD);
+    READER *reread = reader_new(environment_new(reread_bs));
+    output.calls = 0;
+    reader_set_getc(reread, memgetc, &output);
+    mu_assert("pprint output should read", reader_read(reread));
+    char *memory_check_res = memory_check(
+            (char*)reread->reader_context->cellheader, expected_output);
+    mu_assert(memory_check_res, memory_check_res == NULL);
+
+    bistack_destroy(reread_bs);
+    bistack_destroy(bs);
+    return 0;
+}
+
+/**
+ * Verifies forms nested deeper than READER_PPRINT_DEPTH print flat and read
+ * back to the same cells.
+ */
+static char * test_pprint_deep() {
+    static struct pprint_output output;
+    static char source[4096];
+    char *pos = source;
+    for (int i=0; i<100; i++) {
+        pos += sprintf(pos, i % 7 ? "(s%d " : "'(\"a b\" () ", i);
+    }
+    // long enough for an offset table when sized
+    pos += sprintf(pos, "(");
+    for (int i=0; i<40; i++) {
+        pos += sprintf(pos, " %d", i);
+    }
+    pos += sprintf(pos, ")");
+    // siblings opening lists again after those closed, across more chunks
+    for (int j=0; j<2; j++) {
+        for (int i=0; i<40; i++) {
+            pos += sprintf(pos, "(%d ", i);
+        }
+        for (int i=0; i<40; i++) {
+            pos += sprintf(pos, ")");
+        }
+    }
+    for (int i=0; i<100; i++) {
+        pos += sprintf(pos, i % 5 ? ")" : " 12345678)");
+    }
+    sprintf(pos, "\n");
+
+    for (char is_sized=FALSE; is_sized<=TRUE; is_sized++) {
+        struct pprint_output input = { .len=strlen(source), .calls=0 };
+        memcpy(input.buffer, source, input.len);
+        BISTACK *bs = bistack_new(1<<16);
+        bistack_pushdir(bs, BS_BACKWARD);
+        READER *reader = reader_new(environment_new(bs));
+        reader_set_getc(reader, memgetc, &input);
+        reader_set_putc(reader, memputc, &output);
+        reader_set_pprint_width(reader, 40);
+        reader_set_sized_lists(reader, is_sized);
+        mu_assert("deep form should read", reader_read(reader));
+
+        output.len = output.calls = 0;
+        while (!reader_pprint(reader));
+        mu_assert("deep pprint left a context", reader->pprint_context == NULL);
+
+        BISTACK *reread_bs = bistack_new(1<<16);
+        bistack_pushdir(reread_bs, BS_BACKWARD);
+        READER *reread = reader_new(environment_new(reread_bs));
+        output.calls = 0;
+        reader_set_getc(reread, memgetc, &output);
+        reader_set_sized_lists(reread, is_sized);
+        mu_assert("deep pprint output should read", reader_read(reread));
+        CELLHEADER *form = reader->reader_context->cellheader;
+        CELLHEADER *reread_form = reread->reader_context->cellheader;
+        mu_assert("deep pprint output differs",
+            cell_size(form) == cell_size(reread_form) &&
+            memcmp(form, reread_form, cell_size(form)) == 0);
+        bistack_destroy(reread_bs);
+        bistack_destroy(bs);
+    }
     return 0;
 }
 
+static char * test_reader_pprint(
+        char *test_lisp_file, char *expected_output) {
+    char *message = check_pprint(test_lisp_file, expected_output, FALSE);
+    if (!message) {
+        message = check_pprint(test_lisp_file, expected_output, TRUE);
+    }
+    return message;
+}
+
 
 /**
  * Verifies reader_read can handle EOFs and continueing by only allowing
@@ -163,6 +318,191 @@ static char * test_reader_start_stop(
     return 0;
 }
 
+/**
+ * Counts the events sent while reading in event mode.
+ */
+struct event_counts {
+    int opens;
+    int closes;
+    int depth;
+    int max_depth;
+    int atoms;
+    // symbols whose running hashes differ from hashing their names again
+    READER *reader;
+    int bad_hashes;
+};
+
+#define TEST_BUILTIN_SEED 81
+
+static void check_hashes(struct event_counts *counts, char *str, uint8_t len) {
+    uint8_t builtin_hash = TEST_BUILTIN_SEED;
+    for (uint8_t i=0; i<len; i++) {
+        builtin_hash = hashstr_8_step(builtin_hash, str[i]);
+    }
+    if (reader_symbol_hash(counts->reader) != hashstr_8(str, len) ||
+            reader_symbol_builtin_hash(counts->reader) != builtin_hash) {
+        counts->bad_hashes++;
+    }
+}
+
+void count_list_open(void *streamobj, uint8_t prefix) {
+    struct event_counts *counts = (struct event_counts*)streamobj;
+    counts->opens++;
+    if (++counts->depth > counts->max_depth) {
+        counts->max_depth = counts->depth;
+    }
+}
+
+void count_list_close(void *streamobj) {
+    struct event_counts *counts = (struct event_counts*)streamobj;
+    counts->closes++;
+    counts->depth--;
+}
+
+void count_symbol(void *streamobj, uint8_t prefix, char *str, uint8_t len) {
+    ((struct event_counts*)streamobj)->atoms++;
+    check_hashes((struct event_counts*)streamobj, str, len);
+}
+
+void count_string(void *streamobj, char *str, uint8_t len) {
+    ((struct event_counts*)streamobj)->atoms++;
+    check_hashes((struct event_counts*)streamobj, str, len);
+}
+
+void count_integer(void *streamobj, int32_t value) {
+    ((struct event_counts*)streamobj)->atoms++;
+}
+
+/**
+ * Walks a read cell, counting its lists and atoms.
+ * @return The cell following cellheader
+ */
+CELLHEADER *count_cells(CELLHEADER *cellheader, int *lists, int *atoms) {
+    if (cellheader->List.type == AST_LIST) {
+        int length = cellheader->List.length;
+        (*lists)++;
+        cellheader = &cellheader[1];
+        while (length--) {
+            cellheader = count_cells(cellheader, lists, atoms);
+        }
+        return cellheader;
+    } else if (cellheader->Integer.type == AST_INTEGER) {
+        (*atoms)++;
+        return &cellheader[1];
+    } else {
+        (*atoms)++;
+        return (CELLHEADER*)(
+            (char*)&cellheader[1] + cellheader->Symbol.length);
+    }
+}
+
+/**
+ * Verifies event mode reports every cell without keeping any of them.
+ */
+static char * test_reader_events(
+        char *test_lisp_file, char *expected_output) {
+    struct file_with_eof_flag streamobj;
+    streamobj.file = fopen(test_lisp_file, "rb");
+    streamobj.characters_to_read = -1;
+
+    struct event_counts counts = {0};
+    READER_EVENTS events = {
+        .streamobj = &counts,
+        .list_open = count_list_open,
+        .list_close = count_list_close,
+        .symbol = count_symbol,
+        .string = count_string,
+        .integer = count_integer,
+    };
+
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    ENVIRONMENT *environment = environment_new(bs);
+    READER *reader = reader_new(environment);
+    reader_set_getc(reader, mygetc, &streamobj);
+    reader_set_events(reader, &events);
+    reader_set_builtin_seed(reader, TEST_BUILTIN_SEED);
+    counts.reader = reader;
+    while (!feof(streamobj.file)) {
+        bool res = reader_read(reader);
+        mu_assert("reader should complete", res);
+    }
+    mu_assert("wrong running hash", counts.bad_hashes == 0);
+    mu_assert("cells kept in event mode",
+        bs->forwardptr == (void*)&reader->reader_context->cellheader[1]);
+    mu_assert("unbalanced list events", counts.opens == counts.closes);
+
+    // compare against the cells of the materialised tree
+    int lists = 0;
+    int atoms = 0;
+    count_cells((CELLHEADER*)expected_output, &lists, &atoms);
+    // the root list has no events
+    mu_assert("wrong list event count", counts.opens == lists - 1);
+    mu_assert("wrong atom event count", counts.atoms == atoms);
+    bistack_destroy(bs);
+    fclose(streamobj.file);
+    return 0;
+}
+
+/**
+ * Tracks the forms passed to form_ready against the expected cells.
+ */
+struct form_check {
+    CELLHEADER *expected;
+    int forms;
+    int mismatches;
+};
+
+void check_form(void *streamobj, CELLHEADER *form) {
+    struct form_check *check = (struct form_check*)streamobj;
+    int lists = 0;
+    int atoms = 0;
+    CELLHEADER *next = count_cells(check->expected, &lists, &atoms);
+    size_t len = (char*)next - (char*)check->expected;
+    if (memcmp(form, check->expected, len) != 0) {
+        check->mismatches++;
+    }
+    check->expected = next;
+    check->forms++;
+}
+
+/**
+ * Verifies each top-level form is handed over as it completes and released.
+ */
+static char * test_reader_form_ready(
+        char *test_lisp_file, char *expected_output) {
+    struct file_with_eof_flag streamobj;
+    streamobj.file = fopen(test_lisp_file, "rb");
+    streamobj.characters_to_read = -1;
+
+    CELLHEADER *expected_root = (CELLHEADER*)expected_output;
+    struct form_check check = {
+        .expected = &expected_root[1],
+        .forms = 0,
+        .mismatches = 0,
+    };
+
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    ENVIRONMENT *environment = environment_new(bs);
+    READER *reader = reader_new(environment);
+    reader_set_getc(reader, mygetc, &streamobj);
+    reader_set_form_ready(reader, check_form, &check);
+    while (!feof(streamobj.file)) {
+        bool res = reader_read(reader);
+        mu_assert("reader should complete", res);
+    }
+    mu_assert("wrong number of forms",
+        check.forms == expected_root->List.length);
+    mu_assert("form differs from tree read", check.mismatches == 0);
+    mu_assert("forms not released",
+        reader->reader_context->cellheader->List.length == 0 &&
+        bs->forwardptr == (void*)&reader->reader_context->cellheader[1]);
+    bistack_destroy(bs);
+    fclose(streamobj.file);
+    return 0;
+}
+
 static char *batch_tests() {
     static char fullmessage[1024];
     struct TESTDATA {
@@ -195,6 +535,14 @@ static char *batch_tests() {
             .testfn=test_reader_start_stop,
             .fnname="test_reader_start_stop"
         },
+        {
+            .testfn=test_reader_events,
+            .fnname="test_reader_events"
+        },
+        {
+            .testfn=test_reader_form_ready,
+            .fnname="test_reader_form_ready"
+        },
     };
 
     char *message = NULL;
@@ -239,6 +587,10 @@ int main(int argc, char **argv) {
     char *result = 0;
     if (!result) result = sanity_tests();
     if (!result) result = batch_tests();
+    if (!result) {
+        tests_run++;
+        result = test_pprint_deep();
+    }
 
     if (result != 0) {
         printf("%s\n", result);
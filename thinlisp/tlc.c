@@ -0,0 +1,449 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "utils.h"
+#include "bistack.h"
+#include "cell.h"
+#include "tlc.h"
+
+// one bucket per hashstr_8 value
+#define TLC_BUCKETS 256
+
+typedef struct tlc_symbol {
+    // the next symbol in the same bucket, and in order of first use
+    struct tlc_symbol *bucket_next;
+    struct tlc_symbol *next;
+    CELLHEADER *symbol;
+    uint8_t hash;
+} TLC_SYMBOL;
+
+
+static void tlc_write(FILE *file, const void *data, size_t len) {
+    lassert(fwrite(data, 1, len, file) == len, TLC_IO_ERROR);
+}
+
+void tlc_save(BISTACK *bs, FILE *file, CELLHEADER *forms, uint16_t nforms) {
+    void *start_mark = bistack_mark(bs);
+    TLC_SYMBOL **buckets = bistack_alloc(bs, TLC_BUCKETS * sizeof(TLC_SYMBOL*));
+    memset(buckets, 0, TLC_BUCKETS * sizeof(TLC_SYMBOL*));
+    TLC_SYMBOL *first = NULL;
+    TLC_SYMBOL *last = NULL;
+
+    TLC_HEADER header = {
+        .version=TLC_VERSION,
+        .reserved=0,
+        .probe=TLC_PROBE,
+        .nforms=nforms,
+        .nsymbols=0,
+        .symbols_len=0,
+    };
+    memcpy(header.magic, TLC_MAGIC, sizeof(header.magic));
+
+    // collect each distinct symbol name, strings are not symbols
+    CELL_WALK walk;
+    CELLHEADER *cell;
+    cell_walk_init(&walk, forms, nforms);
+    while ((cell = cell_walk_next(&walk))) {
+        if (cell->Symbol.type != AST_SYMBOL ||
+                cell->Symbol.prefix == AST_DOUBLEQUOTE) {
+            continue;
+        }
+        char *name = (char*)&cell[1];
+        uint8_t length = cell->Symbol.length;
+        uint8_t hash = hashstr_8(name, length);
+        TLC_SYMBOL *symbol = buckets[hash];
+        while (symbol && !(
+                symbol->symbol->Symbol.length == length &&
+                memcmp(&symbol->symbol[1], name, length) == 0)) {
+            symbol = symbol->bucket_next;
+        }
+        if (symbol) {
+            continue;
+        }
+
+        lassert(header.nsymbols < UINT16_MAX, CELL_OVERFLOW_ERROR);
+        symbol = bistack_alloc(bs, sizeof(TLC_SYMBOL));
+        symbol->bucket_next = buckets[hash];
+        symbol->next = NULL;
+        symbol->symbol = cell;
+        symbol->hash = hash;
+        buckets[hash] = symbol;
+        if (last) {
+            last->next = symbol;
+        } else {
+            first = symbol;
+        }
+        last = symbol;
+        header.nsymbols++;
+        header.symbols_len += 2 + length;
+    }
+    header.cells_len = (char*)walk.next - (char*)forms;
+
+    header.checksum = fnv_32_buf(forms, header.cells_len, FNV1_32_INIT);
+    for (TLC_SYMBOL *symbol=first; symbol; symbol=symbol->next) {
+        uint8_t entry[2] = { symbol->symbol->Symbol.length, symbol->hash };
+        header.checksum = fnv_32_buf(entry, 2, header.checksum);
+        header.checksum = fnv_32_buf(
+            &symbol->symbol[1], entry[0], header.checksum);
+    }
+
+    tlc_write(file, &header, sizeof(header));
+    tlc_write(file, forms, header.cells_len);
+    for (TLC_SYMBOL *symbol=first; symbol; symbol=symbol->next) {
+        uint8_t entry[2] = { symbol->symbol->Symbol.length, symbol->hash };
+        tlc_write(file, entry, 2);
+        tlc_write(file, &symbol->symbol[1], entry[0]);
+    }
+
+    lassert(start_mark == bistack_rewind(bs), READER_STATE_ERROR);
+}
+
+
+static void *tlc_read(BISTACK *bs, FILE *file, uint32_t len) {
+    /**
+     * Reads len bytes onto the forward stack of bs.  Allocations are limited
+     * to 16 bits, so large sections are read in pieces.
+     * @return The address of the first byte, or NULL if the file ended
+     */
+    char *start = bs->forwardptr;
+    while (len) {
+        uint16_t piece = len > 0x8000 ? 0x8000 : len;
+        if (fread(bistack_allocf(bs, piece), 1, piece, file) != piece) {
+            return NULL;
+        }
+        len -= piece;
+    }
+    return start;
+}
+
+TLC_MODULE *tlc_load(BISTACK *bs, FILE *file, TLC_MODULE *module) {
+    TLC_HEADER header;
+    lassert(
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, TLC_MAGIC, sizeof(header.magic)) == 0,
+        TLC_FORMAT_ERROR);
+    lassert(header.version == TLC_VERSION, TLC_VERSION_ERROR);
+    lassert(
+        memcmp(&header.probe, &TLC_PROBE, sizeof(TLC_PROBE)) == 0,
+        TLC_FORMAT_ERROR);
+
+    // both sections must fit the free space before any of them is read
+    size_t available = (char*)bs->backwardptr - (char*)bs->forwardptr;
+    lassert(
+        header.cells_len <= available &&
+        header.symbols_len <= available - header.cells_len,
+        TLC_FORMAT_ERROR);
+
+    void *start = bs->forwardptr;
+    int error = 0;
+    module->forms = tlc_read(bs, file, header.cells_len);
+    module->nforms = header.nforms;
+    module->symbols = NULL;
+    module->nsymbols = header.nsymbols;
+    if (module->forms) {
+        module->symbols = tlc_read(bs, file, header.symbols_len);
+    }
+
+    if (module->forms == NULL || module->symbols == NULL) {
+        error = TLC_IO_ERROR;
+
+    } else if (fnv_32_buf(
+            module->symbols,
+            header.symbols_len,
+            fnv_32_buf(module->forms, header.cells_len, FNV1_32_INIT))
+            != header.checksum) {
+        error = TLC_CHECKSUM_ERROR;
+
+    } else {
+        // the forms and the symbol table entries must end their sections,
+        // and neither is read past its end on the way
+        CELL_WALK walk;
+        cell_walk_init(&walk, module->forms, module->nforms);
+        cell_walk_bound(&walk, module->symbols);
+        while (cell_walk_next(&walk)) {
+        }
+        uint8_t *symbol = module->symbols;
+        uint8_t *symbols_end = module->symbols + header.symbols_len;
+        for (uint16_t i=0; i<module->nsymbols && symbol; i++) {
+            symbol = (
+                symbols_end - symbol >= 2 &&
+                symbols_end - symbol - 2 >= symbol[0] ?
+                tlc_next_symbol(symbol) : NULL);
+        }
+        if (walk.remaining || (void*)walk.next != (void*)module->symbols ||
+                symbol != symbols_end) {
+            error = TLC_FORMAT_ERROR;
+        }
+    }
+
+    if (error) {
+        bistack_releasef(bs, start);
+        lerror(error, PSTR("tlc_load"));
+    }
+    return module;
+}
+
+
+#ifdef TLC_TEST
+#include "reader.h"
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static char filegetc(void *file) {
+    int c = fgetc((FILE*)file);
+    return c == EOF ? -1 : c;
+}
+
+static READER *read_file(char *filename, char is_sized) {
+    BISTACK *bs = bistack_new(1<<18);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    FILE *file = fopen(filename, "rb");
+    reader_set_getc(reader, filegetc, file);
+    reader_set_sized_lists(reader, is_sized);
+    while (!feof(file)) {
+        reader_read(reader);
+    }
+    fclose(file);
+    return reader;
+}
+
+static FILE *save(READER *reader) {
+    FILE *file = tmpfile();
+    CELLHEADER *root = reader->reader_context->cellheader;
+    tlc_save(
+        reader->environment->bs, file,
+        cell_list_first(root), cell_list_length(root));
+    rewind(file);
+    return file;
+}
+
+static char *test_round_trip() {
+    for (char is_sized=FALSE; is_sized<=TRUE; is_sized++) {
+        READER *reader = read_file("tests/samples/sample2.lisp", is_sized);
+        BISTACK *bs = reader->environment->bs;
+        CELLHEADER *root = reader->reader_context->cellheader;
+        void *forwardptr = bs->forwardptr;
+        FILE *file = save(reader);
+        mu_assert("save left allocations", bs->forwardptr == forwardptr);
+
+        BISTACK *load_bs = bistack_new(1<<18);
+        TLC_MODULE module;
+        tlc_load(load_bs, file, &module);
+        fclose(file);
+
+        size_t len = (char*)forwardptr - (char*)cell_list_first(root);
+        mu_assert("wrong form count", module.nforms == cell_list_length(root));
+        mu_assert("forms differ",
+            memcmp(module.forms, cell_list_first(root), len) == 0);
+
+        // every symbol name appears once
+        uint8_t *symbol = module.symbols;
+        char found_defun = FALSE;
+        for (uint16_t i=0; i<module.nsymbols; i++) {
+            mu_assert("wrong hash",
+                symbol[1] == hashstr_8((char*)&symbol[2], symbol[0]));
+            if (symbol[0] == 5 && memcmp(&symbol[2], "defun", 5) == 0) {
+                mu_assert("duplicate symbol", !found_defun);
+                found_defun = TRUE;
+            }
+            symbol = tlc_next_symbol(symbol);
+        }
+        mu_assert("defun not in symbol table", found_defun);
+
+        bistack_destroy(load_bs);
+        bistack_destroy(bs);
+    }
+    return 0;
+}
+
+static char *test_rejects_damage() {
+    READER *reader = read_file("tests/samples/sample1.lisp", TRUE);
+    FILE *file = save(reader);
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+
+    struct {
+        long offset;
+        char value;
+        int error;
+    } damage[] = {
+        { 0, 'X', TLC_FORMAT_ERROR },
+        { 4, TLC_VERSION + 1, TLC_VERSION_ERROR },
+        { 6, 0x55, TLC_FORMAT_ERROR },
+        { sizeof(TLC_HEADER) + 3, 'X', TLC_CHECKSUM_ERROR },
+        { len - 1, 'X', TLC_CHECKSUM_ERROR },
+    };
+
+    BISTACK *load_bs = bistack_new(1<<16);
+    void *forwardptr = load_bs->forwardptr;
+    for (int i=0; i<sizeof(damage)/sizeof(damage[0]); i++) {
+        char original;
+        fseek(file, damage[i].offset, SEEK_SET);
+        original = fgetc(file);
+        fseek(file, damage[i].offset, SEEK_SET);
+        fputc(damage[i].value, file);
+        rewind(file);
+
+        TLC_MODULE module;
+        int exctype = setjmp(__jmpbuff);
+        if (exctype == 0) {
+            tlc_load(load_bs, file, &module);
+            mu_assert("damage not detected", 0);
+        }
+        mu_assert("wrong error", exctype == damage[i].error);
+        mu_assert("failed load left allocations",
+            load_bs->forwardptr == forwardptr);
+
+        fseek(file, damage[i].offset, SEEK_SET);
+        fputc(original, file);
+    }
+
+    // a truncated file
+    FILE *truncated = tmpfile();
+    rewind(file);
+    for (long i=0; i<len - 1; i++) {
+        fputc(fgetc(file), truncated);
+    }
+    rewind(truncated);
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        TLC_MODULE module;
+        tlc_load(load_bs, truncated, &module);
+        mu_assert("truncation not detected", 0);
+    }
+    mu_assert("wrong error", exctype == TLC_IO_ERROR);
+
+    fclose(truncated);
+    fclose(file);
+    bistack_destroy(load_bs);
+    bistack_destroy(reader->environment->bs);
+    return 0;
+}
+
+static FILE *save_raw(TLC_HEADER *header, void *cells, uint32_t len) {
+    /**
+     * Writes a file of the header and len bytes of cells, checksummed as
+     * though the header's lengths were right.
+     */
+    memcpy(header->magic, TLC_MAGIC, sizeof(header->magic));
+    header->version = TLC_VERSION;
+    header->reserved = 0;
+    header->probe = TLC_PROBE;
+    header->checksum = fnv_32_buf(cells, len, FNV1_32_INIT);
+    FILE *file = tmpfile();
+    tlc_write(file, header, sizeof(*header));
+    tlc_write(file, cells, len);
+    rewind(file);
+    return file;
+}
+
+static char *test_rejects_overreach() {
+    // a sized list spanning past the cells, then lengths past the free space
+    uint8_t cells[sizeof(CELLHEADER) + CELL_SIZED_LIST_HEADER];
+    CELLHEADER list = {
+        .Extended={ .type=AST_NONE, .kind=CELL_EXT_LIST, .prefix=0, .flags=0 }
+    };
+    memcpy(cells, &list, sizeof(list));
+    cell_put16(&cells[sizeof(list)], 1);
+    cell_put16(&cells[sizeof(list) + sizeof(uint16_t)], 200);
+
+    TLC_HEADER headers[] = {
+        { .nforms=1, .nsymbols=0, .cells_len=sizeof(cells), .symbols_len=0 },
+        { .nforms=1, .nsymbols=0, .cells_len=0xfffffff0, .symbols_len=0 },
+        { .nforms=0, .nsymbols=1, .cells_len=0, .symbols_len=0xfffffff0 },
+    };
+    BISTACK *load_bs = bistack_new(1<<16);
+    void *forwardptr = load_bs->forwardptr;
+    for (int i=0; i<sizeof(headers)/sizeof(headers[0]); i++) {
+        FILE *file = save_raw(&headers[i], cells, sizeof(cells));
+        TLC_MODULE module;
+        int exctype = setjmp(__jmpbuff);
+        if (exctype == 0) {
+            tlc_load(load_bs, file, &module);
+            mu_assert("overreach not detected", 0);
+        }
+        mu_assert("wrong error", exctype == TLC_FORMAT_ERROR);
+        mu_assert("failed load left allocations",
+            load_bs->forwardptr == forwardptr);
+        fclose(file);
+    }
+    bistack_destroy(load_bs);
+    return 0;
+}
+
+static char *test_rejects_deep_tables() {
+    /**
+     * More indexed lists open at once than a walk holds is a format error,
+     * however well checksummed, and leaves nothing allocated.
+     */
+    static char source[4096];
+    char *pos = source;
+    for (int i=0; i<CELL_WALK_DEPTH + 1; i++) {
+        pos += sprintf(pos, "(");
+        for (int j=0; j<CELL_LIST_INDEX_MIN; j++) {
+            pos += sprintf(pos, "%d ", j);
+        }
+    }
+    for (int i=0; i<CELL_WALK_DEPTH + 1; i++) {
+        pos += sprintf(pos, ")");
+    }
+    sprintf(pos, "\n");
+    FILE *file = fmemopen(source, strlen(source), "rb");
+    BISTACK *bs = bistack_new(1<<16);
+    bistack_pushdir(bs, BS_BACKWARD);
+    READER *reader = reader_new(environment_new(bs));
+    reader_set_getc(reader, filegetc, file);
+    reader_set_sized_lists(reader, TRUE);
+    mu_assert("deep form not read", reader_read(reader));
+    fclose(file);
+
+    CELLHEADER *form = cell_list_first(reader->reader_context->cellheader);
+    mu_assert("deep form not indexed",
+        cell_is_sized_list(form) &&
+        (form->Extended.flags & CELL_LIST_INDEXED));
+    TLC_HEADER header = {
+        .nforms=1, .nsymbols=0, .cells_len=cell_size(form), .symbols_len=0 };
+    file = save_raw(&header, form, header.cells_len);
+
+    BISTACK *load_bs = bistack_new(1<<16);
+    void *forwardptr = load_bs->forwardptr;
+    TLC_MODULE module;
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        tlc_load(load_bs, file, &module);
+        mu_assert("deep tables accepted", 0);
+    }
+    mu_assert("wrong error", exctype == TLC_FORMAT_ERROR);
+    mu_assert("failed load left allocations",
+        load_bs->forwardptr == forwardptr);
+
+    fclose(file);
+    bistack_destroy(load_bs);
+    bistack_destroy(bs);
+    return 0;
+}
+
+static char *all_tests() {
+    mu_run_test(test_round_trip);
+    mu_run_test(test_rejects_damage);
+    mu_run_test(test_rejects_overreach);
+    mu_run_test(test_rejects_deep_tables);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
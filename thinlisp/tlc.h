@@ -0,0 +1,85 @@
+#ifndef TLC_H
+#define TLC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "defines.h"
+#include "bistack.h"
+#include "cell.h"
+
+/*
+ * A .tlc file holds forms already read into cells, so loading them is a
+ * copy rather than a parse:
+ *
+ *   TLC_HEADER | cells of each form | symbol table
+ *
+ * Cells are stored exactly as the reader lays them out.  The header records
+ * a probe cell, so files written on a host with a different bitfield layout
+ * or byte order are rejected instead of misread.  The symbol table lists
+ * each distinct symbol name used by the forms once, as
+ *
+ *   uint8 length | uint8 hashstr_8 of the name | name
+ *
+ * so a loader can intern them before any form runs.  The checksum is
+ * fnv_32_buf over the cells and then the symbol table.
+ */
+#define TLC_MAGIC "\x7fTLC"
+#define TLC_VERSION 1
+
+// a header whose bytes differ under any other bitfield layout or byte order
+static const CELLHEADER TLC_PROBE = {
+    .List={ .type=AST_LIST, .prefix=0x9, .length=0x2a5 }
+};
+
+typedef struct tlc_header {
+    char magic[4];
+    uint8_t version;
+    uint8_t reserved;
+    // TLC_PROBE as written by the host which saved the file
+    CELLHEADER probe;
+    uint16_t nforms;
+    uint16_t nsymbols;
+    uint32_t cells_len;
+    uint32_t symbols_len;
+    uint32_t checksum;
+} TLC_HEADER;
+
+typedef struct tlc_module {
+    // the first form, the others follow it
+    CELLHEADER *forms;
+    uint16_t nforms;
+    // the first symbol table entry, see above
+    uint8_t *symbols;
+    uint16_t nsymbols;
+} TLC_MODULE;
+
+/**
+ * Writes forms to file in the .tlc format.
+ * @param[in] bs Temporary space for building the symbol table
+ * @param[in] file The file to write to
+ * @param[in] forms The first form, followed by the others
+ * @param[in] nforms The number of forms
+ */
+void tlc_save(BISTACK *bs, FILE *file, CELLHEADER *forms, uint16_t nforms);
+
+/**
+ * Loads a .tlc file by copying its cells and symbol table onto the forward
+ * stack of bs, where they stay until the caller releases them.  The header,
+ * checksum and the extent of the forms are validated; on an error nothing
+ * remains allocated.
+ * @param[in] bs The bistack receiving the forms
+ * @param[in] file The file to read from
+ * @param[out] module Receives the location of the forms and symbols
+ * @return module
+ */
+TLC_MODULE *tlc_load(BISTACK *bs, FILE *file, TLC_MODULE *module);
+
+/**
+ * Steps to the next entry of a module's symbol table.
+ * @return The entry following symbol
+ */
+static inline uint8_t *tlc_next_symbol(uint8_t *symbol) {
+    return symbol + 2 + symbol[0];
+}
+
+#endif
@@ -14,7 +14,22 @@
 #define MASK_16 (((uint32_t)1<<16)-1) /* i.e., (u_int32_t)0xffff */
 #define FNV1_32_INIT ((uint32_t)2166136261L)
 
+static const uint8_t SHUFFLED_NIBBLE[] = {
+  1, 5, 12, 4, 8, 13, 7, 15, 11, 9, 10, 2, 0, 14, 6, 3
+};
+
 uint32_t fnv_32_buf(void *datap, int datalen, uint32_t offset_basis);
 uint32_t hashstr(char *str, int strlen);
 uint8_t hashstr_8(char *str, int strlen);
+
+/**
+ * Adds one character to a hashstr_8 style hash, for hashing names as they
+ * are read.  hashstr_8 starts from 0, other starting values give other
+ * hashes of the same strength.
+ */
+static inline uint8_t hashstr_8_step(uint8_t hash, char c) {
+  uint8_t newindex = hash + (uint8_t)c;
+  return (
+    (SHUFFLED_NIBBLE[newindex >> 4] << 4) + SHUFFLED_NIBBLE[newindex & 0xf]);
+}
 #endif
@@ -0,0 +1,274 @@
+#include <string.h>
+
+#include "defines.h"
+#include "runtime.h"
+#include "bistack.h"
+#include "cell.h"
+#include "value.h"
+#include "utils.h"
+#include "rom.h"
+
+typedef struct value_ram_symbol {
+    // the next symbol of the same bucket, as its index + 1, or 0
+    uint16_t next;
+    // the offset of the name in names
+    uint16_t name;
+    uint8_t length;
+    uint8_t hash;
+} VALUE_RAM_SYMBOL;
+
+static struct {
+    // the first symbol of each bucket, as its index + 1, or 0
+    uint16_t buckets[VALUE_RAM_BUCKETS];
+    VALUE_RAM_SYMBOL symbols[VALUE_RAM_SYMBOLS];
+    char names[VALUE_RAM_NAMES];
+    uint16_t nsymbols;
+    uint16_t names_len;
+} value_ram;
+
+
+VALUE value_of_cell(BISTACK *bs, CELLHEADER *cell) {
+    uintptr_t offset = (uint8_t*)cell - (uint8_t*)bs;
+    lassert(
+        offset >= sizeof(BISTACK) && offset <= VALUE_CELL_MAX,
+        VALUE_RANGE_ERROR);
+    return offset;
+}
+
+
+uint16_t value_intern(const char *name, uint8_t length) {
+    int16_t id = rom_findsymbol(name, length, NULL);
+    if (id >= 0) {
+        return id;
+    }
+
+    uint8_t hash = hashstr_8((char*)name, length);
+    uint16_t *bucket = &value_ram.buckets[hash % VALUE_RAM_BUCKETS];
+    for (uint16_t i=*bucket; i; i=value_ram.symbols[i - 1].next) {
+        VALUE_RAM_SYMBOL *symbol = &value_ram.symbols[i - 1];
+        if (symbol->hash == hash && symbol->length == length &&
+                memcmp(&value_ram.names[symbol->name], name, length) == 0) {
+            return rom_nsymbols + i - 1;
+        }
+    }
+
+    lassert(
+        value_ram.nsymbols < VALUE_RAM_SYMBOLS &&
+        rom_nsymbols + value_ram.nsymbols <= VALUE_SYMBOL_MAX &&
+        length <= VALUE_RAM_NAMES - value_ram.names_len,
+        VALUE_RANGE_ERROR);
+    VALUE_RAM_SYMBOL *symbol = &value_ram.symbols[value_ram.nsymbols];
+    symbol->next = *bucket;
+    symbol->name = value_ram.names_len;
+    symbol->length = length;
+    symbol->hash = hash;
+    memcpy(&value_ram.names[value_ram.names_len], name, length);
+    value_ram.names_len += length;
+    *bucket = ++value_ram.nsymbols;
+    return rom_nsymbols + value_ram.nsymbols - 1;
+}
+
+
+void value_intern_reset(void) {
+    memset(value_ram.buckets, 0, sizeof(value_ram.buckets));
+    value_ram.nsymbols = 0;
+    value_ram.names_len = 0;
+}
+
+
+VALUE value_from_cell(BISTACK *bs, CELLHEADER *cell) {
+    if (cell_is_integer(cell)) {
+        int32_t n = cell_integer_value(cell);
+        if (value_fixnum_fits(n)) {
+            return value_fixnum(n);
+        }
+    } else if (cell->Symbol.type == AST_SYMBOL &&
+            cell->Symbol.prefix == AST_NOPREFIX) {
+        return value_symbol(
+            value_intern((char*)&cell[1], cell->Symbol.length));
+    }
+    return value_of_cell(bs, cell);
+}
+
+
+char value_is_integer(BISTACK *bs, VALUE v) {
+    return (
+        VALUE_IS_FIXNUM(v) ||
+        (VALUE_IS_CELL(v) && !VALUE_IS_NIL(v) &&
+            cell_is_integer(value_cell(bs, v))));
+}
+
+
+int32_t value_integer(BISTACK *bs, VALUE v) {
+    if (VALUE_IS_FIXNUM(v)) {
+        return value_fixnum_value(v);
+    }
+    lassert(value_is_integer(bs, v), VALUE_TYPE_ERROR);
+    return cell_integer_value(value_cell(bs, v));
+}
+
+
+#ifdef VALUE_TEST
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include "tests/minunit.h"
+
+int tests_run = 0;
+
+static char * test_fixnums() {
+    int32_t samples[] = {
+        0, 1, -1, 42, -42, VALUE_FIXNUM_MAX, VALUE_FIXNUM_MIN, 8191, -8192};
+    for (int i=0; i<sizeof(samples)/sizeof(samples[0]); i++) {
+        VALUE v = value_fixnum(samples[i]);
+        mu_assert("not a fixnum", VALUE_IS_FIXNUM(v));
+        mu_assert("fixnum is a symbol", !VALUE_IS_SYMBOL(v));
+        mu_assert("fixnum is a cell", !VALUE_IS_CELL(v));
+        mu_assert("wrong fixnum", value_fixnum_value(v) == samples[i]);
+    }
+    mu_assert("too large fits", !value_fixnum_fits(VALUE_FIXNUM_MAX + 1));
+    mu_assert("too small fits", !value_fixnum_fits(VALUE_FIXNUM_MIN - 1));
+
+    VALUE sym = value_symbol(VALUE_SYMBOL_MAX);
+    mu_assert("not a symbol", VALUE_IS_SYMBOL(sym) && !VALUE_IS_FIXNUM(sym));
+    mu_assert("wrong symbol id", value_symbol_id(sym) == VALUE_SYMBOL_MAX);
+    mu_assert("symbols differ", VALUE_EQ(value_symbol(7), value_symbol(7)));
+    mu_assert("symbol equals fixnum",
+        !VALUE_EQ(value_symbol(7), value_fixnum(7)));
+    mu_assert("nil is not a cell", VALUE_IS_CELL(VALUE_NIL));
+    return 0;
+}
+
+
+static char * test_cells() {
+    static uint8_t heap[1 << 15];
+    BISTACK *bs = bistack_init(heap, sizeof(heap));
+
+    // integers become fixnums without taking any space
+    const CELLHEADER zero = { .Integer={ .type=AST_INTEGER, .sign=1 } };
+    CELLHEADER *small = bistack_allocf(bs, sizeof(CELLHEADER));
+    *small = zero;
+    cell_set_integer(bs, small, -1234);
+    CELLHEADER *large = bistack_allocf(bs, sizeof(CELLHEADER));
+    *large = zero;
+    cell_set_integer(bs, large, 100000);
+    void *end = bs->forwardptr;
+    VALUE v = value_from_cell(bs, small);
+    mu_assert("small integer not a fixnum", VALUE_IS_FIXNUM(v));
+    mu_assert("wrong small integer", value_integer(bs, v) == -1234);
+    v = value_from_cell(bs, large);
+    mu_assert("large integer not a cell", VALUE_IS_CELL(v));
+    mu_assert("wrong cell", value_cell(bs, v) == large);
+    mu_assert("large integer not an integer", value_is_integer(bs, v));
+    mu_assert("wrong large integer", value_integer(bs, v) == 100000);
+    mu_assert("values allocated", bs->forwardptr == end);
+
+    // symbols of the ROM image are the same wherever they were read
+    VALUE cars[2];
+    for (int i=0; i<2; i++) {
+        CELLHEADER *car = bistack_allocf(bs, sizeof(CELLHEADER) + 3);
+        car->Symbol.type = AST_SYMBOL;
+        car->Symbol.length = 3;
+        car->Symbol.prefix = AST_NOPREFIX;
+        memcpy(&car[1], "car", 3);
+        cars[i] = value_from_cell(bs, car);
+    }
+    mu_assert("rom symbol not interned", VALUE_IS_SYMBOL(cars[0]));
+    mu_assert("rom symbols differ", VALUE_EQ(cars[0], cars[1]));
+    mu_assert("wrong symbol id",
+        value_symbol_id(cars[0]) == rom_findsymbol("car", 3, NULL));
+
+    // as are other symbols, interned above the ROM image's, and strings
+    // stay cells
+    VALUE foos[2];
+    for (int i=0; i<2; i++) {
+        CELLHEADER *foo = bistack_allocf(bs, sizeof(CELLHEADER) + 3);
+        foo->Symbol.type = AST_SYMBOL;
+        foo->Symbol.length = 3;
+        foo->Symbol.prefix = AST_NOPREFIX;
+        memcpy(&foo[1], "foo", 3);
+        foos[i] = value_from_cell(bs, foo);
+        memcpy(&foo[1], "xxx", 3);
+    }
+    mu_assert("ram symbol not interned", VALUE_IS_SYMBOL(foos[0]));
+    mu_assert("ram symbols differ", VALUE_EQ(foos[0], foos[1]));
+    mu_assert("ram symbol among rom ids",
+        value_symbol_id(foos[0]) >= rom_nsymbols);
+    mu_assert("ram symbol equals another",
+        !VALUE_EQ(foos[0], value_symbol(value_intern("fop", 3))));
+
+    CELLHEADER *string = bistack_allocf(bs, sizeof(CELLHEADER) + 3);
+    string->Symbol.type = AST_SYMBOL;
+    string->Symbol.length = 3;
+    string->Symbol.prefix = AST_DOUBLEQUOTE;
+    memcpy(&string[1], "foo", 3);
+    mu_assert("string not a cell", VALUE_IS_CELL(value_from_cell(bs, string)));
+    mu_assert("values allocated", bs->forwardptr == (void*)&string[1] + 3);
+
+    v = foos[0];
+    mu_assert("symbol is an integer", !value_is_integer(bs, v));
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        value_integer(bs, v);
+        mu_assert("symbol read as an integer", 0);
+    } else {
+        mu_assert("wrong error", exctype == VALUE_TYPE_ERROR);
+    }
+
+    // cells are only addressable near the start of the bistack
+    bistack_allocf(bs, VALUE_CELL_MAX);
+    exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        value_of_cell(bs, bistack_allocf(bs, sizeof(CELLHEADER)));
+        mu_assert("distant cell referred to", 0);
+    } else {
+        mu_assert("wrong error", exctype == VALUE_RANGE_ERROR);
+    }
+    return 0;
+}
+
+
+static char * test_intern_full() {
+    value_intern_reset();
+    uint16_t first = value_intern("s0", 2);
+    for (int i=1; i<VALUE_RAM_SYMBOLS; i++) {
+        char name[8];
+        uint8_t length = sprintf(name, "s%d", i);
+        mu_assert("wrong id", value_intern(name, length) == first + i);
+    }
+    mu_assert("interned name not found", value_intern("s0", 2) == first);
+
+    int exctype = setjmp(__jmpbuff);
+    if (exctype == 0) {
+        value_intern("one too many", 12);
+        mu_assert("full table accepted a name", 0);
+    } else {
+        mu_assert("wrong error", exctype == VALUE_RANGE_ERROR);
+    }
+    value_intern_reset();
+    mu_assert("reset table kept ids", value_intern("zq", 2) == first);
+    return 0;
+}
+
+
+static char *all_tests() {
+    mu_run_test(test_fixnums);
+    mu_run_test(test_cells);
+    mu_run_test(test_intern_full);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+     char *result = all_tests();
+     if (result != 0) {
+         printf("%s\n", result);
+     } else {
+         printf("ALL TESTS PASSED\n");
+     }
+     printf("Tests run: %d\n", tests_run);
+
+     return result != 0;
+}
+
+#endif
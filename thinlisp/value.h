@@ -0,0 +1,120 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+#include "defines.h"
+#include "bistack.h"
+#include "cell.h"
+
+/*
+ * The evaluator's values, each a 16-bit word tagged by its high bits so
+ * that nothing needs to be allocated to hold an atom:
+ *
+ *   1nnnnnnnnnnnnnnn  fixnum, a 15 bit signed integer
+ *   01iiiiiiiiiiiiii  symbol, an interned symbol id
+ *   00oooooooooooooo  cell, the offset of a cell from the start of the
+ *                     bistack holding it; offset 0 is nil
+ *
+ * Symbols are interned, so two symbols are the same exactly when their ids
+ * are, and values are compared as words.  Lists and integers too large for a
+ * fixnum stay where the reader put them and are referred to as cells.
+ * Interned ids below rom_nsymbols are indexes into rom_symbols, those above
+ * are symbols first seen at run time, whose names value_intern copies into
+ * a table in RAM.
+ */
+typedef uint16_t VALUE;
+
+#define VALUE_FIXNUM_TAG 0x8000
+#define VALUE_SYMBOL_TAG 0x4000
+#define VALUE_TAG_MASK 0xc000
+#define VALUE_NIL ((VALUE)0)
+
+#define VALUE_FIXNUM_MAX ((1 << 14) - 1)
+#define VALUE_FIXNUM_MIN (-(1 << 14))
+#define VALUE_SYMBOL_MAX ((1 << 14) - 1)
+#define VALUE_CELL_MAX ((1 << 14) - 1)
+
+// symbols value_intern holds besides those of the ROM image, the bytes of
+// their names, and the buckets of their hashes
+#ifndef VALUE_RAM_SYMBOLS
+#define VALUE_RAM_SYMBOLS 128
+#endif
+#ifndef VALUE_RAM_NAMES
+#define VALUE_RAM_NAMES 1024
+#endif
+#define VALUE_RAM_BUCKETS 32
+
+#define VALUE_IS_FIXNUM(V) ((V) & VALUE_FIXNUM_TAG)
+#define VALUE_IS_SYMBOL(V) (((V) & VALUE_TAG_MASK) == VALUE_SYMBOL_TAG)
+#define VALUE_IS_CELL(V) (((V) & VALUE_TAG_MASK) == 0)
+#define VALUE_IS_NIL(V) ((V) == VALUE_NIL)
+#define VALUE_EQ(A, B) ((A) == (B))
+
+static inline char value_fixnum_fits(int32_t n) {
+  return n >= VALUE_FIXNUM_MIN && n <= VALUE_FIXNUM_MAX;
+}
+
+/**
+ * @param[in] n An integer for which value_fixnum_fits
+ */
+static inline VALUE value_fixnum(int16_t n) {
+  return VALUE_FIXNUM_TAG | ((uint16_t)n & ~VALUE_FIXNUM_TAG);
+}
+
+static inline int16_t value_fixnum_value(VALUE v) {
+  // moves the sign bit into bit 15 and shifts it back down
+  return (int16_t)(v << 1) >> 1;
+}
+
+static inline VALUE value_symbol(uint16_t id) {
+  return VALUE_SYMBOL_TAG | id;
+}
+
+static inline uint16_t value_symbol_id(VALUE v) {
+  return v & ~VALUE_TAG_MASK;
+}
+
+static inline CELLHEADER *value_cell(BISTACK *bs, VALUE v) {
+  return (CELLHEADER*)((uint8_t*)bs + v);
+}
+
+/**
+ * Refers to a cell of bs, which must lie within VALUE_CELL_MAX bytes of its
+ * start.
+ */
+VALUE value_of_cell(BISTACK *bs, CELLHEADER *cell);
+
+/**
+ * The id of a symbol name: its index in rom_symbols, or else an id above
+ * rom_nsymbols, interning the name the first time it is seen.  Raises
+ * VALUE_RANGE_ERROR once the table of interned names is full.
+ * @param[in] name The name, not necessarily terminated
+ * @param[in] length The length of name
+ */
+uint16_t value_intern(const char *name, uint8_t length);
+
+/**
+ * Forgets the names interned in RAM, whose ids may then be given to others.
+ */
+void value_intern_reset(void);
+
+/**
+ * The value of an atom or list read into cells, without allocating on bs:
+ * small integers become fixnums, unprefixed symbols their interned ids, and
+ * everything else a reference to the cell.
+ * @param[in] bs The bistack holding cell
+ * @param[in] cell The cell
+ */
+VALUE value_from_cell(BISTACK *bs, CELLHEADER *cell);
+
+/**
+ * The integer a fixnum or integer cell holds.
+ */
+int32_t value_integer(BISTACK *bs, VALUE v);
+
+/**
+ * @return TRUE if v is a fixnum or refers to an integer cell
+ */
+char value_is_integer(BISTACK *bs, VALUE v);
+
+#endif